@@ -0,0 +1,205 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BatchGenerator.h"
+#include "CodeGenContext.h"
+#include "CodeGenerator.h"
+#include "Utils.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Timer.h"
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+std::string getManifestPath(llvm::StringRef manifestDirectory,
+                            const std::string &path) {
+  if (llvm::sys::path::is_absolute(path))
+    return path;
+
+  llvm::SmallString<256> fullPath(manifestDirectory);
+  llvm::sys::path::append(fullPath, path);
+  return fullPath.str().str();
+}
+
+int readManifest(const std::string &filename,
+                 std::vector<BatchEntry> &entries) {
+  std::ifstream manifest(filename);
+  if (!manifest.is_open()) {
+    messages() << "Error opening manifest file: " << filename << ".\n";
+    return status_constants::FAIL;
+  }
+
+  auto manifestDirectory = llvm::sys::path::parent_path(filename);
+  std::string line;
+  unsigned lineNumber = 0;
+  while (getline(manifest, line)) {
+    lineNumber++;
+    std::istringstream iss(line);
+    std::vector<std::string> fields;
+    std::string field;
+    while (iss >> field)
+      fields.push_back(field);
+
+    if (fields.empty() || fields.front()[0] == '#')
+      continue;
+
+    if (fields.size() < 3) {
+      messages() << "Line " << lineNumber << " of the manifest " << filename
+                 << " should be '<config file> <output directory> <source "
+                    "file> [<source file> ...]':\n"
+                 << line << "\n";
+      return status_constants::FAIL;
+    }
+
+    BatchEntry entry;
+    entry.configFilename = getManifestPath(manifestDirectory, fields[0]);
+    entry.outputDirectory = getManifestPath(manifestDirectory, fields[1]);
+    for (auto source = fields.begin() + 2; source != fields.end(); source++)
+      entry.sources.push_back(getManifestPath(manifestDirectory, *source));
+    entry.line = lineNumber;
+    entries.push_back(entry);
+  }
+
+  return status_constants::SUCCESS;
+}
+
+void generateBatchEntry(BatchEntry &entry,
+                        const clang::tooling::CompilationDatabase &compilations,
+                        const CodeGenContext &options) {
+  auto startTime = llvm::TimeRecord::getCurrentTime(true);
+
+  // keep the messages apart from those of the other programs
+  llvm::raw_string_ostream entryMessages(entry.messages);
+  MessageRedirect redirect(entryMessages);
+
+  if (llvm::sys::fs::create_directories(entry.outputDirectory)) {
+    messages() << "Could not create the output directory "
+               << entry.outputDirectory << ".\n";
+    entry.status = status_constants::FAIL;
+  } else {
+    // the programs already run in parallel, so their sources do not
+    CodeGenContext context(entry.configFilename, entry.outputDirectory, 1);
+    context.useCache = options.useCache;
+    context.pchDirectory = options.pchDirectory;
+    context.buffers = options.buffers;
+    context.hostCode = options.hostCode;
+    context.capacityAlignment = options.capacityAlignment;
+    entry.status = generateCode(context, compilations, entry.sources);
+  }
+  entryMessages.flush();
+
+  auto elapsed = llvm::TimeRecord::getCurrentTime(false);
+  elapsed -= startTime;
+  entry.seconds = elapsed.getWallTime();
+}
+
+int generateBatch(std::vector<BatchEntry> &entries,
+                  const clang::tooling::CompilationDatabase &compilations,
+                  unsigned jobs, const CodeGenContext &options) {
+  if (jobs == 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  std::mutex progressMutex;
+  unsigned finished = 0;
+  auto generate = [&](BatchEntry &entry) {
+    generateBatchEntry(entry, compilations, options);
+
+    std::lock_guard<std::mutex> lock(progressMutex);
+    finished++;
+    messages() << "[" << finished << "/" << entries.size() << "] "
+               << (entry.status == status_constants::SUCCESS ? "OK    "
+                                                             : "FAILED")
+               << " " << entry.outputDirectory << "\n";
+    messages().flush();
+  };
+
+  if (jobs <= 1 || entries.size() <= 1) {
+    for (auto &entry : entries)
+      generate(entry);
+  } else {
+    // the messages of the workers are redirected, so only the progress is
+    // printed from more than one thread, under the lock
+    auto &progressMessages = messages();
+    auto generateWithProgress = [&](BatchEntry &entry) {
+      MessageRedirect redirect(progressMessages);
+      generate(entry);
+    };
+
+    llvm::ThreadPool pool(std::min<unsigned>(jobs, entries.size()));
+    for (auto &entry : entries) {
+      BatchEntry *entryPtr = &entry;
+      pool.async([&generateWithProgress, entryPtr] {
+        generateWithProgress(*entryPtr);
+      });
+    }
+    pool.wait();
+  }
+
+  for (auto &entry : entries) {
+    if (entry.status != status_constants::SUCCESS)
+      return status_constants::FAIL;
+  }
+  return status_constants::SUCCESS;
+}
+
+void printBatchSummary(const std::vector<BatchEntry> &entries,
+                       llvm::raw_ostream &os) {
+  unsigned failed = 0;
+  double seconds = 0;
+  for (auto &entry : entries) {
+    if (entry.status != status_constants::SUCCESS)
+      failed++;
+    seconds += entry.seconds;
+  }
+
+  os << "\nBatch summary:\n";
+  for (auto &entry : entries) {
+    os << "  "
+       << (entry.status == status_constants::SUCCESS ? "OK    " : "FAILED")
+       << llvm::format(" %10.4f s  ", entry.seconds) << entry.outputDirectory
+       << "\n";
+  }
+
+  for (auto &entry : entries) {
+    if (entry.status == status_constants::SUCCESS)
+      continue;
+
+    os << "\nMessages for line " << entry.line << " ("
+       << entry.outputDirectory << "):\n"
+       << entry.messages;
+  }
+
+  os << "\n"
+     << entries.size() - failed << " of " << entries.size()
+     << " programs generated"
+     << llvm::format(" (%.4f s of generation in total).\n", seconds);
+}
+
+void writeBatchSummary(const std::vector<BatchEntry> &entries,
+                       llvm::raw_ostream &os) {
+  os << "status\tseconds\tline\tconfig\toutput\n";
+  for (auto &entry : entries) {
+    os << (entry.status == status_constants::SUCCESS ? "OK" : "FAILED")
+       << llvm::format("\t%.6f\t", entry.seconds) << entry.line << "\t"
+       << entry.configFilename << "\t" << entry.outputDirectory << "\n";
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BATCH_GENERATOR_H
+#define BATCH_GENERATOR_H
+
+#include "CodeGenContext.h"
+#include "Constants.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+// A program in a batch, and the result of generating its code
+struct BatchEntry {
+  std::string configFilename;
+  std::string outputDirectory;
+  std::vector<std::string> sources;
+  unsigned line = 0; // in the manifest
+
+  int status = status_constants::FAIL;
+  double seconds = 0;
+  std::string messages; // printed while generating its code
+};
+
+// Reads a manifest of programs, one per line:
+//   <config file> <output directory> <source file> [<source file> ...]
+// Empty lines and lines starting with '#' are skipped, and relative paths are
+// relative to the directory of the manifest.
+// Returns status_constants::SUCCESS or status_constants::FAIL.
+int readManifest(const std::string &, std::vector<BatchEntry> &);
+
+// Generates the code for every program in the batch in a single process, up to
+// `jobs` programs at a time (0 uses all hardware threads). The output
+// directories are created if they do not exist, and the messages of each
+// program are kept in its entry. The options of every program (eg. the cache
+// and the buffers) are taken from `options`; its config and output are ignored.
+// Returns status_constants::SUCCESS if the code of every program was generated.
+int generateBatch(std::vector<BatchEntry> &,
+                  const clang::tooling::CompilationDatabase &, unsigned jobs,
+                  const CodeGenContext &options);
+
+// Prints the status and time of every program, and the messages of the ones
+// which failed.
+void printBatchSummary(const std::vector<BatchEntry> &, llvm::raw_ostream &);
+
+// Writes the status and time of every program as tab separated values.
+void writeBatchSummary(const std::vector<BatchEntry> &, llvm::raw_ostream &);
+
+#endif
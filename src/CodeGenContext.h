@@ -0,0 +1,166 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODE_GEN_CONTEXT_H
+#define CODE_GEN_CONTEXT_H
+
+#include "Utils.h"
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// a parsed source file, together with its kernel generation state
+struct TranslationUnitState;
+
+// A global variable, with everything needed to pass it around in any
+// translation unit
+struct GlobalVarFacts {
+  std::string name;
+  std::string declaration; // the original declaration, copied into main
+  std::string param;       // the declaration as an added function parameter
+  bool isArray;
+  // an initialised number or array of numbers, which can be left in constant
+  // memory if nothing writes to it
+  bool canBeConstant = false;
+};
+
+// Where a function or a global var is defined
+struct SymbolDefinition {
+  std::string file;
+  bool isInternal; // static, so another file may define the same name
+};
+
+// A set of names, which remembers the order they were added in, so that the
+// generated parameter lists do not change between runs
+class OrderedNameSet {
+private:
+  std::vector<std::string> names;
+  std::unordered_set<std::string> nameSet;
+
+public:
+  // returns false if the name is already in the set
+  bool insert(const std::string &name) {
+    if (!nameSet.insert(name).second)
+      return false;
+
+    names.push_back(name);
+    return true;
+  }
+
+  bool contains(const std::string &name) const {
+    return nameSet.count(name) != 0;
+  }
+
+  bool empty() const { return names.empty(); }
+  std::vector<std::string>::const_iterator begin() const {
+    return names.begin();
+  }
+  std::vector<std::string>::const_iterator end() const { return names.end(); }
+};
+
+// Facts which are needed across translation units.
+// Each translation unit collects its own facts and they are merged into the
+// facts for the whole program, before any function is rewritten. Functions and
+// variables are referred to by name, as they are declared separately in each
+// translation unit.
+struct ProgramFacts {
+  // a list of all the global vars, in the order they are declared, and their
+  // index in the list by name
+  std::vector<struct GlobalVarFacts> globalVars;
+  std::unordered_map<std::string, size_t> globalVarIndices;
+  // global vars which are written to, or whose address is taken, anywhere in
+  // the program
+  std::unordered_set<std::string> writtenGlobalVars;
+  // array inputs which are written to, or whose address is taken
+  std::unordered_set<std::string> writtenInputs;
+
+  // a map of all global vars used in a function declaration (they need to be
+  // added to the parameter list) //both original uses and added as parameters
+  // to function calls
+  std::map<std::string, OrderedNameSet> funcToGlobalVars;
+  std::unordered_set<std::string> functionsWhichUseTestInputs;
+  std::unordered_set<std::string> functionsWhichUseTestResults;
+  std::unordered_set<std::string> functionsWhichUseStdin;
+
+  // the call graph: a map of function declarations to all their callers
+  std::map<std::string, std::set<std::string>> funcDeclToCallerDecls;
+
+  // the functions and global vars defined outside of the system headers;
+  // static ones with the same name in different files would be merged into
+  // one, so they are an error
+  std::map<std::string, struct SymbolDefinition> definedSymbols;
+
+  // a list of include files to add
+  std::list<std::string> includesToAdd;
+};
+
+// The state of the generation of the code for a single program.
+// Nothing is shared between contexts, so several programs can be generated in
+// parallel threads of the same process, each with its own context.
+class CodeGenContext {
+public:
+  CodeGenContext(const std::string &configFilename,
+                 const std::string &outputDirectory, unsigned jobs = 1)
+      : configFilename(configFilename), outputDirectory(outputDirectory),
+        jobs(jobs) {}
+
+  // options
+  std::string configFilename;
+  std::string outputDirectory;
+  unsigned jobs; // translation units to process in parallel, 0 for all cores
+  bool keepTranslationUnits = false; // keep the ASTs after generation
+  bool useCache = false; // reuse outputs cached beside the output directory
+  std::string pchDirectory; // where to cache precompiled system headers
+  BufferOptions buffers; // how the inputs and results are passed to the kernel
+  HostCodeOptions hostCode; // which host code is generated besides cpu-gen.c
+  // the tests, to infer the capacity of variable length inputs from, and the
+  // alignment of the capacities in bytes
+  std::string testsFilename;
+  unsigned capacityAlignment = 16;
+  bool narrowInputs = false; // store inputs in narrower types, if they fit
+
+  // the configuration, as read from the config file
+  std::map<int, std::string> argvIdxToInput;
+  std::list<struct Declaration> stdinInputs;
+  std::list<struct Declaration> inputs;
+  std::list<struct ResultDeclaration> results;
+  std::list<std::string> includes;
+  std::time_t configModificationTime = 0; // when the config was last changed
+  std::time_t testsModificationTime = 0;  // and the tests
+  // the standard input files which the tests refer to, and when they were
+  // last changed; the capacities are inferred from them too
+  std::map<std::string, std::time_t> stdinFiles;
+
+  // the facts for the whole program, collected during kernel generation
+  ProgramFacts programFacts;
+
+  // the files written into the output directory, and all files (sources and
+  // headers) which the kernel was generated from
+  std::set<std::string> outputFiles;
+  std::set<std::string> dependencies;
+
+  // the parsed translation units; only kept if keepTranslationUnits is set,
+  // so that later generations reparse only the files which changed
+  std::vector<std::shared_ptr<TranslationUnitState>> translationUnits;
+};
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CodeGenerator.h"
+#include "ConfigParser.h"
+#include "Constants.h"
+#include "CpuCodeGenerator.h"
+#include "KernelGenerator.h"
+#include "OutputCache.h"
+#include "TestsParser.h"
+#include "Timing.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+std::time_t getModificationTime(const std::string &filename) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(filename, status))
+    return 0;
+
+  return llvm::sys::toTimeT(status.getLastModificationTime());
+}
+
+// reads the config file into the configuration of the context
+int readConfig(CodeGenContext &context) {
+  PhaseTimer timer("parseConfig");
+
+  // take the time before parsing, so that changes during parsing are not lost
+  context.configModificationTime = getModificationTime(context.configFilename);
+  if (context.testsFilename != "")
+    context.testsModificationTime = getModificationTime(context.testsFilename);
+  if (parseConfig(context.configFilename, context.argvIdxToInput,
+                  context.stdinInputs, context.inputs, context.results,
+                  context.includes) == status_constants::FAIL)
+    return status_constants::FAIL;
+  timer.stop();
+
+  if (context.testsFilename == "")
+    return status_constants::SUCCESS;
+
+  // size the variable length inputs for the tests
+  PhaseTimer testsTimer("inferCapacities");
+  std::vector<struct TestCase> testCases;
+  context.stdinFiles.clear();
+  if (parseTests(context.testsFilename, testCases) == status_constants::FAIL)
+    return status_constants::FAIL;
+  for (auto &testCase : testCases) {
+    for (auto &stdinFile : testCase.stdinFiles)
+      context.stdinFiles[stdinFile] = getModificationTime(stdinFile);
+  }
+
+  inferCapacities(testCases, context.inputs, context.stdinInputs,
+                  context.capacityAlignment, messages());
+  if (context.narrowInputs)
+    inferStorageTypes(testCases, context.inputs, context.buffers.packedInputs,
+                      messages());
+  return status_constants::SUCCESS;
+}
+
+void writeStructs(CodeGenContext &context) {
+  PhaseTimer timer("generateStructs");
+  generateStructs(context.outputDirectory, context.stdinInputs, context.inputs,
+                  context.results, context.includes, context.buffers);
+  context.outputFiles.insert(filename_constants::STRUCTS_FILENAME);
+}
+
+void writeCpuGen(CodeGenContext &context) {
+  PhaseTimer timer("generateCpuGen");
+  generateCpuGen(context.outputDirectory, context.inputs, context.results,
+                 context.stdinInputs, context.buffers, context.hostCode);
+  context.outputFiles.insert(std::string(filename_constants::CPU_GEN_FILENAME) +
+                             ".h");
+  context.outputFiles.insert(std::string(filename_constants::CPU_GEN_FILENAME) +
+                             ".c");
+
+  if (context.hostCode.binaryTests &&
+      canCompileTests(context.inputs, context.stdinInputs, context.buffers)) {
+    generateCompileTestsTool(context.outputDirectory);
+    context.outputFiles.insert(filename_constants::COMPILE_TESTS_FILENAME);
+  }
+
+  if (context.hostCode.hostDriver &&
+      canCompileTests(context.inputs, context.stdinInputs, context.buffers)) {
+    generateHostDriver(context.outputDirectory, context.buffers);
+    context.outputFiles.insert(filename_constants::HOST_GEN_FILENAME);
+  }
+
+  if (context.buffers.compareOnDevice) {
+    generateCompareKernel(context.outputDirectory, context.results,
+                          context.buffers);
+    context.outputFiles.insert(filename_constants::COMPARE_GEN_FILENAME);
+  }
+}
+
+int writeKernel(CodeGenContext &context,
+                const clang::tooling::CompilationDatabase &compilations,
+                const std::vector<std::string> &sources) {
+  PhaseTimer timer("generateKernel");
+  return generateKernel(context, compilations, sources);
+}
+
+bool isSameDeclaration(const struct Declaration &decl1,
+                       const struct Declaration &decl2) {
+  return decl1.type == decl2.type && decl1.name == decl2.name &&
+         decl1.isArray == decl2.isArray && decl1.isConst == decl2.isConst &&
+         decl1.isPointer == decl2.isPointer && decl1.size == decl2.size &&
+         decl1.capacity == decl2.capacity &&
+         decl1.storageType == decl2.storageType;
+}
+
+bool isSameResult(const struct ResultDeclaration &result1,
+                  const struct ResultDeclaration &result2) {
+  return isSameDeclaration(result1.declaration, result2.declaration) &&
+         result1.testedValue.name == result2.testedValue.name &&
+         result1.testedValue.type == result2.testedValue.type &&
+         result1.testedValue.resultArg == result2.testedValue.resultArg;
+}
+
+bool isSameDeclarations(const std::list<struct Declaration> &decls1,
+                        const std::list<struct Declaration> &decls2) {
+  return decls1.size() == decls2.size() &&
+         std::equal(decls1.begin(), decls1.end(), decls2.begin(),
+                    isSameDeclaration);
+}
+
+bool isSameResults(const std::list<struct ResultDeclaration> &results1,
+                   const std::list<struct ResultDeclaration> &results2) {
+  return results1.size() == results2.size() &&
+         std::equal(results1.begin(), results1.end(), results2.begin(),
+                    isSameResult);
+}
+
+int generateCode(CodeGenContext &context,
+                 const clang::tooling::CompilationDatabase &compilations,
+                 const std::vector<std::string> &sources) {
+  // parse the configuration file
+  if (readConfig(context) == status_constants::FAIL) {
+    messages() << "\nFailed to parse the configuration file "
+               << context.configFilename << ". \nTERMINATING!\n";
+    return status_constants::FAIL;
+  }
+
+  // nothing to do if the same code was generated before
+  std::string cacheKey;
+  if (context.useCache) {
+    PhaseTimer timer("cache lookup");
+    cacheKey = computeCacheKey(context, compilations, sources);
+    if (restoreFromCache(context, cacheKey))
+      return status_constants::SUCCESS;
+  }
+
+  // generate the struct file
+  writeStructs(context);
+
+  // generate CPU code
+  writeCpuGen(context);
+
+  // generate kernel
+  int status = writeKernel(context, compilations, sources);
+
+  if (context.useCache && status == status_constants::SUCCESS) {
+    PhaseTimer timer("cache store");
+    storeInCache(context, cacheKey);
+  }
+
+  return status;
+}
+
+int regenerateChangedCode(
+    CodeGenContext &context,
+    const clang::tooling::CompilationDatabase &compilations,
+    const std::vector<std::string> &sources) {
+  bool regenerateStructs = false;
+  bool regenerateCpuGen = false;
+  bool regenerateKernel = false;
+
+  // find out which parts of the config changed
+  bool stdinFilesChanged = false;
+  for (auto &stdinFile : context.stdinFiles) {
+    if (getModificationTime(stdinFile.first) != stdinFile.second)
+      stdinFilesChanged = true;
+  }
+  if (getModificationTime(context.configFilename) !=
+          context.configModificationTime ||
+      (context.testsFilename != "" &&
+       getModificationTime(context.testsFilename) !=
+           context.testsModificationTime) ||
+      stdinFilesChanged) {
+    CodeGenContext config(context.configFilename, context.outputDirectory);
+    config.testsFilename = context.testsFilename;
+    config.capacityAlignment = context.capacityAlignment;
+    config.narrowInputs = context.narrowInputs;
+    config.buffers = context.buffers;
+    if (readConfig(config) == status_constants::FAIL) {
+      // do not read it again until it changes
+      context.configModificationTime = config.configModificationTime;
+      context.testsModificationTime = config.testsModificationTime;
+      for (auto &stdinFile : context.stdinFiles)
+        stdinFile.second = getModificationTime(stdinFile.first);
+      messages() << "\nFailed to parse the configuration file "
+                 << context.configFilename
+                 << ". Keeping the previously generated code.\n";
+      return status_constants::FAIL;
+    }
+
+    bool inputsChanged =
+        !isSameDeclarations(config.inputs, context.inputs) ||
+        !isSameDeclarations(config.stdinInputs, context.stdinInputs);
+    bool resultsChanged = !isSameResults(config.results, context.results);
+    bool argvChanged = config.argvIdxToInput != context.argvIdxToInput;
+    bool includesChanged = config.includes != context.includes;
+
+    regenerateStructs = inputsChanged || resultsChanged || includesChanged;
+    regenerateCpuGen = inputsChanged || resultsChanged;
+    regenerateKernel = inputsChanged || resultsChanged || argvChanged;
+
+    context.configModificationTime = config.configModificationTime;
+    context.testsModificationTime = config.testsModificationTime;
+    context.stdinFiles = config.stdinFiles;
+    context.argvIdxToInput = config.argvIdxToInput;
+    context.stdinInputs = config.stdinInputs;
+    context.inputs = config.inputs;
+    context.results = config.results;
+    context.includes = config.includes;
+  }
+
+  // the kernel also changes with its sources
+  if (!regenerateKernel)
+    regenerateKernel = haveKernelSourcesChanged(context);
+
+  if (regenerateStructs)
+    writeStructs(context);
+
+  if (regenerateCpuGen)
+    writeCpuGen(context);
+
+  if (regenerateKernel)
+    return writeKernel(context, compilations, sources);
+
+  return status_constants::SUCCESS;
+}
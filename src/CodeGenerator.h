@@ -0,0 +1,41 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODE_GENERATOR_H
+#define CODE_GENERATOR_H
+
+#include "CodeGenContext.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include <string>
+#include <vector>
+
+// Generates the structs, the CPU code and the kernel for a program, from the
+// config file and the output directory in the context.
+// Returns status_constants::SUCCESS or status_constants::FAIL.
+int generateCode(CodeGenContext &,
+                 const clang::tooling::CompilationDatabase &,
+                 const std::vector<std::string> &);
+
+// Regenerates only the code whose inputs changed since the last generation with
+// the context: the structs and the CPU code when the inputs, results or
+// includes in the config change, and the kernel when the config or any of its
+// source files change. If the context keeps its translation units, only the
+// source files which changed are parsed again.
+int regenerateChangedCode(CodeGenContext &,
+                          const clang::tooling::CompilationDatabase &,
+                          const std::vector<std::string> &);
+
+#endif
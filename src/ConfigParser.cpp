@@ -64,17 +64,17 @@ int parseTestedValueFunction(const std::string &line, std::istringstream &iss,
     iss >> argNumStr;
     int argNum = stoi(argNumStr);
     if (argNum < 1) {
-      llvm::outs() << argNum
-                   << " is not a valid argument number config file line:\n"
-                   << line;
+      messages() << argNum
+                 << " is not a valid argument number config file line:\n"
+                 << line;
       return status_constants::FAIL;
     }
 
     testedValue.resultArg = argNum;
   } else {
-    llvm::outs() << returnType
-                 << " is not a valid result in config file line:\n"
-                 << line << "\nPlease enter std::RET or ARG.\n";
+    messages() << returnType
+               << " is not a valid result in config file line:\n"
+               << line << "\nPlease enter std::RET or ARG.\n";
     return status_constants::FAIL;
   }
 
@@ -117,7 +117,7 @@ int parseName(const std::string &line, std::istringstream &iss,
         }
 
         if (*it != ']') {
-          llvm::outs()
+          messages()
               << "Array \"" << declaration.name << "[" << size << "]\""
               << " is not correctly defined in line:\n"
               << line << "\nPlease, specify as   'type arrayname[arraysize]'\n";
@@ -198,8 +198,8 @@ int parseResult(const std::string &line, std::istringstream &iss,
   }
 
   else {
-    llvm::outs() << "I don't know how to parse annotation " << annot
-                 << " on line: " << line;
+    messages() << "I don't know how to parse annotation " << annot
+               << " on line: " << line;
     return status_constants::FAIL;
   }
 
@@ -223,13 +223,13 @@ int parseConfig(const std::string &configFilename,
                 std::list<struct Declaration> &inputDeclarations,
                 std::list<struct ResultDeclaration> &resultDeclarations,
                 std::list<std::string> &includes) {
-  llvm::outs() << "Parsing configuration file... ";
+  messages() << "Parsing configuration file... ";
 
   // open the file
   std::ifstream infile(configFilename);
   std::string line;
   if (!infile.is_open()) {
-    llvm::outs() << "Error opening config file: " << configFilename << ".\n";
+    messages() << "Error opening config file: " << configFilename << ".\n";
     return status_constants::FAIL;
   }
 
@@ -265,12 +265,12 @@ int parseConfig(const std::string &configFilename,
     }
 
     else {
-      llvm::outs() << "I don't know how to parse annotation " << annot
-                   << " on line: " << line;
+      messages() << "I don't know how to parse annotation " << annot
+                 << " on line: " << line;
       return status_constants::FAIL;
     }
   }
 
-  llvm::outs() << "DONE!\n";
+  messages() << "DONE!\n";
   return status_constants::SUCCESS;
 }
@@ -35,6 +35,9 @@ const char *const INCLUDE = "include:";
 namespace filename_constants {
 const char *const STRUCTS_FILENAME = "structs.h";
 const char *const CPU_GEN_FILENAME = "cpu-gen";
+const char *const COMPARE_GEN_FILENAME = "compare-gen.cl";
+const char *const COMPILE_TESTS_FILENAME = "compile-tests-gen.c";
+const char *const HOST_GEN_FILENAME = "host-gen.c";
 } // namespace filename_constants
 
 // status
@@ -48,7 +51,51 @@ const char *const ARGC = "argc";
 const char *const INPUT = "partecl_input";
 const char *const RESULT = "partecl_result";
 const char *const TEST_CASE_NUM = "test_case_num";
+// with the struct of arrays layout
+const char *const INPUT_BUFFERS = "partecl_input_buffers";
+const char *const RESULT_BUFFERS = "partecl_result_buffers";
+const char *const INPUT_FIELDS = "PARTECL_INPUT_FIELDS";
+const char *const RESULT_FIELDS = "PARTECL_RESULT_FIELDS";
+const char *const INPUT_BUFFER_PREFIX = "inputs_";
+const char *const RESULT_BUFFER_PREFIX = "results_";
+const char *const EXPECTED_BUFFER_PREFIX = "exp_results_";
 const int POINTER_ARRAY_SIZE = 500;
+// with packed inputs
+const char *const INPUT_VIEW = "partecl_input_view";
+const char *const ARENA = "partecl_arena";
+const char *const OFFSET_SUFFIX = "_offset";
+const char *const LENGTH_SUFFIX = "_length";
+// with the host arena
+const char *const HOST_ARENA = "partecl_host_arena";
+const char *const HOST_BLOCK = "partecl_host_block";
+// with binary tests
+const char *const TESTS_HEADER = "partecl_tests_header";
+const char *const TESTS = "partecl_tests";
+const char *const TESTS_MAGIC = "PARTECL1";
+// with the tests parser
+const char *const PARSER = "partecl_parser";
+const char *const TOKEN = "partecl_token";
+// with the parallel tests parser
+const char *const CHUNK = "partecl_chunk";
+const char *const PARALLEL_PARSE = "partecl_parallel_parse";
+// with the host driver
+const char *const SLOT = "partecl_slot";
+const char *const READER = "partecl_reader";
 } // namespace structs_constants
 
+// output cache
+namespace cache_constants {
+// change whenever the generated code changes for the same inputs
+const char *const CODEGEN_VERSION = "13";
+const char *const DIRECTORY_SUFFIX = ".partecl-cache";
+const char *const MANIFEST_FILENAME = "manifest";
+const char *const DEPENDENCY = "dependency:";
+const char *const OUTPUT = "output:";
+// the hash of a dependency which does not exist
+const char *const MISSING_HASH = "-";
+const unsigned MAX_ENTRIES = 16;
+// default directory for precompiled headers, inside the system temp directory
+const char *const PCH_DIRECTORY = "partecl-codegen-pch";
+} // namespace cache_constants
+
 #endif
@@ -16,46 +16,213 @@
 
 #include "CpuCodeGenerator.h"
 #include "Constants.h"
+#include "Timing.h"
 #include "Utils.h"
+#include <algorithm>
 #include <sstream>
 #include <string>
 
 /*
  * Gnerate structs.h
  */
-void generateDeclaration(std::ofstream &strFile,
+void generateDeclaration(std::ostream &strFile,
                          const struct Declaration &declaration) {
 
   std::string type = declaration.type;
-  std::stringstream size;
-  // if the size is not a numeric string, then hardcode it
-  if (declaration.size.find_first_not_of("0123456789") != std::string::npos)
-    size << structs_constants::POINTER_ARRAY_SIZE;
-  else
-    size << declaration.size;
 
-  if (declaration.isPointer) { // add the star to delcaraiont
+  if (declaration.isPointer && !isStoredAsArray(declaration)) {
+    // add the star to delcaraiont
     strFile << "  " << type << "* " << declaration.name << ";\n";
-  } else if (declaration.isArray) {
-    strFile << "  " << type << " " << declaration.name << "[" << size.str()
-            << "];\n";
+  } else if (isStoredAsArray(declaration)) {
+    strFile << "  " << type << " " << declaration.name << "["
+            << getArraySize(declaration) << "];\n";
   } else {
     strFile << "  " << type << " " << declaration.name << ";\n";
   }
 }
 
+// For the struct of arrays layout: a list of the buffers, for the runtime to
+// create and pass to the kernel in this order, and a struct with a pointer to
+// each of them, which the CPU code fills in and reads from
+void generateBuffers(std::ostream &strFile, const std::string &structName,
+                     const std::string &buffersName,
+                     const std::string &fieldsMacro,
+                     const std::list<struct Declaration> &fields) {
+  strFile << "/* The buffers of struct " << structName
+          << ", one for each field:\n";
+  strFile << " * FIELD(element type, name, elements per test case) */\n";
+  strFile << "#define " << fieldsMacro << "(FIELD) \\\n";
+  size_t i = 0;
+  for (auto &field : fields) {
+    strFile << "  FIELD(" << getFieldType(field) << ", " << field.name << ", "
+            << (isStoredAsArray(field) ? getArraySize(field) : "1")
+            << ")" << (++i < fields.size() ? " \\\n" : "\n\n");
+  }
+
+  strFile << "typedef struct " << buffersName << "\n";
+  strFile << "{\n";
+  for (auto &field : fields)
+    strFile << "  " << getFieldType(field) << " *" << field.name << ";\n";
+  strFile << "} " << buffersName << ";\n\n";
+}
+
+// whether any of the inputs is stored in a narrower type
+bool isNarrowed(const std::list<struct Declaration> &inputs) {
+  return std::any_of(
+      inputs.begin(), inputs.end(),
+      [](const struct Declaration &input) { return input.storageType != ""; });
+}
+
+// The narrower types which inputs can be stored in
+void generateStorageTypes(std::ostream &strFile) {
+  auto &storageTypes = getStorageTypes();
+  strFile << "#ifdef __OPENCL_VERSION__\n";
+  for (auto &storageType : storageTypes)
+    strFile << "typedef " << storageType.deviceType << " " << storageType.name
+            << ";\n";
+  strFile << "#else\n";
+  strFile << "#include <stdint.h>\n";
+  for (auto &storageType : storageTypes)
+    strFile << "typedef " << storageType.hostType << " " << storageType.name
+            << ";\n";
+  strFile << "#endif\n\n";
+}
+
+// The fixed width types of the ABI safe layout, and the macros which check the
+// layout; OpenCL C has no _Static_assert, so the checks fall back to arrays of
+// negative size there
+void generateFixedWidthTypes(std::ostream &strFile) {
+  strFile << "#ifdef __OPENCL_VERSION__\n";
+  strFile << "#define PARTECL_OFFSETOF(type, field) "
+             "__builtin_offsetof(type, field)\n";
+  strFile << "#else\n";
+  strFile << "#include <stddef.h>\n";
+  strFile << "#define PARTECL_OFFSETOF(type, field) offsetof(type, field)\n";
+  strFile << "#endif\n";
+  strFile << "#if defined(__cplusplus) && __cplusplus >= 201103L\n";
+  strFile << "#define PARTECL_CHECK(name, cond) static_assert(cond, #name)\n";
+  strFile << "#elif !defined(__OPENCL_VERSION__) && "
+             "defined(__STDC_VERSION__) && \\\n";
+  strFile << "    __STDC_VERSION__ >= 201112L\n";
+  strFile << "#define PARTECL_CHECK(name, cond) _Static_assert(cond, #name)\n";
+  strFile << "#else\n";
+  strFile << "#define PARTECL_CHECK(name, cond) \\\n";
+  strFile << "  typedef char partecl_check_##name[(cond) ? 1 : -1]\n";
+  strFile << "#endif\n\n";
+
+  auto &configTypes = getConfigTypes();
+  strFile << "#ifdef __OPENCL_VERSION__\n";
+  for (auto &configType : configTypes)
+    strFile << "typedef " << configType.deviceType << " "
+            << getFixedWidthType(configType.name) << ";\n";
+  strFile << "#else\n";
+  strFile << "#ifdef __APPLE__\n";
+  strFile << "#include <OpenCL/cl_platform.h>\n";
+  strFile << "#else\n";
+  strFile << "#include <CL/cl_platform.h>\n";
+  strFile << "#endif\n";
+  for (auto &configType : configTypes)
+    strFile << "typedef " << configType.hostType << " "
+            << getFixedWidthType(configType.name) << ";\n";
+  strFile << "#endif\n";
+  for (auto &configType : configTypes)
+    strFile << "PARTECL_CHECK(" << getFixedWidthType(configType.name)
+            << ", sizeof(" << getFixedWidthType(configType.name)
+            << ") == " << configType.size << ");\n";
+  strFile << "\n";
+}
+
+// Checks the size of a struct and the offset of each of its fields, with the
+// layout a C compiler gives it; returns the size, or 0 if the size of one of
+// the fields is not known, and then the struct is not checked
+unsigned generateLayoutChecks(std::ostream &strFile,
+                              const std::string &structName,
+                              const std::list<struct Declaration> &fields) {
+  std::stringstream checks;
+  unsigned offset = 0;
+  unsigned structAlignment = 1;
+  for (auto &field : fields) {
+    unsigned size, alignment;
+    if (!getFieldLayout(field, size, alignment)) {
+      strFile << "/* The layout of struct " << structName
+              << " is not checked, as the size of '" << field.type
+              << "' is not known */\n\n";
+      return 0;
+    }
+
+    offset = (offset + alignment - 1) / alignment * alignment;
+    checks << "PARTECL_CHECK(" << structName << "_" << field.name
+           << ", PARTECL_OFFSETOF(struct " << structName << ", " << field.name
+           << ") == " << offset << ");\n";
+    offset += size;
+    structAlignment = std::max(structAlignment, alignment);
+  }
+  offset = (offset + structAlignment - 1) / structAlignment * structAlignment;
+
+  strFile << "PARTECL_CHECK(" << structName << ", sizeof(struct " << structName
+          << ") == " << offset << ");\n";
+  strFile << checks.str() << "\n";
+  return offset;
+}
+
+// Prints how many bytes a test case takes in the buffers
+void reportRecordSize(const std::string &structName,
+                      const std::list<struct Declaration> &fields,
+                      unsigned structSize, BufferLayout layout) {
+  unsigned fieldsSize = 0;
+  for (auto &field : fields) {
+    unsigned size, alignment;
+    if (!getFieldLayout(field, size, alignment)) {
+      messages() << "  " << structName << ": size not known ('" << field.type
+                 << "')\n";
+      return;
+    }
+    if (field.isPointer && !isStoredAsArray(field))
+      messages() << "  Warning: field '" << field.name << "' of "
+                 << structName << " is a pointer, which the device can not "
+                                  "read from the host memory.\n";
+    fieldsSize += size;
+  }
+
+  if (layout == BufferLayout::structOfArrays)
+    messages() << "  " << structName << ": " << fieldsSize
+               << " bytes per test case, in " << fields.size()
+               << " buffers\n";
+  else
+    messages() << "  " << structName << ": " << structSize
+               << " bytes per test case (" << structSize - fieldsSize
+               << " of padding)\n";
+}
+
+// The input as the kernel sees it, in the declared types, and when packed,
+// with each variable length input pointing to its elements in the arena
+void generateInputView(std::ostream &strFile,
+                       const std::list<struct Declaration> &fields,
+                       bool packed) {
+  strFile << "#ifdef __OPENCL_VERSION__\n";
+  strFile << "typedef struct " << structs_constants::INPUT_VIEW << "\n";
+  strFile << "{\n";
+  for (auto &field : fields) {
+    if (packed && isVariableLength(field))
+      strFile << "  __global " << field.type << " *" << field.name << ";\n";
+    else
+      generateDeclaration(strFile, field);
+  }
+  strFile << "} " << structs_constants::INPUT_VIEW << ";\n";
+  strFile << "#endif\n\n";
+}
+
 void generateStructs(
     const std::string &outputDirectory,
     const std::list<struct Declaration> &stdinInputs,
     const std::list<struct Declaration> &inputDeclarations,
     const std::list<struct ResultDeclaration> &resultDeclarations,
-    const std::list<std::string> &includes) {
-  llvm::outs() << "Generating memory buffer structs... ";
+    const std::list<std::string> &includes, const BufferOptions &options) {
+  messages() << "Generating memory buffer structs... ";
 
   std::string structsFilename =
       outputDirectory + '/' + filename_constants::STRUCTS_FILENAME;
-  std::ofstream strFile;
-  strFile.open(structsFilename);
+  std::stringstream strFile;
 
   // write input
   strFile << "#ifndef STRUCTS_H\n";
@@ -64,34 +231,69 @@ void generateStructs(
     strFile << "#include \"" << include << "\"\n";
   }
   strFile << "\n";
+  if (isNarrowed(inputDeclarations))
+    generateStorageTypes(strFile);
+  if (options.abiSafeLayout)
+    generateFixedWidthTypes(strFile);
+
+  auto inputFields =
+      getStoredInputFields(inputDeclarations, stdinInputs, options);
   strFile << "typedef struct " << structs_constants::INPUT << "\n";
   strFile << "{\n";
-  strFile << "  int " << structs_constants::TEST_CASE_NUM << ";\n";
-  strFile << "  int " << structs_constants::ARGC << ";\n";
-
-  for (auto &inputDecl : inputDeclarations) {
-    generateDeclaration(strFile, inputDecl);
+  for (auto &inputField : inputFields) {
+    generateDeclaration(strFile, inputField);
   }
+  strFile << "} " << structs_constants::INPUT << ";\n\n";
+  unsigned inputSize = 0;
+  if (options.abiSafeLayout)
+    inputSize =
+        generateLayoutChecks(strFile, structs_constants::INPUT, inputFields);
 
-  for (auto &stdinArg : stdinInputs) {
-    generateDeclaration(strFile, stdinArg);
-  }
+  if (hasInputView(inputDeclarations, options.packedInputs))
+    generateInputView(strFile, getInputFields(inputDeclarations, stdinInputs),
+                      options.packedInputs);
 
-  strFile << "} " << structs_constants::INPUT << ";\n\n";
+  if (options.inputLayout == BufferLayout::structOfArrays)
+    generateBuffers(strFile, structs_constants::INPUT,
+                    structs_constants::INPUT_BUFFERS,
+                    structs_constants::INPUT_FIELDS, inputFields);
 
   // write result
+  auto resultFields = getStoredResultFields(resultDeclarations, options);
   strFile << "typedef struct " << structs_constants::RESULT << "\n";
   strFile << "{\n";
-  strFile << "  int test_case_num;\n";
-  for (auto &resultDecl : resultDeclarations) {
-    generateDeclaration(strFile, resultDecl.declaration);
+  for (auto &resultField : resultFields) {
+    generateDeclaration(strFile, resultField);
   }
   strFile << "} " << structs_constants::RESULT << ";\n\n";
+  unsigned resultSize = 0;
+  if (options.abiSafeLayout)
+    resultSize =
+        generateLayoutChecks(strFile, structs_constants::RESULT, resultFields);
+
+  if (options.resultLayout == BufferLayout::structOfArrays)
+    generateBuffers(strFile, structs_constants::RESULT,
+                    structs_constants::RESULT_BUFFERS,
+                    structs_constants::RESULT_FIELDS, resultFields);
+
+  // the kernel compares the results itself
+  if (options.compactResults) {
+    strFile << "#ifndef PARTECL_TOLERANCE\n";
+    strFile << "#define PARTECL_TOLERANCE 0\n";
+    strFile << "#endif\n\n";
+  }
 
   strFile << "#endif\n";
-  strFile.close();
+  writeFileIfChanged(structsFilename, strFile.str());
+  addOutputFile(structsFilename, strFile.str().size());
 
-  llvm::outs() << "DONE!\n";
+  messages() << "DONE!\n";
+  if (options.abiSafeLayout) {
+    reportRecordSize(structs_constants::INPUT, inputFields, inputSize,
+                     options.inputLayout);
+    reportRecordSize(structs_constants::RESULT, resultFields, resultSize,
+                     options.resultLayout);
+  }
 }
 
 /*
@@ -116,9 +318,9 @@ std::string generatePrintByTypeNonArray(const struct Declaration &declaration) {
 
   // TODO: Handle other types; currently default to int
 #if ENABLE_WARNINGS
-    llvm::outs() << "\ngenerateCompareResults: I don't know how to print "
-                    "results of type '"
-                 << resultDecl.declaration.type << "'. Defaulting to 'int'.\n";
+    messages() << "\ngenerateCompareResults: I don't know how to print "
+                  "results of type '"
+               << resultDecl.declaration.type << "'. Defaulting to 'int'.\n";
 #endif
     ss << "printf(\"%d \", curres." << declaration.name << ");\n";
   }
@@ -142,9 +344,9 @@ std::string generatePrintByTypeArray(const struct Declaration &declaration) {
   } else {
   // TODO: Handle other types; currently default to int
 #if ENABLE_WARNINGS
-    llvm::outs() << "\ngenerateCompareResults: I don't know how to print "
-                    "results of type '"
-                 << declaration.type << "'. Defaulting to 'int'.\n";
+    messages() << "\ngenerateCompareResults: I don't know how to print "
+                  "results of type '"
+               << declaration.type << "'. Defaulting to 'int'.\n";
 #endif
 
     ss << "      int curel = "
@@ -185,29 +387,173 @@ std::string generatePrintCalls(const struct ResultDeclaration &resultDecl) {
   return str;
 }
 
+// Prints the results which differ from the expected ones, with the same checks
+// as the kernels make; without expected results, prints every result
 void generateCompareResults(
-    std::ofstream &strFile,
-    const std::list<struct ResultDeclaration> &resultDecls) {
-  strFile << "void compare_results(struct " << structs_constants::RESULT
+    std::ostream &strFile,
+    const std::list<struct ResultDeclaration> &resultDecls,
+    const BufferOptions &options) {
+  bool isSoA = options.resultLayout == BufferLayout::structOfArrays;
+  strFile << "void compare_results(struct "
+          << (isSoA ? structs_constants::RESULT_BUFFERS
+                    : structs_constants::RESULT)
           << "* results, struct " << structs_constants::RESULT
           << "* exp_results, int num_test_cases)\n";
   strFile << "{\n";
   strFile << "  for(int i = 0; i < num_test_cases; i++)\n";
   strFile << "  {\n";
+  // without expected results, every result is printed
+  if (isSoA) {
+    // read the result of the test case from the buffers
+    strFile << "    struct " << structs_constants::RESULT << " curres;\n";
+    for (auto &field : getStoredResultFields(resultDecls, options))
+      strFile << getFieldCopy(field, "curres.", "results->", "i", false,
+                              "    ");
+  } else {
+    strFile << "    struct " << structs_constants::RESULT
+            << " curres = results[i];\n";
+  }
+  strFile << "    int passed = 0;\n";
+  strFile << "    if(exp_results != NULL)\n";
+  strFile << "    {\n";
+  strFile << "      passed = 1;\n";
+  // the same checks as the kernels make, a level further in
+  auto result = [](const struct Declaration &field, const std::string &el) {
+    return "curres." + field.name + (isStoredAsArray(field) ? "[" + el + "]"
+                                                            : "");
+  };
+  auto expected = [](const struct Declaration &field, const std::string &el) {
+    return "exp_results[i]." + field.name +
+           (isStoredAsArray(field) ? "[" + el + "]" : "");
+  };
+  std::stringstream checks(
+      getResultChecks(resultDecls, result, expected, "passed"));
+  std::string line;
+  while (std::getline(checks, line))
+    strFile << "    " << line << "\n";
+  strFile << "    }\n";
+  strFile << "    if(passed)\n";
+  strFile << "      continue;\n";
+  strFile << "\n";
+  strFile << "    if(exp_results != NULL)\n";
+  strFile << "      printf(\"Test case %d failed:\\n\", curres."
+          << structs_constants::TEST_CASE_NUM << ");\n";
+  for (auto &resultDecl : resultDecls)
+    strFile << generatePrintCalls(resultDecl);
+  strFile << "  }\n";
+  strFile << "}\n";
+}
+
+// Prints the results which the comparison kernel, or the kernel itself with
+// compacted results, found to differ from the expected ones; they are read
+// back from the device one after the other
+void generatePrintFailures(
+    std::ostream &strFile,
+    const std::list<struct ResultDeclaration> &resultDecls) {
+  strFile << "void print_failures(struct " << structs_constants::RESULT
+          << "* failed_results, unsigned int* failures, int num_failures)\n";
+  strFile << "{\n";
+  strFile << "  for(int i = 0; i < num_failures; i++)\n";
+  strFile << "  {\n";
   strFile << "    struct " << structs_constants::RESULT
-          << " curres = results[i];\n";
-  for (auto &resultDecl : resultDecls) {
-    // TODO: Find out how to compare; for now just print
+          << " curres = failed_results[i];\n";
+  strFile << "    printf(\"Test case %u failed:\\n\", failures[i]);\n";
+  for (auto &resultDecl : resultDecls)
     strFile << generatePrintCalls(resultDecl);
-  }
   strFile << "  }\n";
   strFile << "}\n";
 }
 
-void generatePopulateInput(std::ofstream &strFile, struct Declaration input,
-                           std::string count, std::string container, int i) {
+// With compacted results: zero the count of failures before the kernel runs,
+// and read back the count, and then only that many results, after it
+void generateReadFailures(std::ostream &strFile) {
+  std::string result = std::string("struct ") + structs_constants::RESULT;
+
+  // the write does not block, so its source must outlive it
+  strFile << "static const cl_uint partecl_zero = 0;\n\n";
+  strFile << "cl_int partecl_reset_failures(cl_command_queue queue, cl_mem "
+             "num_failures, cl_uint num_events, const cl_event *events, "
+             "cl_event *event)\n";
+  strFile << "{\n";
+  strFile << "  return clEnqueueWriteBuffer(queue, num_failures, CL_FALSE, 0, "
+             "sizeof(partecl_zero), &partecl_zero, num_events, events, "
+             "event);\n";
+  strFile << "}\n\n";
+
+  strFile << "/* Returns the number of failures, or -1 on an error */\n";
+  strFile << "int partecl_read_failures(cl_command_queue queue, cl_mem "
+             "results, cl_mem num_failures, " << result << " *failures, "
+             "cl_uint num_events, const cl_event *events)\n";
+  strFile << "{\n";
+  strFile << "  cl_uint count;\n";
+  strFile << "  if(clEnqueueReadBuffer(queue, num_failures, CL_TRUE, 0, "
+             "sizeof(count), &count, num_events, events, NULL) != "
+             "CL_SUCCESS)\n";
+  strFile << "    return -1;\n";
+  strFile << "  if(count > 0 && clEnqueueReadBuffer(queue, results, CL_TRUE, "
+             "0, count * sizeof(" << result << "), failures, 0, NULL, NULL) "
+             "!= CL_SUCCESS)\n";
+  strFile << "    return -1;\n";
+  strFile << "  return (int)count;\n";
+  strFile << "}\n";
+}
+
+// Inputs are narrowed to the values of the tests which the code was generated
+// for; other test cases may hold values which do not fit, so these are
+// reported rather than cut short silently
+void generateCheckRange(std::ostream &strFile) {
+  strFile << "static long partecl_check_range(long value, long min, long max, "
+             "const char *type, int test_case_num, const char *name)\n";
+  strFile << "{\n";
+  strFile << "  if(value < min || value > max)\n";
+  strFile << "    fprintf(stderr, \"Test case %d: the input %s is %ld, which "
+             "does not fit in %s; generate the code again for these "
+             "tests.\\n\", test_case_num, name, value, type);\n";
+  strFile << "  return value;\n";
+  strFile << "}\n\n";
+}
+
+// the conversion of a narrowed input, checked against the range of the type it
+// is stored in
+std::string getRangeCheck(const struct Declaration &input,
+                          const std::string &value) {
+  for (auto &storageType : getStorageTypes()) {
+    if (input.storageType != storageType.name)
+      continue;
+    return "partecl_check_range(" + value + ", " +
+           std::to_string(storageType.min) + ", " +
+           std::to_string(storageType.max) + ", \"" + storageType.name +
+           "\", input->" + structs_constants::TEST_CASE_NUM + ", \"" +
+           input.name + "\")";
+  }
+  return value;
+}
+
+// A packed input which does not fit in the arena is left empty in the test
+// case, and reported
+void generateArenaCheck(std::ostream &strFile, const std::string &indent,
+                        const std::string &offset, const std::string &length,
+                        const std::string &name) {
+  strFile << indent << "if(" << offset << " < 0)\n";
+  strFile << indent << "{\n";
+  strFile << indent << "  fprintf(stderr, \"Test case %d: the input " << name
+          << " does not fit in the arena.\\n\", input->"
+          << structs_constants::TEST_CASE_NUM << ");\n";
+  strFile << indent << "  " << offset << " = 0;\n";
+  strFile << indent << "  " << length << " = 0;\n";
+  strFile << indent << "}\n";
+}
+
+void generatePopulateInput(std::ostream &strFile, struct Declaration input,
+                           std::string count, std::string container, int i,
+                           const BufferOptions &options,
+                           const HostCodeOptions &hostCode) {
   std::string name = input.name;
   std::string argsidx = std::to_string(i + 1);
+  std::string field = "input->" + input.name;
+  std::string offset = field + structs_constants::OFFSET_SUFFIX;
+  std::string length = field + structs_constants::LENGTH_SUFFIX;
+  bool isPacked = options.packedInputs && isVariableLength(input);
 
   // for arrays, add a loop and indexes
   if (input.isArray) {
@@ -218,8 +564,24 @@ void generatePopulateInput(std::ofstream &strFile, struct Declaration input,
     else
       size << input.size;
 
+    // reserve the elements in the arena and write them there
+    if (isPacked) {
+      strFile << "  " << length << " = " << size.str() << ";\n";
+      strFile << "  " << offset << " = partecl_arena_alloc(arena, sizeof("
+              << input.type << ") * " << length << ", sizeof(" << input.type
+              << "));\n";
+      generateArenaCheck(strFile, "  ", offset, length, input.name);
+      field = "((" + input.type + " *)(arena->data + " + offset + "))";
+      size.str(length);
+    } else if (input.size.find_first_not_of("0123456789") !=
+               std::string::npos) {
+      // the size is an input, which may be larger than the capacity
+      size << " && i < " << getArraySize(input);
+    }
+
     strFile << "  for(int i = 0; i < " << size.str() << "; i++)\n";
     name.append("[i]");
+    field.append("[i]");
     argsidx = "i+";
     argsidx.append(std::to_string(i + 1));
   } else {
@@ -229,28 +591,57 @@ void generatePopulateInput(std::ofstream &strFile, struct Declaration input,
 
   // pointers
   // TODO: add handling for pointers which are not 'char *'
-  if (input.isPointer) {
+  if (input.isPointer && isPacked) {
+    // keep the terminating character, for the string functions in the kernel
     strFile << "    int len = strlen(" << container << "[" << argsidx << "]);\n"
-            << "    input->" << name
-            << " = (char *)malloc(sizeof(char *)*len);\n"
-            << "    strcpy(input->" << name << ", " << container << "["
-            << argsidx << "]);\n";
-    // not pointers
+            << "    " << offset
+            << " = partecl_arena_alloc(arena, len + 1, 1);\n"
+            << "    " << length << " = len;\n";
+    generateArenaCheck(strFile, "    ", offset, length, input.name);
+    strFile << "    else\n"
+            << "      memcpy(arena->data + " << offset << ", " << container
+            << "[" << argsidx << "], len + 1);\n";
+  } else if (input.isPointer && isStoredAsArray(input)) {
+    // the capacity is known from the tests; longer inputs are cut short
+    strFile << "    strncpy(input->" << name << ", " << container << "["
+            << argsidx << "], " << input.capacity << " - 1);\n"
+            << "    input->" << name << "[" << input.capacity
+            << " - 1] = '\\0';\n";
+  } else if (input.isPointer && hostCode.hostArena) {
+    strFile << "    input->" << name << " = partecl_host_strdup(strings, "
+            << container << "[" << argsidx << "]);\n";
+  } else if (input.isPointer) {
+    strFile << "    int len = strlen(" << container << "[" << argsidx << "]);\n"
+            << "    input->" << name << " = (char *)malloc(len + 1);\n"
+            << "    memcpy(input->" << name << ", " << container << "["
+            << argsidx << "], len + 1);\n";
+    // not pointers; read the same way as the tests parser reads them
+  } else if (input.storageType != "") {
+    strFile << "    " << field << " = "
+            << getRangeCheck(input, "atol(" + container + "[" + argsidx +
+                                        "])")
+            << ";\n";
+  } else if (input.type == "float" || input.type == "double") {
+    strFile << "    " << field << " = "
+            << "atof(" << container << "[" << argsidx << "]);\n";
+  } else if (contains(input.type, "long")) {
+    strFile << "    " << field << " = "
+            << "atol(" << container << "[" << argsidx << "]);\n";
   } else if (contains(input.type, "int")) {
-    strFile << "    input->" << name << " = "
+    strFile << "    " << field << " = "
             << "atoi(" << container << "[" << argsidx << "]);\n";
   } else if (contains(input.type, "bool")) {
-    strFile << "    input->" << name << " = "
+    strFile << "    " << field << " = "
             << "atoi(" << container << "[" << argsidx << "]);\n";
   } else if (contains(input.type, "char")) {
-    strFile << "    input->" << name << " = "
+    strFile << "    " << field << " = "
             << "*" << container << "[" << argsidx << "];\n";
   } else {
 #if ENABLE_WARNINGS
-    llvm::outs() << "POPULATE_INPUTS: Improvising for custom type "
-                 << input.type << ".\n";
+    messages() << "POPULATE_INPUTS: Improvising for custom type "
+               << input.type << ".\n";
 #endif
-    strFile << "    input->" << name << " = "
+    strFile << "    " << field << " = "
             << "atoi(" << container << "[" << argsidx << "]);\n";
   }
 
@@ -260,12 +651,57 @@ void generatePopulateInput(std::ofstream &strFile, struct Declaration input,
   }
 }
 
-void generatePopulateInputs(std::ofstream &strFile,
+// Inputs which are the size of an array are cut down to its capacity, so that
+// the kernel does not read past the end of the array
+void generateClampSizes(std::ostream &strFile,
+                        const std::list<struct Declaration> &inputs,
+                        bool packedInputs) {
+  for (auto &input : inputs) {
+    if (!input.isArray || input.isPointer ||
+        input.size.find_first_not_of("0123456789") == std::string::npos ||
+        (packedInputs && isVariableLength(input)))
+      continue;
+
+    std::string size = "input->" + input.size;
+    strFile << "  if(" << size << " > " << getArraySize(input) << ")\n";
+    strFile << "    " << size << " = " << getArraySize(input) << ";\n";
+  }
+}
+
+void generatePopulateInputs(std::ostream &strFile,
                             const std::list<struct Declaration> &inputDecls,
-                            const std::list<struct Declaration> &stdinInputs) {
-  strFile << "void populate_inputs(struct " << structs_constants::INPUT
-          << " *input, int argc, char** args, int stdinc, char** stdins)\n";
-  strFile << "{\n";
+                            const std::list<struct Declaration> &stdinInputs,
+                            const BufferOptions &options,
+                            const HostCodeOptions &hostCode) {
+  bool isSoA = options.inputLayout == BufferLayout::structOfArrays;
+  std::string arenaParam;
+  if (options.packedInputs) {
+    arenaParam = ", struct ";
+    arenaParam.append(structs_constants::ARENA);
+    arenaParam.append(" *arena");
+  }
+  if (hostCode.hostArena) {
+    arenaParam.append(", struct ");
+    arenaParam.append(structs_constants::HOST_ARENA);
+    arenaParam.append(" *strings");
+  }
+
+  if (isSoA) {
+    // fill in a struct for the test case, then copy it into the buffers
+    strFile << "void populate_inputs(struct "
+            << structs_constants::INPUT_BUFFERS << " *inputs, int idx, "
+            << "int argc, char** args, int stdinc, char** stdins"
+            << arenaParam << ")\n";
+    strFile << "{\n";
+    strFile << "  struct " << structs_constants::INPUT << " input_rec;\n";
+    strFile << "  struct " << structs_constants::INPUT
+            << " *input = &input_rec;\n";
+  } else {
+    strFile << "void populate_inputs(struct " << structs_constants::INPUT
+            << " *input, int argc, char** args, int stdinc, char** stdins"
+            << arenaParam << ")\n";
+    strFile << "{\n";
+  }
 
   strFile << "  input->" << structs_constants::TEST_CASE_NUM
           << " = atoi(args[0]);\n";
@@ -275,56 +711,2259 @@ void generatePopulateInputs(std::ofstream &strFile,
   for (auto &input : inputDecls) {
     i++;
 
-    generatePopulateInput(strFile, input, "argc", "args", i);
+    generatePopulateInput(strFile, input, "argc", "args", i, options,
+                          hostCode);
   }
 
   i = -2; // stdin args start from index 0
   for (auto &stdinArg : stdinInputs) {
     i++;
-    generatePopulateInput(strFile, stdinArg, "stdinc", "stdins", i);
+    generatePopulateInput(strFile, stdinArg, "stdinc", "stdins", i,
+                          options, hostCode);
+  }
+  generateClampSizes(strFile, inputDecls, options.packedInputs);
+  generateClampSizes(strFile, stdinInputs, options.packedInputs);
+
+  if (isSoA) {
+    strFile << "\n";
+    for (auto &field : getStoredInputFields(inputDecls, stdinInputs, options))
+      strFile << getFieldCopy(field, "input->", "inputs->", "idx", true, "  ");
+  }
+
+  strFile << "}\n";
+}
+
+// Reserves space in the arena, growing it when needed, and returns its offset;
+// the offsets are int in the input, so returns -1 and leaves the arena as it
+// is when the space is past INT_MAX, or cannot be allocated
+void generateArenaAlloc(std::ostream &strFile) {
+  strFile << "int partecl_arena_alloc(struct " << structs_constants::ARENA
+          << " *arena, size_t bytes, size_t align)\n";
+  strFile << "{\n";
+  strFile << "  size_t offset = (arena->size + align - 1) / align * align;\n";
+  strFile << "  if(offset > INT_MAX || bytes > INT_MAX - offset)\n";
+  strFile << "    return -1;\n";
+  strFile << "  if(offset + bytes > arena->capacity)\n";
+  strFile << "  {\n";
+  strFile << "    size_t capacity = arena->capacity ? arena->capacity : "
+             "4096;\n";
+  strFile << "    while(capacity < offset + bytes)\n";
+  strFile << "      capacity *= 2;\n";
+  strFile << "    char *data = (char *)realloc(arena->data, capacity);\n";
+  strFile << "    if(data == NULL)\n";
+  strFile << "      return -1;\n";
+  strFile << "    arena->data = data;\n";
+  strFile << "    arena->capacity = capacity;\n";
+  strFile << "  }\n";
+  strFile << "  arena->size = offset + bytes;\n";
+  strFile << "  return (int)offset;\n";
+  strFile << "}\n\n";
+}
+
+// Copies a string to the current block of the host arena, starting a new
+// block when it does not fit; the blocks never move, so the strings stay put
+// until the arena is reset. A reset frees the blocks, and replaces them by a
+// single one large enough for the whole batch, so that the next batches of
+// the same size do not allocate at all.
+void generateHostArena(std::ostream &strFile) {
+  std::string block = std::string("struct ") + structs_constants::HOST_BLOCK;
+  std::string arena = std::string("struct ") + structs_constants::HOST_ARENA;
+
+  strFile << "static " << block << " *partecl_host_block_new(" << block
+          << " *next, size_t capacity)\n";
+  strFile << "{\n";
+  strFile << "  " << block << " *b = (" << block << " *)malloc(sizeof(" << block
+          << ") + capacity);\n";
+  strFile << "  b->next = next;\n";
+  strFile << "  b->size = 0;\n";
+  strFile << "  b->capacity = capacity;\n";
+  strFile << "  return b;\n";
+  strFile << "}\n\n";
+
+  strFile << "char *partecl_host_strdup(" << arena
+          << " *arena, const char *str)\n";
+  strFile << "{\n";
+  strFile << "  size_t bytes = strlen(str) + 1;\n";
+  strFile << "  " << block << " *b = arena->blocks;\n";
+  strFile << "  if(b == NULL || b->size + bytes > b->capacity)\n";
+  strFile << "  {\n";
+  strFile << "    size_t capacity = b ? b->capacity * 2 : 65536;\n";
+  strFile << "    while(capacity < bytes)\n";
+  strFile << "      capacity *= 2;\n";
+  strFile << "    b = arena->blocks = partecl_host_block_new(b, capacity);\n";
+  strFile << "  }\n";
+  strFile << "  char *copy = b->data + b->size;\n";
+  strFile << "  memcpy(copy, str, bytes);\n";
+  strFile << "  b->size += bytes;\n";
+  strFile << "  return copy;\n";
+  strFile << "}\n\n";
+
+  strFile << "void partecl_host_arena_reset(" << arena << " *arena)\n";
+  strFile << "{\n";
+  strFile << "  " << block << " *b = arena->blocks;\n";
+  strFile << "  if(b == NULL)\n";
+  strFile << "    return;\n";
+  strFile << "  if(b->next == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    b->size = 0;\n";
+  strFile << "    return;\n";
+  strFile << "  }\n";
+  strFile << "  size_t capacity = 0;\n";
+  strFile << "  while(b != NULL)\n";
+  strFile << "  {\n";
+  strFile << "    " << block << " *next = b->next;\n";
+  strFile << "    capacity += b->capacity;\n";
+  strFile << "    free(b);\n";
+  strFile << "    b = next;\n";
+  strFile << "  }\n";
+  strFile << "  arena->blocks = partecl_host_block_new(NULL, capacity);\n";
+  strFile << "}\n\n";
+
+  strFile << "void partecl_host_arena_free(" << arena << " *arena)\n";
+  strFile << "{\n";
+  strFile << "  while(arena->blocks != NULL)\n";
+  strFile << "  {\n";
+  strFile << "    " << block << " *next = arena->blocks->next;\n";
+  strFile << "    free(arena->blocks);\n";
+  strFile << "    arena->blocks = next;\n";
+  strFile << "  }\n";
+  strFile << "}\n\n";
+}
+
+/*
+ * Generate the compiled tests
+ */
+
+// Identifies the fields of the input as they are stored, so that a compiled
+// tests file is only loaded by the code it was compiled with
+std::string getLayoutHash(const std::list<struct Declaration> &fields) {
+  llvm::MD5 hash;
+  for (auto &field : fields) {
+    addToHash(hash, field.type);
+    addToHash(hash, field.name);
+    addToHash(hash, isStoredAsArray(field) ? getArraySize(field) : "");
+  }
+  return "0x" + getHashAsString(hash).substr(0, 16) + "ULL";
+}
+
+void generateTestsHeader(std::ostream &strFile,
+                         const std::list<struct Declaration> &fields,
+                         const BufferOptions &options,
+                         const HostCodeOptions &hostCode) {
+  std::string headerName = structs_constants::TESTS_HEADER;
+  std::string testsName = structs_constants::TESTS;
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string tests = "struct " + testsName;
+  std::string magic = structs_constants::TESTS_MAGIC;
+  std::string layoutHash = getLayoutHash(fields);
+
+  if (!options.packedInputs && !hostCode.hostArena)
+    strFile << "#include <stddef.h>\n";
+  strFile << "#include <stdint.h>\n";
+  strFile << "\n";
+  strFile << "/* A compiled tests file is this header, followed by the "
+             "partecl_input\n";
+  strFile << " * records of all test cases; the layout hash changes with the "
+             "fields of\n";
+  strFile << " * partecl_input, and the loader rejects files compiled for "
+             "other ones */\n";
+  strFile << "#define PARTECL_TESTS_MAGIC \"" << magic << "\"\n";
+  strFile << "#define PARTECL_LAYOUT_HASH " << layoutHash << "\n";
+  strFile << "typedef struct " << headerName << "\n";
+  strFile << "{\n";
+  strFile << "  char magic[8];\n";
+  strFile << "  uint64_t layout_hash;\n";
+  strFile << "  uint64_t record_size;\n";
+  strFile << "  uint64_t num_test_cases;\n";
+  strFile << "} " << headerName << ";\n";
+  strFile << "\n";
+  strFile << "/* The inputs of a mapped tests file, to be passed to the "
+             "kernel as they are */\n";
+  strFile << "typedef struct " << testsName << "\n";
+  strFile << "{\n";
+  strFile << "  void *map;\n";
+  strFile << "  size_t map_size;\n";
+  strFile << "  " << input << " *inputs;\n";
+  strFile << "  size_t num_test_cases;\n";
+  strFile << "} " << testsName << ";\n";
+  strFile << "\n";
+  strFile << "int partecl_compile_tests(const char*, const char*);\n";
+  strFile << "int partecl_load_tests(const char*, " << tests << "*);\n";
+  strFile << "void partecl_unload_tests(" << tests << "*);\n";
+
+}
+
+// Reads a quoted string or a word, starting at `pos`, as the tests parser of
+// the tool does
+void generateTestsToken(std::ostream &strFile) {
+  strFile << "static char *partecl_tests_token(char **pos)\n";
+  strFile << "{\n";
+  strFile << "  char *start = *pos;\n";
+  strFile << "  char *end;\n";
+  strFile << "  if(*start == '\"')\n";
+  strFile << "  {\n";
+  strFile << "    start++;\n";
+  strFile << "    end = strchr(start, '\"');\n";
+  strFile << "    if(end == NULL)\n";
+  strFile << "      end = start + strlen(start);\n";
+  strFile << "  }\n";
+  strFile << "  else\n";
+  strFile << "  {\n";
+  strFile << "    end = start + strcspn(start, \" \\t\\r\\n\");\n";
+  strFile << "  }\n";
+  strFile << "  *pos = *end ? end + 1 : end;\n";
+  strFile << "  *end = '\\0';\n";
+  strFile << "  return start;\n";
+  strFile << "}\n";
+  strFile << "\n";
+}
+
+// Reads a standard input file, relative to the tests file
+void generateReadStdinFile(std::ostream &strFile) {
+  strFile << "static char *partecl_read_stdin_file(const char "
+             "*tests_filename, const char *filename)\n";
+  strFile << "{\n";
+  strFile << "  const char *dir_end = strrchr(tests_filename, '/');\n";
+  strFile << "  size_t dir_length = filename[0] != '/' && dir_end ? dir_end - "
+             "tests_filename + 1 : 0;\n";
+  strFile << "  char *path = (char *)malloc(dir_length + strlen(filename) + "
+             "1);\n";
+  strFile << "  memcpy(path, tests_filename, dir_length);\n";
+  strFile << "  strcpy(path + dir_length, filename);\n";
+  strFile << "  FILE *file = fopen(path, \"rb\");\n";
+  strFile << "  free(path);\n";
+  strFile << "  if(file == NULL)\n";
+  strFile << "    return NULL;\n";
+  strFile << "  fseek(file, 0, SEEK_END);\n";
+  strFile << "  long size = ftell(file);\n";
+  strFile << "  fseek(file, 0, SEEK_SET);\n";
+  strFile << "  char *text = (char *)malloc(size + 1);\n";
+  strFile << "  size = fread(text, 1, size, file);\n";
+  strFile << "  text[size] = '\\0';\n";
+  strFile << "  fclose(file);\n";
+  strFile << "  return text;\n";
+  strFile << "}\n";
+  strFile << "\n";
+}
+
+// Parses the tests file, fills in the input of each test case with
+// populate_inputs and writes it out as it is
+void generateCompileTests(std::ostream &strFile,
+                          const HostCodeOptions &hostCode) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string header = std::string("struct ") +
+                       structs_constants::TESTS_HEADER;
+  // none of the inputs is a string, so the host arena is not used
+  std::string strings = hostCode.hostArena ? ", NULL" : "";
+
+  strFile << "int partecl_compile_tests(const char *tests_filename, const "
+             "char *binary_filename)\n";
+  strFile << "{\n";
+  strFile << "  FILE *tests = fopen(tests_filename, \"r\");\n";
+  strFile << "  if(tests == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open the tests file %s.\\n\", "
+             "tests_filename);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "  FILE *binary = fopen(binary_filename, \"wb\");\n";
+  strFile << "  if(binary == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not create %s.\\n\", "
+             "binary_filename);\n";
+  strFile << "    fclose(tests);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  " << header << " header;\n";
+  strFile << "  memset(&header, 0, sizeof(header));\n";
+  strFile << "  memcpy(header.magic, PARTECL_TESTS_MAGIC, "
+             "sizeof(header.magic));\n";
+  strFile << "  header.layout_hash = PARTECL_LAYOUT_HASH;\n";
+  strFile << "  header.record_size = sizeof(" << input << ");\n";
+  strFile << "  fwrite(&header, sizeof(header), 1, binary);\n";
+  strFile << "\n";
+  strFile << "  int status = 1;\n";
+  strFile << "  char *line = NULL;\n";
+  strFile << "  size_t line_capacity = 0;\n";
+  strFile << "  ssize_t line_length;\n";
+  strFile << "  char **tokens = NULL;\n";
+  strFile << "  int line_number = 0;\n";
+  strFile << "  while(status && (line_length = getline(&line, &line_capacity, "
+             "tests)) != -1)\n";
+  strFile << "  {\n";
+  strFile << "    line_number++;\n";
+  strFile << "    /* a line has fewer values than characters */\n";
+  strFile << "    char **grown = (char **)realloc(tokens, 3 * (line_length "
+             "+ 1) * sizeof(char *));\n";
+  strFile << "    if(grown == NULL)\n";
+  strFile << "    {\n";
+  strFile << "      status = 0;\n";
+  strFile << "      break;\n";
+  strFile << "    }\n";
+  strFile << "    tokens = grown;\n";
+  strFile << "    char **args = tokens;\n";
+  strFile << "    char **stdins = tokens + line_length + 1;\n";
+  strFile << "    char **stdin_files = tokens + 2 * (line_length + 1);\n";
+  strFile << "    int argc = 0;\n";
+  strFile << "    int stdinc = 0;\n";
+  strFile << "    char *pos = line;\n";
+  strFile << "    while(1)\n";
+  strFile << "    {\n";
+  strFile << "      pos += strspn(pos, \" \\t\\r\\n\");\n";
+  strFile << "      if(*pos == '\\0')\n";
+  strFile << "        break;\n";
+  strFile << "      if(*pos != '<')\n";
+  strFile << "      {\n";
+  strFile << "        args[argc++] = partecl_tests_token(&pos);\n";
+  strFile << "        continue;\n";
+  strFile << "      }\n";
+  strFile << "\n";
+  strFile << "      /* a standard input: either quoted text, or the name of a "
+             "file */\n";
+  strFile << "      pos += 1 + strspn(pos + 1, \" \\t\\r\\n\");\n";
+  strFile << "      if(*pos == '\\0')\n";
+  strFile << "      {\n";
+  strFile << "        fprintf(stderr, \"Missing standard input at the end of "
+             "line %d of %s.\\n\", line_number, tests_filename);\n";
+  strFile << "        status = 0;\n";
+  strFile << "        break;\n";
+  strFile << "      }\n";
+  strFile << "      int is_file = *pos != '\"';\n";
+  strFile << "      char *token = partecl_tests_token(&pos);\n";
+  strFile << "      stdin_files[stdinc] = NULL;\n";
+  strFile << "      if(is_file)\n";
+  strFile << "      {\n";
+  strFile << "        token = stdin_files[stdinc] = "
+             "partecl_read_stdin_file(tests_filename, token);\n";
+  strFile << "        if(token == NULL)\n";
+  strFile << "        {\n";
+  strFile << "          fprintf(stderr, \"Could not read the standard input "
+             "file on line %d of %s.\\n\", line_number, tests_filename);\n";
+  strFile << "          status = 0;\n";
+  strFile << "          break;\n";
+  strFile << "        }\n";
+  strFile << "      }\n";
+  strFile << "      stdins[stdinc++] = token;\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    if(status && (argc > 0 || stdinc > 0))\n";
+  strFile << "    {\n";
+  strFile << "      /* zeroed, so that the padding is the same in every "
+             "record */\n";
+  strFile << "      " << input << " input;\n";
+  strFile << "      memset(&input, 0, sizeof(input));\n";
+  strFile << "      populate_inputs(&input, argc, args, stdinc, stdins"
+          << strings << ");\n";
+  strFile << "      if(fwrite(&input, sizeof(input), 1, binary) != 1)\n";
+  strFile << "        status = 0;\n";
+  strFile << "      header.num_test_cases++;\n";
+  strFile << "    }\n";
+  strFile << "    for(int i = 0; i < stdinc; i++)\n";
+  strFile << "      free(stdin_files[i]);\n";
+  strFile << "  }\n";
+  strFile << "  free(line);\n";
+  strFile << "  free(tokens);\n";
+  strFile << "  fclose(tests);\n";
+  strFile << "\n";
+  strFile << "  /* the number of test cases is only known at the end */\n";
+  strFile << "  fseek(binary, 0, SEEK_SET);\n";
+  strFile << "  if(fwrite(&header, sizeof(header), 1, binary) != 1)\n";
+  strFile << "    status = 0;\n";
+  strFile << "  if(fclose(binary) != 0)\n";
+  strFile << "    status = 0;\n";
+  strFile << "  if(!status)\n";
+  strFile << "    fprintf(stderr, \"Could not compile %s into %s.\\n\", "
+             "tests_filename, binary_filename);\n";
+  strFile << "  return status;\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// Maps the records of a compiled tests file into memory; they are private to
+// the process, so they can also be used as the host pointer of a buffer
+void generateLoadTests(std::ostream &strFile) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string header = std::string("struct ") +
+                       structs_constants::TESTS_HEADER;
+  std::string tests = std::string("struct ") + structs_constants::TESTS;
+
+  strFile << "int partecl_load_tests(const char *binary_filename, " << tests
+          << " *tests)\n";
+  strFile << "{\n";
+  strFile << "  int fd = open(binary_filename, O_RDONLY);\n";
+  strFile << "  if(fd < 0)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open %s.\\n\", "
+             "binary_filename);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "  struct stat st;\n";
+  strFile << "  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof("
+          << header << "))\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"%s is not a compiled tests file.\\n\", "
+             "binary_filename);\n";
+  strFile << "    close(fd);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "  void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, "
+             "MAP_PRIVATE, fd, 0);\n";
+  strFile << "  close(fd);\n";
+  strFile << "  if(map == MAP_FAILED)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not map %s into memory.\\n\", "
+             "binary_filename);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  const " << header << " *header = (const " << header
+          << " *)map;\n";
+  strFile << "  if(memcmp(header->magic, PARTECL_TESTS_MAGIC, "
+             "sizeof(header->magic)) != 0 ||\n";
+  strFile << "     header->layout_hash != PARTECL_LAYOUT_HASH ||\n";
+  strFile << "     header->record_size != sizeof(" << input << ") ||\n";
+  strFile << "     (uint64_t)st.st_size != sizeof(*header) + "
+             "header->num_test_cases * header->record_size)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"%s was compiled for another layout of the "
+             "inputs; compile it again.\\n\", binary_filename);\n";
+  strFile << "    munmap(map, st.st_size);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "  tests->map = map;\n";
+  strFile << "  tests->map_size = st.st_size;\n";
+  strFile << "  tests->inputs = (" << input << " *)((char *)map + "
+             "sizeof(*header));\n";
+  strFile << "  tests->num_test_cases = header->num_test_cases;\n";
+  strFile << "  return 1;\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "void partecl_unload_tests(" << tests << " *tests)\n";
+  strFile << "{\n";
+  strFile << "  munmap(tests->map, tests->map_size);\n";
+  strFile << "  tests->map = NULL;\n";
+  strFile << "  tests->inputs = NULL;\n";
+  strFile << "  tests->num_test_cases = 0;\n";
+  strFile << "}\n";
+
+}
+
+void generateCompileTestsTool(const std::string &outputDirectory) {
+  std::stringstream strFile;
+  std::string toolFilename =
+      outputDirectory + "/" + filename_constants::COMPILE_TESTS_FILENAME;
+
+  strFile << "#include <stdio.h>\n";
+  strFile << "#include \"" << filename_constants::CPU_GEN_FILENAME
+          << ".h\"\n\n";
+  strFile << "int main(int argc, char **argv)\n";
+  strFile << "{\n";
+  strFile << "  if(argc != 3)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Usage: %s <tests file> <compiled tests "
+             "file>\\n\", argv[0]);\n";
+  strFile << "    return 1;\n";
+  strFile << "  }\n";
+  strFile << "  return partecl_compile_tests(argv[1], argv[2]) ? 0 : 1;\n";
+  strFile << "}\n";
+
+  writeFileIfChanged(toolFilename, strFile.str());
+  addOutputFile(toolFilename, strFile.str().size());
+}
+
+/*
+ * Generate the tests parser
+ */
+
+// Scans for either of two characters, a vector at a time where the host
+// compiler targets SSE2 or AVX2
+void generateScanner(std::ostream &strFile) {
+  std::string tokenName = structs_constants::TOKEN;
+
+  strFile << "typedef struct " << tokenName << "\n";
+  strFile << "{\n";
+  strFile << "  const char *start;\n";
+  strFile << "  size_t length;\n";
+  strFile << "  char *text;\n";
+  strFile << "} " << tokenName << ";\n";
+  strFile << "\n";
+  strFile << "static const char *partecl_find2(const char *p, const char "
+             "*end, char c1, char c2)\n";
+  strFile << "{\n";
+  strFile << "#if defined(__AVX2__)\n";
+  strFile << "  __m256i v1 = _mm256_set1_epi8(c1);\n";
+  strFile << "  __m256i v2 = _mm256_set1_epi8(c2);\n";
+  strFile << "  for(; end - p >= 32; p += 32)\n";
+  strFile << "  {\n";
+  strFile << "    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);\n";
+  strFile << "    __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, "
+             "v1), _mm256_cmpeq_epi8(chunk, v2));\n";
+  strFile << "    if(_mm256_movemask_epi8(found) != 0)\n";
+  strFile << "      break;\n";
+  strFile << "  }\n";
+  strFile << "#elif defined(__SSE2__)\n";
+  strFile << "  __m128i v1 = _mm_set1_epi8(c1);\n";
+  strFile << "  __m128i v2 = _mm_set1_epi8(c2);\n";
+  strFile << "  for(; end - p >= 16; p += 16)\n";
+  strFile << "  {\n";
+  strFile << "    __m128i chunk = _mm_loadu_si128((const __m128i *)p);\n";
+  strFile << "    __m128i found = _mm_or_si128(_mm_cmpeq_epi8(chunk, v1), "
+             "_mm_cmpeq_epi8(chunk, v2));\n";
+  strFile << "    if(_mm_movemask_epi8(found) != 0)\n";
+  strFile << "      break;\n";
+  strFile << "  }\n";
+  strFile << "#endif\n";
+  strFile << "  while(p < end && *p != c1 && *p != c2)\n";
+  strFile << "    p++;\n";
+  strFile << "  return p;\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// The inputs are converted straight from the tokens of the tests file, to
+// the same values as populate_inputs gives them: it reads float and double
+// inputs with atof, long ones with atol and the others with atoi. Only some
+// of these are used by each program, so they are inline.
+void generateParseValues(std::ostream &strFile) {
+  std::string token = std::string("struct ") + structs_constants::TOKEN;
+
+  strFile << "static inline long partecl_parse_long(" << token << " token)\n";
+  strFile << "{\n";
+  strFile << "  const char *p = token.start;\n";
+  strFile << "  const char *end = p + token.length;\n";
+  strFile << "  int negative = 0;\n";
+  strFile << "  if(p < end && (*p == '-' || *p == '+'))\n";
+  strFile << "    negative = *p++ == '-';\n";
+  strFile << "  unsigned long value = 0;\n";
+  strFile << "  for(; p < end && *p >= '0' && *p <= '9'; p++)\n";
+  strFile << "    value = value * 10 + (*p - '0');\n";
+  strFile << "  return negative ? -(long)value : (long)value;\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "static inline double partecl_parse_double(" << token
+          << " token)\n";
+  strFile << "{\n";
+  strFile << "  char number[64];\n";
+  strFile << "  size_t length = token.length < sizeof(number) - 1 ? "
+             "token.length : sizeof(number) - 1;\n";
+  strFile << "  memcpy(number, token.start, length);\n";
+  strFile << "  number[length] = '\\0';\n";
+  strFile << "  return strtod(number, NULL);\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "static inline char partecl_parse_char(" << token << " token)\n";
+  strFile << "{\n";
+  strFile << "  return token.length > 0 ? token.start[0] : '\\0';\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "static inline void partecl_copy_string(char *str, size_t "
+             "capacity, "
+          << token << " token)\n";
+  strFile << "{\n";
+  strFile << "  size_t length = token.length < capacity - 1 ? token.length : "
+             "capacity - 1;\n";
+  strFile << "  memcpy(str, token.start, length);\n";
+  strFile << "  str[length] = '\\0';\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// Splits a line as the tests parser of the tool does
+void generateSplitLine(std::ostream &strFile) {
+  std::string token = std::string("struct ") + structs_constants::TOKEN;
+  std::string parser = std::string("struct ") + structs_constants::PARSER;
+
+  strFile << "/* Splits a line into its command line arguments and standard "
+             "inputs, keeping\n";
+  strFile << " * as many of them as the inputs use; returns 0 if the line is "
+             "not valid */\n";
+  strFile << "static int partecl_split_line(" << parser << " *parser, const "
+             "char *p, const char *end, " << token << " *args, int *argc, int "
+             "max_args, " << token << " *stdins, int *stdinc, int "
+             "max_stdins)\n";
+  strFile << "{\n";
+  strFile << "  *argc = 0;\n";
+  strFile << "  *stdinc = 0;\n";
+  strFile << "  /* the line end of files written on Windows */\n";
+  strFile << "  while(end > p && end[-1] == '\\r')\n";
+  strFile << "    end--;\n";
+  strFile << "  while(1)\n";
+  strFile << "  {\n";
+  strFile << "    while(p < end && (*p == ' ' || *p == '\\t' || *p == "
+             "'\\r'))\n";
+  strFile << "      p++;\n";
+  strFile << "    if(p == end)\n";
+  strFile << "      return 1;\n";
+  strFile << "\n";
+  strFile << "    int is_stdin = *p == '<';\n";
+  strFile << "    if(is_stdin)\n";
+  strFile << "    {\n";
+  strFile << "      p++;\n";
+  strFile << "      while(p < end && (*p == ' ' || *p == '\\t'))\n";
+  strFile << "        p++;\n";
+  strFile << "      if(p == end)\n";
+  strFile << "      {\n";
+  strFile << "        fprintf(stderr, \"Missing standard input at the end of "
+             "line %d of %s.\\n\", parser->line_number, "
+             "parser->tests_filename);\n";
+  strFile << "        return 0;\n";
+  strFile << "      }\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    " << token << " token;\n";
+  strFile << "    int is_file = is_stdin && *p != '\"';\n";
+  strFile << "    token.text = NULL;\n";
+  strFile << "    if(*p == '\"')\n";
+  strFile << "    {\n";
+  strFile << "      token.start = p + 1;\n";
+  strFile << "      p = partecl_find2(p + 1, end, '\"', '\"');\n";
+  strFile << "      token.length = p - token.start;\n";
+  strFile << "      if(p < end)\n";
+  strFile << "        p++;\n";
+  strFile << "    }\n";
+  strFile << "    else\n";
+  strFile << "    {\n";
+  strFile << "      token.start = p;\n";
+  strFile << "      p = partecl_find2(p, end, ' ', '\\t');\n";
+  strFile << "      token.length = p - token.start;\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    if(!is_stdin)\n";
+  strFile << "    {\n";
+  strFile << "      if(*argc < max_args)\n";
+  strFile << "        args[*argc] = token;\n";
+  strFile << "      (*argc)++;\n";
+  strFile << "      continue;\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    /* a standard input from a file, relative to the tests file "
+             "*/\n";
+  strFile << "    if(is_file && *stdinc < max_stdins)\n";
+  strFile << "    {\n";
+  strFile << "      char *filename = (char *)malloc(token.length + 1);\n";
+  strFile << "      memcpy(filename, token.start, token.length);\n";
+  strFile << "      filename[token.length] = '\\0';\n";
+  strFile << "      token.text = "
+             "partecl_read_stdin_file(parser->tests_filename, filename);\n";
+  strFile << "      free(filename);\n";
+  strFile << "      if(token.text == NULL)\n";
+  strFile << "      {\n";
+  strFile << "        fprintf(stderr, \"Could not read the standard input "
+             "file on line %d of %s.\\n\", parser->line_number, "
+             "parser->tests_filename);\n";
+  strFile << "        for(int i = 0; i < *stdinc; i++)\n";
+  strFile << "          free(stdins[i].text);\n";
+  strFile << "        return 0;\n";
+  strFile << "      }\n";
+  strFile << "      token.start = token.text;\n";
+  strFile << "      token.length = strlen(token.text);\n";
+  strFile << "    }\n";
+  strFile << "    if(*stdinc < max_stdins)\n";
+  strFile << "      stdins[*stdinc] = token;\n";
+  strFile << "    (*stdinc)++;\n";
+  strFile << "  }\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// how a token of the tests file is converted to an input; keep it in step
+// with the conversions in generatePopulateInput
+std::string getTokenConversion(const struct Declaration &input,
+                               const std::string &token) {
+  if (input.type == "float" || input.type == "double")
+    return "partecl_parse_double(" + token + ")";
+  if (!contains(input.type, "int") && contains(input.type, "char"))
+    return "partecl_parse_char(" + token + ")";
+  return "partecl_parse_long(" + token + ")";
+}
+
+// the number of tokens which the inputs are read from, if the first one is
+// read from token `first`
+unsigned getTokenCount(const std::list<struct Declaration> &inputs,
+                       unsigned first) {
+  unsigned count = first;
+  unsigned idx = first;
+  for (auto &input : inputs) {
+    unsigned elements = 1;
+    if (input.isArray && !input.isPointer)
+      elements = std::stoul(getArraySize(input));
+    count = std::max(count, idx + elements);
+    idx++;
   }
+  return std::max(count, 1u);
+}
+
+// Converts the tokens of an input, which starts at token `idx`; like
+// populate_inputs, an array takes the tokens after it
+void generateParseInput(std::ostream &strFile, const struct Declaration &input,
+                        const std::string &tokens, const std::string &count,
+                        unsigned idx) {
+  std::string field = "input->" + input.name;
+  std::string index = std::to_string(idx);
+
+  // a string, whose capacity is known from the tests
+  if (input.isPointer) {
+    strFile << "  if(" << count << " > " << index << ")\n";
+    strFile << "    partecl_copy_string(" << field << ", " << input.capacity
+            << ", " << tokens << "[" << index << "]);\n";
+    return;
+  }
+
+  if (input.isArray) {
+    std::string size = input.size;
+    if (size.find_first_not_of("0123456789") != std::string::npos)
+      size = "input->" + size + " && i < " + getArraySize(input);
+    strFile << "  for(int i = 0; i < " << size << " && i + " << index << " < "
+            << count << "; i++)\n";
+    strFile << "    " << field << "[i] = "
+            << getRangeCheck(input, getTokenConversion(
+                                        input, tokens + "[i + " + index + "]"))
+            << ";\n";
+    return;
+  }
+
+  strFile << "  if(" << count << " > " << index << ")\n";
+  std::string conversion =
+      getTokenConversion(input, tokens + "[" + index + "]");
+  strFile << "    " << field << " = " << getRangeCheck(input, conversion)
+          << ";\n";
+}
+
+// Fills in the input of the test case on a line; returns 1, 0 for an empty
+// line, or -1 if the line is not valid
+void generateParseLine(std::ostream &strFile,
+                       const std::list<struct Declaration> &inputs,
+                       const std::list<struct Declaration> &stdinInputs) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string token = std::string("struct ") + structs_constants::TOKEN;
+  std::string parser = std::string("struct ") + structs_constants::PARSER;
+  std::string maxArgs = std::to_string(getTokenCount(inputs, 1));
+  std::string maxStdins = std::to_string(getTokenCount(stdinInputs, 0));
 
+  strFile << "static int partecl_parse_line(" << parser
+          << " *parser, const char *p, const char *end, " << input
+          << " *input)\n";
+  strFile << "{\n";
+  strFile << "  " << token << " args[" << maxArgs << "];\n";
+  strFile << "  " << token << " stdins[" << maxStdins << "];\n";
+  strFile << "  int argc;\n";
+  strFile << "  int stdinc;\n";
+  strFile << "  if(!partecl_split_line(parser, p, end, args, &argc, "
+          << maxArgs << ", stdins, &stdinc, " << maxStdins << "))\n";
+  strFile << "    return -1;\n";
+  strFile << "  if(argc == 0 && stdinc == 0)\n";
+  strFile << "    return 0;\n";
+  strFile << "  int nargs = argc < " << maxArgs << " ? argc : " << maxArgs
+          << ";\n";
+  strFile << "  int nstdins = stdinc < " << maxStdins << " ? stdinc : "
+          << maxStdins << ";\n\n";
+
+  strFile << "  memset(input, 0, sizeof(*input));\n";
+  strFile << "  if(nargs > 0)\n";
+  strFile << "    input->" << structs_constants::TEST_CASE_NUM
+          << " = partecl_parse_long(args[0]);\n";
+  strFile << "  input->" << structs_constants::ARGC << " = argc;\n";
+  unsigned idx = 1; // command line args start from index 1
+  for (auto &input : inputs)
+    generateParseInput(strFile, input, "args", "nargs", idx++);
+  idx = 0;
+  for (auto &stdinInput : stdinInputs)
+    generateParseInput(strFile, stdinInput, "stdins", "nstdins", idx++);
+  generateClampSizes(strFile, inputs, false);
+  generateClampSizes(strFile, stdinInputs, false);
+
+  strFile << "\n";
+  strFile << "  for(int i = 0; i < nstdins; i++)\n";
+  strFile << "    free(stdins[i].text);\n";
+  strFile << "  return 1;\n";
+  strFile << "}\n\n";
+}
+
+// Parses the complete lines of a chunk, and a whole file chunk by chunk
+void generateParseTests(std::ostream &strFile) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string parser = std::string("struct ") + structs_constants::PARSER;
+
+  strFile << "size_t partecl_parse_tests(" << parser << " *parser, const char "
+             "*data, size_t size, int at_end, " << input << " *inputs, int "
+             "max_inputs, int *num_inputs)\n";
+  strFile << "{\n";
+  strFile << "  const char *p = data;\n";
+  strFile << "  const char *end = data + size;\n";
+  strFile << "  *num_inputs = 0;\n";
+  strFile << "  while(p < end && *num_inputs < max_inputs)\n";
+  strFile << "  {\n";
+  strFile << "    const char *line_end = partecl_find2(p, end, '\\n', "
+             "'\\n');\n";
+  strFile << "    if(line_end == end && !at_end)\n";
+  strFile << "      break;\n";
+  strFile << "    parser->line_number++;\n";
+  strFile << "    int status = partecl_parse_line(parser, p, line_end, "
+             "&inputs[*num_inputs]);\n";
+  strFile << "    if(status < 0)\n";
+  strFile << "      return (size_t)-1;\n";
+  strFile << "    *num_inputs += status;\n";
+  strFile << "    p = line_end < end ? line_end + 1 : end;\n";
+  strFile << "  }\n";
+  strFile << "  return p - data;\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "int partecl_parse_tests_file(const char *tests_filename, "
+          << input << " **inputs)\n";
+  strFile << "{\n";
+  strFile << "  FILE *file = fopen(tests_filename, \"rb\");\n";
+  strFile << "  if(file == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open the tests file %s.\\n\", "
+             "tests_filename);\n";
+  strFile << "    return -1;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  " << parser << " parser;\n";
+  strFile << "  parser.tests_filename = tests_filename;\n";
+  strFile << "  parser.line_number = 0;\n";
+  strFile << "  size_t capacity = PARTECL_PARSE_CHUNK;\n";
+  strFile << "  size_t size = 0;\n";
+  strFile << "  char *buffer = (char *)malloc(capacity);\n";
+  strFile << "  int max_inputs = 1024;\n";
+  strFile << "  int num_inputs = 0;\n";
+  strFile << "  *inputs = (" << input << " *)malloc(max_inputs * sizeof("
+          << input << "));\n";
+  strFile << "  if(buffer == NULL || *inputs == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Out of memory for the tests file %s.\\n\", "
+             "tests_filename);\n";
+  strFile << "    num_inputs = -1;\n";
+  strFile << "  }\n";
+  strFile << "  while(num_inputs >= 0)\n";
+  strFile << "  {\n";
+  strFile << "    /* a line longer than the buffer */\n";
+  strFile << "    if(size == capacity)\n";
+  strFile << "    {\n";
+  strFile << "      char *grown = (char *)realloc(buffer, 2 * capacity);\n";
+  strFile << "      if(grown == NULL)\n";
+  strFile << "      {\n";
+  strFile << "        fprintf(stderr, \"Out of memory for a line of the tests "
+             "file %s.\\n\", tests_filename);\n";
+  strFile << "        num_inputs = -1;\n";
+  strFile << "        break;\n";
+  strFile << "      }\n";
+  strFile << "      buffer = grown;\n";
+  strFile << "      capacity *= 2;\n";
+  strFile << "    }\n";
+  strFile << "    size_t bytes = fread(buffer + size, 1, capacity - size, "
+             "file);\n";
+  strFile << "    size += bytes;\n";
+  strFile << "    int at_end = bytes == 0;\n";
+  strFile << "\n";
+  strFile << "    size_t parsed = 0;\n";
+  strFile << "    while(1)\n";
+  strFile << "    {\n";
+  strFile << "      if(num_inputs == max_inputs)\n";
+  strFile << "      {\n";
+  strFile << "        " << input << " *grown = (" << input
+          << " *)realloc(*inputs, 2 * max_inputs * sizeof(" << input
+          << "));\n";
+  strFile << "        if(grown == NULL)\n";
+  strFile << "        {\n";
+  strFile << "          fprintf(stderr, \"Out of memory for the test cases of "
+             "%s.\\n\", tests_filename);\n";
+  strFile << "          num_inputs = -1;\n";
+  strFile << "          break;\n";
+  strFile << "        }\n";
+  strFile << "        *inputs = grown;\n";
+  strFile << "        max_inputs *= 2;\n";
+  strFile << "      }\n";
+  strFile << "      int parsed_inputs;\n";
+  strFile << "      size_t parsed_bytes = partecl_parse_tests(&parser, buffer "
+             "+ parsed, size - parsed, at_end, *inputs + num_inputs, "
+             "max_inputs - num_inputs, &parsed_inputs);\n";
+  strFile << "      if(parsed_bytes == (size_t)-1)\n";
+  strFile << "      {\n";
+  strFile << "        num_inputs = -1;\n";
+  strFile << "        break;\n";
+  strFile << "      }\n";
+  strFile << "      parsed += parsed_bytes;\n";
+  strFile << "      num_inputs += parsed_inputs;\n";
+  strFile << "      if(num_inputs < max_inputs)\n";
+  strFile << "        break;\n";
+  strFile << "    }\n";
+  strFile << "    if(num_inputs < 0 || at_end)\n";
+  strFile << "      break;\n";
+  strFile << "    memmove(buffer, buffer + parsed, size - parsed);\n";
+  strFile << "    size -= parsed;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  if(ferror(file))\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not read the tests file %s.\\n\", "
+             "tests_filename);\n";
+  strFile << "    num_inputs = -1;\n";
+  strFile << "  }\n";
+  strFile << "  fclose(file);\n";
+  strFile << "  free(buffer);\n";
+  strFile << "  if(num_inputs < 0)\n";
+  strFile << "  {\n";
+  strFile << "    free(*inputs);\n";
+  strFile << "    *inputs = NULL;\n";
+  strFile << "  }\n";
+  strFile << "  return num_inputs;\n";
+  strFile << "}\n";
+
+}
+
+void generateParserHeader(std::ostream &strFile) {
+  std::string parserName = structs_constants::PARSER;
+  std::string parser = "struct " + parserName;
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+
+  strFile << "/* Parses tests files (see doc/Tests.md) straight into "
+             "partecl_input records;\n";
+  strFile << " * the file can be given in chunks, of which only the complete "
+             "lines are\n";
+  strFile << " * parsed */\n";
+  strFile << "#ifndef PARTECL_PARSE_CHUNK\n";
+  strFile << "#define PARTECL_PARSE_CHUNK 65536\n";
+  strFile << "#endif\n";
+  strFile << "typedef struct " << parserName << "\n";
+  strFile << "{\n";
+  strFile << "  const char *tests_filename; /* standard input files are "
+             "relative to it */\n";
+  strFile << "  int line_number;\n";
+  strFile << "} " << parserName << ";\n";
+  strFile << "\n";
+  strFile << "size_t partecl_parse_tests(" << parser << "*, const char*, "
+             "size_t, int, " << input << "*, int, int*);\n";
+  strFile << "int partecl_parse_tests_file(const char*, " << input << "**);\n";
+
+}
+
+// The chunks of a tests file, and the state shared by the threads which
+// parse them
+void generateParallelChunks(std::ostream &strFile) {
+  std::string chunkName = structs_constants::CHUNK;
+  std::string parallelName = structs_constants::PARALLEL_PARSE;
+  std::string chunk = "struct " + chunkName;
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+
+  strFile << "typedef struct " << chunkName << "\n";
+  strFile << "{\n";
+  strFile << "  size_t start;\n";
+  strFile << "  size_t end;\n";
+  strFile << "  int first_line;\n";
+  strFile << "  int num_lines;\n";
+  strFile << "  int first_input;\n";
+  strFile << "  int num_inputs;\n";
+  strFile << "} " << chunkName << ";\n";
+  strFile << "\n";
+  strFile << "typedef struct " << parallelName << "\n";
+  strFile << "{\n";
+  strFile << "  const char *tests_filename;\n";
+  strFile << "  const char *data;\n";
+  strFile << "  " << chunk << " *chunks;\n";
+  strFile << "  int num_chunks;\n";
+  strFile << "  int next_chunk;\n";
+  strFile << "  int counting;\n";
+  strFile << "  int failed;\n";
+  strFile << "  " << input << " *inputs;\n";
+  strFile << "  pthread_mutex_t lock;\n";
+  strFile << "} " << parallelName << ";\n";
+  strFile << "\n";
+  strFile << "/* Counts the lines of a chunk, and the test cases on them */\n";
+  strFile << "static void partecl_count_lines(const char *p, const char *end, "
+             "int *num_lines, int *num_inputs)\n";
+  strFile << "{\n";
+  strFile << "  *num_lines = 0;\n";
+  strFile << "  *num_inputs = 0;\n";
+  strFile << "  while(p < end)\n";
+  strFile << "  {\n";
+  strFile << "    const char *line_end = partecl_find2(p, end, '\\n', "
+             "'\\n');\n";
+  strFile << "    (*num_lines)++;\n";
+  strFile << "    while(p < line_end && (*p == ' ' || *p == '\\t' || *p == "
+             "'\\r'))\n";
+  strFile << "      p++;\n";
+  strFile << "    if(p < line_end)\n";
+  strFile << "      (*num_inputs)++;\n";
+  strFile << "    p = line_end < end ? line_end + 1 : end;\n";
+  strFile << "  }\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// The threads take the next chunk until there are none left, so that they
+// stay busy however unevenly the test cases are spread over the file
+void generateParseWorkers(std::ostream &strFile) {
+  std::string chunk = std::string("struct ") + structs_constants::CHUNK;
+  std::string parallel =
+      std::string("struct ") + structs_constants::PARALLEL_PARSE;
+  std::string parser = std::string("struct ") + structs_constants::PARSER;
+
+  strFile << "/* Takes the chunks one by one, until there are none left */\n";
+  strFile << "static void *partecl_parse_worker(void *arg)\n";
+  strFile << "{\n";
+  strFile << "  " << parallel << " *parse = (" << parallel << " *)arg;\n";
+  strFile << "  while(1)\n";
+  strFile << "  {\n";
+  strFile << "    pthread_mutex_lock(&parse->lock);\n";
+  strFile << "    int idx = parse->next_chunk++;\n";
+  strFile << "    pthread_mutex_unlock(&parse->lock);\n";
+  strFile << "    if(idx >= parse->num_chunks)\n";
+  strFile << "      return NULL;\n";
+  strFile << "\n";
+  strFile << "    " << chunk << " *chunk = &parse->chunks[idx];\n";
+  strFile << "    const char *data = parse->data + chunk->start;\n";
+  strFile << "    size_t size = chunk->end - chunk->start;\n";
+  strFile << "    if(parse->counting)\n";
+  strFile << "    {\n";
+  strFile << "      partecl_count_lines(data, data + size, &chunk->num_lines, "
+             "&chunk->num_inputs);\n";
+  strFile << "      continue;\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    " << parser << " parser;\n";
+  strFile << "    parser.tests_filename = parse->tests_filename;\n";
+  strFile << "    parser.line_number = chunk->first_line;\n";
+  strFile << "    int num_inputs;\n";
+  strFile << "    size_t parsed = partecl_parse_tests(&parser, data, size, 1, "
+             "parse->inputs + chunk->first_input, chunk->num_inputs, "
+             "&num_inputs);\n";
+  strFile << "    if(parsed == (size_t)-1 || num_inputs != "
+             "chunk->num_inputs)\n";
+  strFile << "    {\n";
+  strFile << "      pthread_mutex_lock(&parse->lock);\n";
+  strFile << "      parse->failed = 1;\n";
+  strFile << "      pthread_mutex_unlock(&parse->lock);\n";
+  strFile << "    }\n";
+  strFile << "  }\n";
+  strFile << "}\n";
+  strFile << "\n";
+  strFile << "/* Runs the workers on num_threads threads, including the "
+             "calling one */\n";
+  strFile << "static void partecl_run_workers(" << parallel << " *parse, int "
+             "num_threads)\n";
+  strFile << "{\n";
+  strFile << "  pthread_t *threads = (pthread_t *)malloc(num_threads * "
+             "sizeof(pthread_t));\n";
+  strFile << "  int started = 0;\n";
+  strFile << "  parse->next_chunk = 0;\n";
+  strFile << "  while(started < num_threads - 1 && "
+             "pthread_create(&threads[started], NULL, partecl_parse_worker, "
+             "parse) == 0)\n";
+  strFile << "    started++;\n";
+  strFile << "  partecl_parse_worker(parse);\n";
+  strFile << "  for(int i = 0; i < started; i++)\n";
+  strFile << "    pthread_join(threads[i], NULL);\n";
+  strFile << "  free(threads);\n";
+  strFile << "}\n";
+
+  strFile << "\n";
+}
+
+// Splits the mapped file at line ends, counts the test cases of each chunk
+// in parallel, and then parses each chunk straight into its own place
+void generatePopulateInputsParallel(std::ostream &strFile) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string chunk = std::string("struct ") + structs_constants::CHUNK;
+  std::string parallel =
+      std::string("struct ") + structs_constants::PARALLEL_PARSE;
+
+  strFile << "int populate_inputs_parallel(const char *tests_filename, "
+          << input << " **inputs, int num_threads, size_t chunk_size)\n";
+  strFile << "{\n";
+  strFile << "  *inputs = NULL;\n";
+  strFile << "  if(num_threads <= 0)\n";
+  strFile << "    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);\n";
+  strFile << "  if(num_threads <= 0)\n";
+  strFile << "    num_threads = 1;\n";
+  strFile << "  if(chunk_size == 0)\n";
+  strFile << "    chunk_size = PARTECL_PARALLEL_CHUNK;\n";
+  strFile << "\n";
+  strFile << "  int fd = open(tests_filename, O_RDONLY);\n";
+  strFile << "  struct stat st;\n";
+  strFile << "  if(fd < 0 || fstat(fd, &st) != 0)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open the tests file %s.\\n\", "
+             "tests_filename);\n";
+  strFile << "    if(fd >= 0)\n";
+  strFile << "      close(fd);\n";
+  strFile << "    return -1;\n";
+  strFile << "  }\n";
+  strFile << "  size_t size = st.st_size;\n";
+  strFile << "  if(size == 0)\n";
+  strFile << "  {\n";
+  strFile << "    close(fd);\n";
+  strFile << "    return 0;\n";
+  strFile << "  }\n";
+  strFile << "  const char *data = (const char *)mmap(NULL, size, PROT_READ, "
+             "MAP_PRIVATE, fd, 0);\n";
+  strFile << "  close(fd);\n";
+  strFile << "  if(data == MAP_FAILED)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not map %s into memory.\\n\", "
+             "tests_filename);\n";
+  strFile << "    return -1;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  /* every chunk but the last is at least chunk_size bytes, and "
+             "ends a line */\n";
+  strFile << "  " << parallel << " parse;\n";
+  strFile << "  parse.tests_filename = tests_filename;\n";
+  strFile << "  parse.data = data;\n";
+  strFile << "  parse.chunks = (" << chunk << " *)malloc((size / chunk_size + "
+             "1) * sizeof(" << chunk << "));\n";
+  strFile << "  parse.num_chunks = 0;\n";
+  strFile << "  parse.failed = 0;\n";
+  strFile << "  parse.inputs = NULL;\n";
+  strFile << "  pthread_mutex_init(&parse.lock, NULL);\n";
+  strFile << "  for(size_t start = 0; start < size; )\n";
+  strFile << "  {\n";
+  strFile << "    size_t end = size - start > chunk_size ? start + chunk_size "
+             ": size;\n";
+  strFile << "    end = partecl_find2(data + end, data + size, '\\n', '\\n') "
+             "- data;\n";
+  strFile << "    if(end < size)\n";
+  strFile << "      end++;\n";
+  strFile << "    parse.chunks[parse.num_chunks].start = start;\n";
+  strFile << "    parse.chunks[parse.num_chunks].end = end;\n";
+  strFile << "    parse.num_chunks++;\n";
+  strFile << "    start = end;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  /* count the test cases first, so that each chunk knows where "
+             "its go */\n";
+  strFile << "  parse.counting = 1;\n";
+  strFile << "  partecl_run_workers(&parse, num_threads);\n";
+  strFile << "  int num_lines = 0;\n";
+  strFile << "  int num_inputs = 0;\n";
+  strFile << "  for(int i = 0; i < parse.num_chunks; i++)\n";
+  strFile << "  {\n";
+  strFile << "    parse.chunks[i].first_line = num_lines;\n";
+  strFile << "    parse.chunks[i].first_input = num_inputs;\n";
+  strFile << "    num_lines += parse.chunks[i].num_lines;\n";
+  strFile << "    num_inputs += parse.chunks[i].num_inputs;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  parse.counting = 0;\n";
+  strFile << "  parse.inputs = (" << input << " *)malloc((num_inputs > 0 ? "
+             "num_inputs : 1) * sizeof(" << input << "));\n";
+  strFile << "  partecl_run_workers(&parse, num_threads);\n";
+  strFile << "\n";
+  strFile << "  pthread_mutex_destroy(&parse.lock);\n";
+  strFile << "  free(parse.chunks);\n";
+  strFile << "  munmap((void *)data, size);\n";
+  strFile << "  if(parse.failed)\n";
+  strFile << "  {\n";
+  strFile << "    free(parse.inputs);\n";
+  strFile << "    return -1;\n";
+  strFile << "  }\n";
+  strFile << "  *inputs = parse.inputs;\n";
+  strFile << "  return num_inputs;\n";
   strFile << "}\n";
+
+}
+
+void generateParallelHeader(std::ostream &strFile) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+
+  strFile << "/* Parses a tests file on num_threads threads (0 for one per "
+             "processor), in\n";
+  strFile << " * chunks of about chunk_size bytes (0 for "
+             "PARTECL_PARALLEL_CHUNK), writing\n";
+  strFile << " * each test case to its place in *inputs; returns the number "
+             "of test cases,\n";
+  strFile << " * or -1 on an error */\n";
+  strFile << "#ifndef PARTECL_PARALLEL_CHUNK\n";
+  strFile << "#define PARTECL_PARALLEL_CHUNK 4194304\n";
+  strFile << "#endif\n";
+  strFile << "int populate_inputs_parallel(const char*, " << input << "**, "
+             "int, size_t);\n";
+
 }
 
 void generateCpuGen(const std::string &outputDirectory,
                     const std::list<struct Declaration> &inputs,
                     const std::list<struct ResultDeclaration> &results,
-                    const std::list<struct Declaration> &stdinInputs) {
-  llvm::outs() << "Generating CPU code... ";
+                    const std::list<struct Declaration> &stdinInputs,
+                    const BufferOptions &options,
+                    const HostCodeOptions &hostCode) {
+  messages() << "Generating CPU code... ";
+
+  bool canCompile = canCompileTests(inputs, stdinInputs, options);
+  bool isCompiled = hostCode.binaryTests && canCompile;
+  bool isParsed = hostCode.testsParser && canCompile;
+  bool isParallel = hostCode.parallelTests && canCompile;
+  if ((hostCode.binaryTests || hostCode.testsParser) && !canCompile)
+    messages() << "\nSome of the inputs are strings of unknown size, so the "
+                  "tests cannot be compiled or parsed into records; give "
+                  "-tests to size them.\n";
 
   // generate header file
-  std::ofstream headerFile;
+  std::stringstream headerFile;
   std::string headerFilename =
       outputDirectory + "/" + filename_constants::CPU_GEN_FILENAME + ".h";
-  headerFile.open(headerFilename);
 
   headerFile << "#ifndef CPU_GEN_H\n";
   headerFile << "#define CPU_GEN_H\n";
   headerFile << "#include \"structs.h\"\n\n";
-  headerFile << "void populate_inputs(struct " << structs_constants::INPUT
-             << "*, int, char**, int, char**);\n\n";
-  headerFile << "void compare_results(struct " << structs_constants::RESULT
+  // the failures are read back from the device buffers
+  if (options.compactResults) {
+    headerFile << "#ifndef CL_TARGET_OPENCL_VERSION\n";
+    headerFile << "#define CL_TARGET_OPENCL_VERSION 120\n";
+    headerFile << "#endif\n";
+    headerFile << "#ifdef __APPLE__\n";
+    headerFile << "#include <OpenCL/cl.h>\n";
+    headerFile << "#else\n";
+    headerFile << "#include <CL/cl.h>\n";
+    headerFile << "#endif\n\n";
+  }
+  std::string arenaParam;
+  if (options.packedInputs) {
+    headerFile << "#include <stddef.h>\n\n";
+    headerFile << "/* The variable length inputs of all test cases, one after "
+                  "the other;\n";
+    headerFile << " * passed to the kernel as a single buffer, after the "
+                  "inputs */\n";
+    headerFile << "typedef struct " << structs_constants::ARENA << "\n";
+    headerFile << "{\n";
+    headerFile << "  char *data;\n";
+    headerFile << "  size_t size;\n";
+    headerFile << "  size_t capacity;\n";
+    headerFile << "} " << structs_constants::ARENA << ";\n\n";
+    headerFile << "int partecl_arena_alloc(struct " << structs_constants::ARENA
+               << "*, size_t, size_t);\n\n";
+    arenaParam = ", struct ";
+    arenaParam.append(structs_constants::ARENA);
+    arenaParam.append("*");
+  }
+  if (hostCode.hostArena) {
+    if (!options.packedInputs)
+      headerFile << "#include <stddef.h>\n\n";
+    headerFile << "/* The strings in the inputs of a batch of test cases; "
+                  "starts empty, and\n";
+    headerFile << " * partecl_host_arena_reset frees them all once the batch "
+                  "is done */\n";
+    headerFile << "typedef struct " << structs_constants::HOST_BLOCK << "\n";
+    headerFile << "{\n";
+    headerFile << "  struct " << structs_constants::HOST_BLOCK << " *next;\n";
+    headerFile << "  size_t size;\n";
+    headerFile << "  size_t capacity;\n";
+    headerFile << "  char data[];\n";
+    headerFile << "} " << structs_constants::HOST_BLOCK << ";\n\n";
+    headerFile << "typedef struct " << structs_constants::HOST_ARENA << "\n";
+    headerFile << "{\n";
+    headerFile << "  struct " << structs_constants::HOST_BLOCK
+               << " *blocks;\n";
+    headerFile << "} " << structs_constants::HOST_ARENA << ";\n\n";
+    headerFile << "char *partecl_host_strdup(struct "
+               << structs_constants::HOST_ARENA << "*, const char*);\n";
+    headerFile << "void partecl_host_arena_reset(struct "
+               << structs_constants::HOST_ARENA << "*);\n";
+    headerFile << "void partecl_host_arena_free(struct "
+               << structs_constants::HOST_ARENA << "*);\n\n";
+    arenaParam.append(", struct ");
+    arenaParam.append(structs_constants::HOST_ARENA);
+    arenaParam.append("*");
+  }
+  if (options.inputLayout == BufferLayout::structOfArrays)
+    headerFile << "void populate_inputs(struct "
+               << structs_constants::INPUT_BUFFERS
+               << "*, int, int, char**, int, char**" << arenaParam
+               << ");\n\n";
+  else
+    headerFile << "void populate_inputs(struct " << structs_constants::INPUT
+               << "*, int, char**, int, char**" << arenaParam << ");\n\n";
+  headerFile << "void compare_results(struct "
+             << (options.resultLayout == BufferLayout::structOfArrays
+                     ? structs_constants::RESULT_BUFFERS
+                     : structs_constants::RESULT)
              << "*, struct " << structs_constants::RESULT << "*, int);\n\n";
+  if (isCompiled)
+    generateTestsHeader(headerFile,
+                        getStoredInputFields(inputs, stdinInputs, options),
+                        options, hostCode);
+  if (isParsed)
+    generateParserHeader(headerFile);
+  if (isParallel)
+    generateParallelHeader(headerFile);
+  if (options.compareOnDevice) {
+    headerFile << "/* Written by the comparison kernel: a bit for each test "
+                  "case, set if it failed */\n";
+    headerFile << "#define PARTECL_FAIL_BITMAP_WORDS(num_test_cases) "
+                  "(((num_test_cases) + 31) / 32)\n";
+    headerFile << "#define PARTECL_FAILED(fail_bits, idx) "
+                  "(((fail_bits)[(idx) / 32] >> ((idx) % 32)) & 1)\n\n";
+  }
+  if (options.compareOnDevice || options.compactResults)
+    headerFile << "void print_failures(struct " << structs_constants::RESULT
+               << "*, unsigned int*, int);\n\n";
+  if (options.compactResults) {
+    headerFile << "/* The kernel writes only the failing results, one after "
+                  "the other, and counts them in partecl_num_failures */\n";
+    headerFile << "cl_int partecl_reset_failures(cl_command_queue, cl_mem, "
+                  "cl_uint, const cl_event*, cl_event*);\n";
+    headerFile << "int partecl_read_failures(cl_command_queue, cl_mem, cl_mem, "
+                  "struct " << structs_constants::RESULT
+               << "*, cl_uint, const cl_event*);\n\n";
+  }
   headerFile << "#endif\n";
 
-  headerFile.close();
+  writeFileIfChanged(headerFilename, headerFile.str());
+  addOutputFile(headerFilename, headerFile.str().size());
 
   // generate source file
-  std::ofstream strFile;
+  std::stringstream strFile;
   std::string sourceFilename =
       outputDirectory + "/" + filename_constants::CPU_GEN_FILENAME + ".c";
-  strFile.open(sourceFilename);
 
+  // getline, mmap and the threads are POSIX
+  if (isCompiled || isParallel)
+    strFile << "#define _POSIX_C_SOURCE 200809L\n";
   strFile << "#include <stdlib.h>\n";
   strFile << "#include <string.h>\n";
   strFile << "#include <stdio.h>\n";
+  strFile << "#include <math.h>\n";
+  if (options.packedInputs)
+    strFile << "#include <limits.h>\n";
+  if (isCompiled || isParallel) {
+    strFile << "#include <fcntl.h>\n";
+    strFile << "#include <sys/mman.h>\n";
+    strFile << "#include <sys/stat.h>\n";
+    strFile << "#include <unistd.h>\n";
+  }
+  if (isParallel)
+    strFile << "#include <pthread.h>\n";
+  if (isParsed) {
+    strFile << "#if defined(__AVX2__)\n";
+    strFile << "#include <immintrin.h>\n";
+    strFile << "#elif defined(__SSE2__)\n";
+    strFile << "#include <emmintrin.h>\n";
+    strFile << "#endif\n";
+  }
   strFile << "#include \"cpu-gen.h\"\n\n";
+  // compare_results compares floating point results as the kernels do
+  strFile << "#ifndef PARTECL_TOLERANCE\n";
+  strFile << "#define PARTECL_TOLERANCE 0\n";
+  strFile << "#endif\n\n";
+
+  if (isNarrowed(inputs) || isNarrowed(stdinInputs))
+    generateCheckRange(strFile);
+  if (options.packedInputs)
+    generateArenaAlloc(strFile);
+  if (hostCode.hostArena)
+    generateHostArena(strFile);
+  generatePopulateInputs(strFile, inputs, stdinInputs, options, hostCode);
+  generateCompareResults(strFile, results, options);
+  if (options.compareOnDevice || options.compactResults) {
+    strFile << "\n";
+    generatePrintFailures(strFile, results);
+  }
+  if (options.compactResults) {
+    strFile << "\n";
+    generateReadFailures(strFile);
+  }
+  if (isCompiled || isParsed)
+    strFile << "\n";
+  if (isCompiled)
+    generateTestsToken(strFile);
+  if (isCompiled || isParsed)
+    generateReadStdinFile(strFile);
+  if (isCompiled) {
+    generateCompileTests(strFile, hostCode);
+    generateLoadTests(strFile);
+  }
+  if (isParsed) {
+    if (isCompiled)
+      strFile << "\n";
+    generateScanner(strFile);
+    generateParseValues(strFile);
+    generateSplitLine(strFile);
+    generateParseLine(strFile, inputs, stdinInputs);
+    generateParseTests(strFile);
+  }
+  if (isParallel) {
+    strFile << "\n";
+    generateParallelChunks(strFile);
+    generateParseWorkers(strFile);
+    generatePopulateInputsParallel(strFile);
+  }
+
+  writeFileIfChanged(sourceFilename, strFile.str());
+  addOutputFile(sourceFilename, strFile.str().size());
+
+  messages() << "DONE!\n";
+}
+
+/*
+ * Generate host-gen.c
+ */
+
+// The includes, and a check of the result of every OpenCL call
+void generateHostDriverHeader(std::ostream &strFile) {
+  strFile << "#define _POSIX_C_SOURCE 200809L\n";
+  strFile << "#define CL_TARGET_OPENCL_VERSION 120\n";
+  strFile << "#define CL_USE_DEPRECATED_OPENCL_1_2_APIS\n";
+  strFile << "#include <stdio.h>\n";
+  strFile << "#include <stdlib.h>\n";
+  strFile << "#include <string.h>\n";
+  strFile << "#include <time.h>\n";
+  strFile << "#ifdef __APPLE__\n";
+  strFile << "#include <OpenCL/cl.h>\n";
+  strFile << "#else\n";
+  strFile << "#include <CL/cl.h>\n";
+  strFile << "#endif\n";
+  strFile << "#include \"" << filename_constants::CPU_GEN_FILENAME
+          << ".h\"\n\n";
+  strFile << "#define PARTECL_CL_CHECK(call) \\\n";
+  strFile << "  do \\\n";
+  strFile << "  { \\\n";
+  strFile << "    cl_int partecl_err = (call); \\\n";
+  strFile << "    if(partecl_err != CL_SUCCESS) \\\n";
+  strFile << "    { \\\n";
+  strFile << "      fprintf(stderr, \"%s failed with error %d.\\n\", #call, "
+             "partecl_err); \\\n";
+  strFile << "      exit(1); \\\n";
+  strFile << "    } \\\n";
+  strFile << "  } while(0)\n";
+}
+
+// A slot holds a batch of test cases, on the host and on the device
+void generateHostDriverStructs(std::ostream &strFile, bool isCompacted) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string result = std::string("struct ") + structs_constants::RESULT;
+  std::string parser = std::string("struct ") + structs_constants::PARSER;
+  std::string slot = std::string("struct ") + structs_constants::SLOT;
+  std::string reader = std::string("struct ") + structs_constants::READER;
+
+  strFile << "/* The test cases of a batch, on the host and on the device, "
+             "and the event of\n";
+  strFile << " * the last command which uses them */\n";
+  strFile << slot << "\n";
+  strFile << "{\n";
+  strFile << "  " << input << " *inputs;\n";
+  strFile << "  " << result << " *results;\n";
+  strFile << "  " << result << " *exp_results;\n";
+  strFile << "  unsigned int *failures;\n";
+  strFile << "  cl_mem inputs_buf;\n";
+  strFile << "  cl_mem results_buf;\n";
+  strFile << "  cl_mem exp_results_buf;\n";
+  strFile << "  cl_mem num_failures_buf;\n";
+  if (!isCompacted) {
+    strFile << "  cl_mem fail_bits_buf;\n";
+    strFile << "  cl_mem failures_buf;\n";
+    strFile << "  cl_uint num_failures;\n";
+  }
+  strFile << "  int num_test_cases;\n";
+  strFile << "  cl_event done;\n";
+  strFile << "};\n";
+  strFile << "\n";
+  strFile << "/* Reads the tests file a chunk at a time */\n";
+  strFile << reader << "\n";
+  strFile << "{\n";
+  strFile << "  FILE *file;\n";
+  strFile << "  char *buffer;\n";
+  strFile << "  size_t capacity;\n";
+  strFile << "  size_t size;\n";
+  strFile << "  size_t parsed;\n";
+  strFile << "  int at_end;\n";
+  strFile << "  " << parser << " parser;\n";
+  strFile << "};\n";
+}
 
-  generatePopulateInputs(strFile, inputs, stdinInputs);
-  generateCompareResults(strFile, results);
+// Fills a batch from the tests file, with the tests parser, reading more of
+// the file only when the parser runs out of whole lines
+void generateReadBatch(std::ostream &strFile) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string reader = std::string("struct ") + structs_constants::READER;
+
+  strFile << "/* Parses up to batch_size test cases; returns how many, or -1 "
+             "on an error */\n";
+  strFile << "static int partecl_read_batch(" << reader << " *reader, "
+          << input << " *inputs, int batch_size)\n";
+  strFile << "{\n";
+  strFile << "  int num_inputs = 0;\n";
+  strFile << "  while(1)\n";
+  strFile << "  {\n";
+  strFile << "    int parsed_inputs;\n";
+  strFile << "    size_t parsed_bytes = partecl_parse_tests(&reader->parser, "
+             "reader->buffer + reader->parsed, reader->size - reader->parsed, "
+             "reader->at_end, inputs + num_inputs, batch_size - num_inputs, "
+             "&parsed_inputs);\n";
+  strFile << "    if(parsed_bytes == (size_t)-1)\n";
+  strFile << "      return -1;\n";
+  strFile << "    reader->parsed += parsed_bytes;\n";
+  strFile << "    num_inputs += parsed_inputs;\n";
+  strFile << "    if(num_inputs == batch_size || reader->at_end)\n";
+  strFile << "      return num_inputs;\n";
+  strFile << "\n";
+  strFile << "    /* keep the incomplete line, and read the next chunk after "
+             "it */\n";
+  strFile << "    memmove(reader->buffer, reader->buffer + reader->parsed, "
+             "reader->size - reader->parsed);\n";
+  strFile << "    reader->size -= reader->parsed;\n";
+  strFile << "    reader->parsed = 0;\n";
+  strFile << "    if(reader->size == reader->capacity)\n";
+  strFile << "    {\n";
+  strFile << "      char *grown = (char *)realloc(reader->buffer, 2 * "
+             "reader->capacity);\n";
+  strFile << "      if(grown == NULL)\n";
+  strFile << "      {\n";
+  strFile << "        fprintf(stderr, \"Out of memory for a line of the tests "
+             "file %s.\\n\", reader->parser.tests_filename);\n";
+  strFile << "        return -1;\n";
+  strFile << "      }\n";
+  strFile << "      reader->buffer = grown;\n";
+  strFile << "      reader->capacity *= 2;\n";
+  strFile << "    }\n";
+  strFile << "    size_t bytes = fread(reader->buffer + reader->size, 1, "
+             "reader->capacity - reader->size, reader->file);\n";
+  strFile << "    reader->size += bytes;\n";
+  strFile << "    reader->at_end = bytes == 0;\n";
+  strFile << "  }\n";
+  strFile << "}\n";
+}
+
+// Builds a kernel with the plain OpenCL 1.2 API, which every ICD has
+void generateBuildKernel(std::ostream &strFile) {
+  strFile << "/* Builds the kernel from the given files, which are compiled "
+             "together */\n";
+  strFile << "static cl_kernel partecl_build_kernel(cl_context context, "
+             "cl_device_id device, int num_files, char **filenames, const char "
+             "*kernel_name)\n";
+  strFile << "{\n";
+  strFile << "  char **sources = (char **)malloc(num_files * sizeof(char "
+             "*));\n";
+  strFile << "  for(int i = 0; i < num_files; i++)\n";
+  strFile << "  {\n";
+  strFile << "    FILE *file = fopen(filenames[i], \"rb\");\n";
+  strFile << "    if(file == NULL)\n";
+  strFile << "    {\n";
+  strFile << "      fprintf(stderr, \"Could not open the kernel file "
+             "%s.\\n\", filenames[i]);\n";
+  strFile << "      exit(1);\n";
+  strFile << "    }\n";
+  strFile << "    fseek(file, 0, SEEK_END);\n";
+  strFile << "    long size = ftell(file);\n";
+  strFile << "    fseek(file, 0, SEEK_SET);\n";
+  strFile << "    sources[i] = (char *)malloc(size + 1);\n";
+  strFile << "    size = fread(sources[i], 1, size, file);\n";
+  strFile << "    sources[i][size] = '\\0';\n";
+  strFile << "    fclose(file);\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  /* structs.h is next to the kernel files */\n";
+  strFile << "  char options[4096] = \"-I .\";\n";
+  strFile << "  const char *dir_end = strrchr(filenames[0], '/');\n";
+  strFile << "  if(dir_end != NULL)\n";
+  strFile << "    snprintf(options, sizeof(options), \"-I %.*s\", "
+             "(int)(dir_end - filenames[0]), filenames[0]);\n";
+  strFile << "\n";
+  strFile << "  cl_int err;\n";
+  strFile << "  cl_program program = clCreateProgramWithSource(context, "
+             "num_files, (const char **)sources, NULL, &err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  strFile << "  if(clBuildProgram(program, 1, &device, options, NULL, NULL) "
+             "!= CL_SUCCESS)\n";
+  strFile << "  {\n";
+  strFile << "    size_t log_size;\n";
+  strFile << "    clGetProgramBuildInfo(program, device, "
+             "CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);\n";
+  strFile << "    char *log = (char *)malloc(log_size + 1);\n";
+  strFile << "    clGetProgramBuildInfo(program, device, "
+             "CL_PROGRAM_BUILD_LOG, log_size, log, NULL);\n";
+  strFile << "    log[log_size] = '\\0';\n";
+  strFile << "    fprintf(stderr, \"Could not build the kernel:\\n%s\\n\", "
+             "log);\n";
+  strFile << "    exit(1);\n";
+  strFile << "  }\n";
+  strFile << "  cl_kernel kernel = clCreateKernel(program, kernel_name, "
+             "&err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  strFile << "\n";
+  strFile << "  clReleaseProgram(program);\n";
+  strFile << "  for(int i = 0; i < num_files; i++)\n";
+  strFile << "    free(sources[i]);\n";
+  strFile << "  free(sources);\n";
+  strFile << "  return kernel;\n";
+  strFile << "}\n";
+}
+
+void generateGetDevice(std::ostream &strFile) {
+  strFile << "static cl_device_id partecl_get_device(int platform_idx, int "
+             "device_idx)\n";
+  strFile << "{\n";
+  strFile << "  cl_uint num_platforms;\n";
+  strFile << "  PARTECL_CL_CHECK(clGetPlatformIDs(0, NULL, &num_platforms));\n";
+  strFile << "  if(platform_idx >= (int)num_platforms)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"There is no OpenCL platform %d.\\n\", "
+             "platform_idx);\n";
+  strFile << "    exit(1);\n";
+  strFile << "  }\n";
+  strFile << "  cl_platform_id *platforms = (cl_platform_id "
+             "*)malloc(num_platforms * sizeof(cl_platform_id));\n";
+  strFile << "  PARTECL_CL_CHECK(clGetPlatformIDs(num_platforms, platforms, "
+             "NULL));\n";
+  strFile << "\n";
+  strFile << "  cl_uint num_devices;\n";
+  strFile << "  PARTECL_CL_CHECK(clGetDeviceIDs(platforms[platform_idx], "
+             "CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices));\n";
+  strFile << "  if(device_idx >= (int)num_devices)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"There is no device %d on OpenCL platform "
+             "%d.\\n\", device_idx, platform_idx);\n";
+  strFile << "    exit(1);\n";
+  strFile << "  }\n";
+  strFile << "  cl_device_id *devices = (cl_device_id *)malloc(num_devices * "
+             "sizeof(cl_device_id));\n";
+  strFile << "  PARTECL_CL_CHECK(clGetDeviceIDs(platforms[platform_idx], "
+             "CL_DEVICE_TYPE_ALL, num_devices, devices, NULL));\n";
+  strFile << "  cl_device_id device = devices[device_idx];\n";
+  strFile << "  free(devices);\n";
+  strFile << "  free(platforms);\n";
+  strFile << "  return device;\n";
+  strFile << "}\n";
+}
+
+// With compacted results, the kernel has already compared the results, and
+// only the failures are read back, with partecl_read_failures. Otherwise the
+// comparison kernel runs after it, and only the indices of the failures, and
+// then their results, are read back; or, without expected results, all of the
+// results are written to a file, to be the expected results of later runs.
+void generateFinishBatch(std::ostream &strFile, bool isCompacted) {
+  std::string result = std::string("struct ") + structs_constants::RESULT;
+  std::string slot = std::string("struct ") + structs_constants::SLOT;
+
+  strFile << "/* Orders the failures as the test cases are in the tests file "
+             "*/\n";
+  strFile << "static int partecl_compare_failures(const void *a, const void "
+             "*b)\n";
+  strFile << "{\n";
+  if (isCompacted) {
+    strFile << "  int x = ((const " << result << " *)a)->"
+            << structs_constants::TEST_CASE_NUM << ";\n";
+    strFile << "  int y = ((const " << result << " *)b)->"
+            << structs_constants::TEST_CASE_NUM << ";\n";
+  } else {
+    strFile << "  unsigned int x = *(const unsigned int *)a;\n";
+    strFile << "  unsigned int y = *(const unsigned int *)b;\n";
+  }
+  strFile << "  return (x > y) - (x < y);\n";
+  strFile << "}\n";
+  strFile << "\n";
+
+  if (isCompacted) {
+    strFile << "/* Waits for a batch, and prints its failures; returns how "
+               "many there are, or\n";
+    strFile << " * -1 on an error */\n";
+    strFile << "static int partecl_finish_batch(" << slot
+            << " *slot, cl_command_queue queue)\n";
+    strFile << "{\n";
+    strFile << "  if(slot->num_test_cases == 0)\n";
+    strFile << "    return 0;\n";
+    strFile << "  int num_failures = partecl_read_failures(queue, "
+               "slot->results_buf, slot->num_failures_buf, slot->results, 1, "
+               "&slot->done);\n";
+    strFile << "  clReleaseEvent(slot->done);\n";
+    strFile << "  slot->num_test_cases = 0;\n";
+    strFile << "  if(num_failures <= 0)\n";
+    strFile << "    return num_failures;\n";
+    strFile << "\n";
+    strFile << "  qsort(slot->results, num_failures, sizeof(" << result
+            << "), partecl_compare_failures);\n";
+    strFile << "  for(int i = 0; i < num_failures; i++)\n";
+    strFile << "    slot->failures[i] = slot->results[i]."
+            << structs_constants::TEST_CASE_NUM << ";\n";
+    strFile << "  print_failures(slot->results, slot->failures, "
+               "num_failures);\n";
+    strFile << "  return num_failures;\n";
+    strFile << "}\n";
+    return;
+  }
+
+  strFile << "/* Waits for a batch, and prints its failures, or writes its "
+             "results to\n";
+  strFile << " * results_file if it is given; returns the number of failures, "
+             "or -1 on an\n";
+  strFile << " * error */\n";
+  strFile << "static int partecl_finish_batch(" << slot
+          << " *slot, cl_command_queue queue, FILE *results_file)\n";
+  strFile << "{\n";
+  strFile << "  if(slot->num_test_cases == 0)\n";
+  strFile << "    return 0;\n";
+  strFile << "  PARTECL_CL_CHECK(clWaitForEvents(1, &slot->done));\n";
+  strFile << "  clReleaseEvent(slot->done);\n";
+  strFile << "  int num_test_cases = slot->num_test_cases;\n";
+  strFile << "  slot->num_test_cases = 0;\n";
+  strFile << "  if(results_file != NULL)\n";
+  strFile << "  {\n";
+  strFile << "    if(fwrite(slot->results, sizeof(" << result
+          << "), num_test_cases, results_file) == (size_t)num_test_cases)\n";
+  strFile << "      return 0;\n";
+  strFile << "    fprintf(stderr, \"Could not write the results.\\n\");\n";
+  strFile << "    return -1;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  int num_failures = slot->num_failures;\n";
+  strFile << "  if(num_failures == 0)\n";
+  strFile << "    return 0;\n";
+  strFile << "  qsort(slot->failures, num_failures, sizeof(unsigned int), "
+             "partecl_compare_failures);\n";
+  strFile << "  for(int i = 0; i < num_failures; i++)\n";
+  strFile << "  {\n";
+  strFile << "    unsigned int idx = slot->failures[i];\n";
+  strFile << "    PARTECL_CL_CHECK(clEnqueueReadBuffer(queue, "
+             "slot->results_buf, CL_FALSE, idx * sizeof(" << result
+          << "), sizeof(" << result
+          << "), &slot->results[i], 0, NULL, NULL));\n";
+  strFile << "    slot->failures[i] = slot->inputs[idx]."
+          << structs_constants::TEST_CASE_NUM << ";\n";
+  strFile << "  }\n";
+  strFile << "  PARTECL_CL_CHECK(clFinish(queue));\n";
+  strFile << "  print_failures(slot->results, slot->failures, num_failures);\n";
+  strFile << "  return num_failures;\n";
+  strFile << "}\n";
+}
+
+// Runs the batches through three queues, so that the upload, the kernel and
+// the download of different batches can overlap, while the host parses the
+// next batch and prints the failures of the last one
+void generateHostDriverMain(std::ostream &strFile, bool isCompacted) {
+  std::string input = std::string("struct ") + structs_constants::INPUT;
+  std::string result = std::string("struct ") + structs_constants::RESULT;
+  std::string slot = std::string("struct ") + structs_constants::SLOT;
+  std::string reader = std::string("struct ") + structs_constants::READER;
+  // the results are written to a file only when all of them are read back
+  std::string resultsFile = isCompacted ? "" : ", results_file";
+
+  strFile << "int main(int argc, char **argv)\n";
+  strFile << "{\n";
+  strFile << "  int batch_size = 65536;\n";
+  strFile << "  int num_slots = 3;\n";
+  strFile << "  int platform_idx = 0;\n";
+  strFile << "  int device_idx = 0;\n";
+  strFile << "  char *exp_filename = NULL;\n";
+  if (!isCompacted)
+    strFile << "  char *results_filename = NULL;\n";
+  strFile << "  int arg = 1;\n";
+  strFile << "  for(; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)\n";
+  strFile << "  {\n";
+  strFile << "    if(strcmp(argv[arg], \"-b\") == 0)\n";
+  strFile << "      batch_size = atoi(argv[arg + 1]);\n";
+  strFile << "    else if(strcmp(argv[arg], \"-n\") == 0)\n";
+  strFile << "      num_slots = atoi(argv[arg + 1]);\n";
+  strFile << "    else if(strcmp(argv[arg], \"-p\") == 0)\n";
+  strFile << "      platform_idx = atoi(argv[arg + 1]);\n";
+  strFile << "    else if(strcmp(argv[arg], \"-d\") == 0)\n";
+  strFile << "      device_idx = atoi(argv[arg + 1]);\n";
+  strFile << "    else if(strcmp(argv[arg], \"-e\") == 0)\n";
+  strFile << "      exp_filename = argv[arg + 1];\n";
+  if (!isCompacted) {
+    strFile << "    else if(strcmp(argv[arg], \"-w\") == 0)\n";
+    strFile << "      results_filename = argv[arg + 1];\n";
+  }
+  strFile << "    else\n";
+  strFile << "      break;\n";
+  strFile << "  }\n";
+  strFile << "  if(arg >= argc || argv[arg][0] == '-' || batch_size <= 0 || "
+             "num_slots < 2 || num_slots > 3 || "
+          << (isCompacted ? "exp_filename == NULL"
+                          : "(exp_filename == NULL) == (results_filename == "
+                            "NULL)")
+          << ")\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Usage: %s "
+          << (isCompacted ? "-e <expected results>"
+                          : "-e <expected results> | -w <results>")
+          << " [-b batch size] [-n 2|3 buffers] [-p platform] [-d device] "
+             "<tests file> [<kernel file> ...]\\n\", argv[0]);\n";
+  strFile << "    return 1;\n";
+  strFile << "  }\n";
+  strFile << "  char *default_kernel = \"main.cl\";\n";
+  strFile << "  char **kernel_files = arg + 1 < argc ? argv + arg + 1 : "
+             "&default_kernel;\n";
+  strFile << "  int num_kernel_files = arg + 1 < argc ? argc - arg - 1 : 1;\n";
+  strFile << "\n";
+  strFile << "  " << reader << " reader;\n";
+  strFile << "  reader.file = fopen(argv[arg], \"rb\");\n";
+  strFile << "  if(reader.file == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open the tests file %s.\\n\", "
+             "argv[arg]);\n";
+  strFile << "    return 1;\n";
+  strFile << "  }\n";
+  strFile << "  reader.capacity = PARTECL_PARSE_CHUNK;\n";
+  strFile << "  reader.buffer = (char *)malloc(reader.capacity);\n";
+  strFile << "  if(reader.buffer == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Out of memory for the tests file %s.\\n\", "
+             "argv[arg]);\n";
+  strFile << "    fclose(reader.file);\n";
+  strFile << "    return 1;\n";
+  strFile << "  }\n";
+  strFile << "  reader.size = 0;\n";
+  strFile << "  reader.parsed = 0;\n";
+  strFile << "  reader.at_end = 0;\n";
+  strFile << "  reader.parser.tests_filename = argv[arg];\n";
+  strFile << "  reader.parser.line_number = 0;\n";
+  strFile << "\n";
+  strFile << "  /* the partecl_result of every test case, in the order of the "
+             "tests file */\n";
+  strFile << "  FILE *exp_file = NULL;\n";
+  strFile << "  if(exp_filename != NULL && (exp_file = fopen(exp_filename, "
+             "\"rb\")) == NULL)\n";
+  strFile << "  {\n";
+  strFile << "    fprintf(stderr, \"Could not open the expected results file "
+             "%s.\\n\", exp_filename);\n";
+  strFile << "    return 1;\n";
+  strFile << "  }\n";
+  if (!isCompacted) {
+    strFile << "  FILE *results_file = NULL;\n";
+    strFile << "  if(results_filename != NULL && (results_file = "
+               "fopen(results_filename, \"wb\")) == NULL)\n";
+    strFile << "  {\n";
+    strFile << "    fprintf(stderr, \"Could not create the results file "
+               "%s.\\n\", results_filename);\n";
+    strFile << "    return 1;\n";
+    strFile << "  }\n";
+  }
+  strFile << "\n";
+  strFile << "  cl_int err;\n";
+  strFile << "  cl_device_id device = partecl_get_device(platform_idx, "
+             "device_idx);\n";
+  strFile << "  cl_context context = clCreateContext(NULL, 1, &device, NULL, "
+             "NULL, &err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  strFile << "  cl_kernel kernel = partecl_build_kernel(context, device, "
+             "num_kernel_files, kernel_files, \"main_kernel\");\n";
+  if (!isCompacted) {
+    strFile << "  cl_kernel compare_kernel = NULL;\n";
+    strFile << "  if(exp_file != NULL)\n";
+    strFile << "  {\n";
+    strFile << "    /* " << filename_constants::COMPARE_GEN_FILENAME
+            << " is next to the kernel files */\n";
+    strFile << "    char compare_filename[4096] = \""
+            << filename_constants::COMPARE_GEN_FILENAME << "\";\n";
+    strFile << "    char *compare_file = compare_filename;\n";
+    strFile << "    const char *dir_end = strrchr(kernel_files[0], '/');\n";
+    strFile << "    if(dir_end != NULL)\n";
+    strFile << "      snprintf(compare_filename, sizeof(compare_filename), "
+               "\"%.*s/"
+            << filename_constants::COMPARE_GEN_FILENAME
+            << "\", (int)(dir_end - kernel_files[0]), kernel_files[0]);\n";
+    strFile << "    compare_kernel = partecl_build_kernel(context, device, 1, "
+               "&compare_file, \"compare_results_kernel\");\n";
+    strFile << "  }\n";
+  }
+  strFile << "\n";
+  strFile << "  /* in-order queues of their own, so that the uploads, the "
+             "kernels and the\n";
+  strFile << "   * downloads of different batches run at the same time */\n";
+  strFile << "  cl_command_queue upload = clCreateCommandQueue(context, "
+             "device, 0, &err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  strFile << "  cl_command_queue compute = clCreateCommandQueue(context, "
+             "device, 0, &err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  strFile << "  cl_command_queue download = clCreateCommandQueue(context, "
+             "device, 0, &err);\n";
+  strFile << "  PARTECL_CL_CHECK(err);\n";
+  if (!isCompacted) {
+    strFile << "  /* the results of the failures are read on a queue of their "
+               "own, so that\n";
+    strFile << "   * they do not wait for the downloads of the later batches "
+               "*/\n";
+    strFile << "  cl_command_queue read_back = clCreateCommandQueue(context, "
+               "device, 0, &err);\n";
+    strFile << "  PARTECL_CL_CHECK(err);\n";
+    strFile << "  cl_uint *zeros = (cl_uint "
+               "*)calloc(PARTECL_FAIL_BITMAP_WORDS(batch_size), "
+               "sizeof(cl_uint));\n";
+  }
+  strFile << "\n";
+  strFile << "  " << slot << " slots[3];\n";
+  strFile << "  for(int i = 0; i < num_slots; i++)\n";
+  strFile << "  {\n";
+  strFile << "    slots[i].inputs = (" << input << " *)malloc(batch_size * "
+             "sizeof(" << input << "));\n";
+  strFile << "    slots[i].results = (" << result << " *)malloc(batch_size * "
+             "sizeof(" << result << "));\n";
+  strFile << "    slots[i].exp_results = (" << result
+          << " *)malloc(batch_size * sizeof(" << result << "));\n";
+  strFile << "    slots[i].failures = (unsigned int *)malloc(batch_size * "
+             "sizeof(unsigned int));\n";
+  strFile << "    slots[i].inputs_buf = clCreateBuffer(context, "
+             "CL_MEM_READ_ONLY, batch_size * sizeof(" << input << "), NULL, "
+             "&err);\n";
+  strFile << "    PARTECL_CL_CHECK(err);\n";
+  strFile << "    slots[i].results_buf = clCreateBuffer(context, "
+          << (isCompacted ? "CL_MEM_WRITE_ONLY" : "CL_MEM_READ_WRITE")
+          << ", batch_size * sizeof(" << result << "), NULL, &err);\n";
+  strFile << "    PARTECL_CL_CHECK(err);\n";
+  strFile << "    slots[i].exp_results_buf = clCreateBuffer(context, "
+             "CL_MEM_READ_ONLY, batch_size * sizeof(" << result << "), NULL, "
+             "&err);\n";
+  strFile << "    PARTECL_CL_CHECK(err);\n";
+  strFile << "    slots[i].num_failures_buf = clCreateBuffer(context, "
+             "CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &err);\n";
+  strFile << "    PARTECL_CL_CHECK(err);\n";
+  if (!isCompacted) {
+    strFile << "    slots[i].fail_bits_buf = clCreateBuffer(context, "
+               "CL_MEM_READ_WRITE, PARTECL_FAIL_BITMAP_WORDS(batch_size) * "
+               "sizeof(cl_uint), NULL, &err);\n";
+    strFile << "    PARTECL_CL_CHECK(err);\n";
+    strFile << "    slots[i].failures_buf = clCreateBuffer(context, "
+               "CL_MEM_READ_WRITE, batch_size * sizeof(cl_uint), NULL, "
+               "&err);\n";
+    strFile << "    PARTECL_CL_CHECK(err);\n";
+  }
+  strFile << "    slots[i].num_test_cases = 0;\n";
+  strFile << "  }\n";
+  strFile << "\n";
+  strFile << "  /* batch n is parsed while the batches before it are on the "
+             "device; a slot\n";
+  strFile << "   * is used again only once its previous batch is compared */\n";
+  strFile << "  struct timespec start, end;\n";
+  strFile << "  clock_gettime(CLOCK_MONOTONIC, &start);\n";
+  strFile << "  long total = 0;\n";
+  strFile << "  long total_failures = 0;\n";
+  strFile << "  int num_batches = 0;\n";
+  strFile << "  int status = 0;\n";
+  strFile << "  for(int n = 0; ; n++)\n";
+  strFile << "  {\n";
+  strFile << "    " << slot << " *slot = &slots[n % num_slots];\n";
+  strFile << "    int num_test_cases = partecl_read_batch(&reader, "
+             "slot->inputs, batch_size);\n";
+  strFile << "    if(num_test_cases < 0)\n";
+  strFile << "    {\n";
+  strFile << "      status = 1;\n";
+  strFile << "      break;\n";
+  strFile << "    }\n";
+  strFile << "    if(num_test_cases == 0)\n";
+  strFile << "      break;\n";
+  strFile << "    if(" << (isCompacted ? "" : "exp_file != NULL && ")
+          << "fread(slot->exp_results, sizeof(" << result
+          << "), num_test_cases, exp_file) != (size_t)num_test_cases)\n";
+  strFile << "    {\n";
+  strFile << "      fprintf(stderr, \"The expected results file %s has fewer "
+             "test cases than the tests file.\\n\", exp_filename);\n";
+  strFile << "      status = 1;\n";
+  strFile << "      break;\n";
+  strFile << "    }\n";
+  strFile << "\n";
+  strFile << "    cl_event write_done;\n";
+  strFile << "    size_t global_size = num_test_cases;\n";
+  if (isCompacted) {
+    strFile << "    /* the upload queue is in order, so the count is zeroed "
+               "and the inputs are\n";
+    strFile << "     * written by the time the expected results are */\n";
+    strFile << "    PARTECL_CL_CHECK(partecl_reset_failures(upload, "
+               "slot->num_failures_buf, 0, NULL, NULL));\n";
+    strFile << "    PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->inputs_buf, CL_FALSE, 0, num_test_cases * sizeof("
+            << input << "), slot->inputs, 0, NULL, NULL));\n";
+    strFile << "    PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->exp_results_buf, CL_FALSE, 0, num_test_cases * sizeof("
+            << result << "), slot->exp_results, 0, NULL, &write_done));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 0, "
+               "sizeof(cl_mem), &slot->inputs_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 1, "
+               "sizeof(cl_mem), &slot->results_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 2, "
+               "sizeof(cl_mem), &slot->exp_results_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 3, "
+               "sizeof(cl_mem), &slot->num_failures_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 4, sizeof(int), "
+               "&num_test_cases));\n";
+    strFile << "    /* the failures are read back when the batch is finished "
+               "*/\n";
+    strFile << "    PARTECL_CL_CHECK(clEnqueueNDRangeKernel(compute, kernel, "
+               "1, NULL, &global_size, NULL, 1, &write_done, &slot->done));\n";
+    strFile << "    clFlush(upload);\n";
+    strFile << "    clFlush(compute);\n";
+    strFile << "    clReleaseEvent(write_done);\n";
+  } else {
+    strFile << "    cl_event kernel_done;\n";
+    strFile << "    PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->inputs_buf, CL_FALSE, 0, num_test_cases * sizeof("
+            << input << "), slot->inputs, 0, NULL, &write_done));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 0, "
+               "sizeof(cl_mem), &slot->inputs_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clSetKernelArg(kernel, 1, "
+               "sizeof(cl_mem), &slot->results_buf));\n";
+    strFile << "    PARTECL_CL_CHECK(clEnqueueNDRangeKernel(compute, kernel, "
+               "1, NULL, &global_size, NULL, 1, &write_done, "
+               "&kernel_done));\n";
+    strFile << "    if(exp_file != NULL)\n";
+    strFile << "    {\n";
+    strFile << "      /* the queues are in order, so the comparison runs "
+               "after the kernel, and\n";
+    strFile << "       * once the expected results are written the bitmap and "
+               "the count are\n";
+    strFile << "       * zeroed too */\n";
+    strFile << "      cl_event compare_ready;\n";
+    strFile << "      cl_event compare_done;\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->fail_bits_buf, CL_FALSE, 0, "
+               "PARTECL_FAIL_BITMAP_WORDS(num_test_cases) * sizeof(cl_uint), "
+               "zeros, 0, NULL, NULL));\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->num_failures_buf, CL_FALSE, 0, sizeof(cl_uint), zeros, "
+               "0, NULL, NULL));\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueWriteBuffer(upload, "
+               "slot->exp_results_buf, CL_FALSE, 0, num_test_cases * sizeof("
+            << result << "), slot->exp_results, 0, NULL, "
+               "&compare_ready));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 0, "
+               "sizeof(cl_mem), &slot->results_buf));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 1, "
+               "sizeof(cl_mem), &slot->exp_results_buf));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 2, "
+               "sizeof(cl_mem), &slot->fail_bits_buf));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 3, "
+               "sizeof(cl_mem), &slot->failures_buf));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 4, "
+               "sizeof(cl_mem), &slot->num_failures_buf));\n";
+    strFile << "      PARTECL_CL_CHECK(clSetKernelArg(compare_kernel, 5, "
+               "sizeof(int), &num_test_cases));\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueNDRangeKernel(compute, "
+               "compare_kernel, 1, NULL, &global_size, NULL, 1, "
+               "&compare_ready, &compare_done));\n";
+    strFile << "      /* the count is not known until the comparison is done, "
+               "so all of the\n";
+    strFile << "       * indices are read back; they are far smaller than the "
+               "results */\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueReadBuffer(download, "
+               "slot->num_failures_buf, CL_FALSE, 0, sizeof(cl_uint), "
+               "&slot->num_failures, 1, &compare_done, NULL));\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueReadBuffer(download, "
+               "slot->failures_buf, CL_FALSE, 0, num_test_cases * "
+               "sizeof(cl_uint), slot->failures, 0, NULL, &slot->done));\n";
+    strFile << "      clReleaseEvent(compare_ready);\n";
+    strFile << "      clReleaseEvent(compare_done);\n";
+    strFile << "    }\n";
+    strFile << "    else\n";
+    strFile << "      PARTECL_CL_CHECK(clEnqueueReadBuffer(download, "
+               "slot->results_buf, CL_FALSE, 0, num_test_cases * sizeof("
+            << result << "), slot->results, 1, &kernel_done, "
+               "&slot->done));\n";
+    strFile << "    clFlush(upload);\n";
+    strFile << "    clFlush(compute);\n";
+    strFile << "    clFlush(download);\n";
+    strFile << "    clReleaseEvent(write_done);\n";
+    strFile << "    clReleaseEvent(kernel_done);\n";
+  }
+  strFile << "    slot->num_test_cases = num_test_cases;\n";
+  strFile << "    total += num_test_cases;\n";
+  strFile << "    num_batches++;\n";
+  strFile << "\n";
+  strFile << "    int num_failures = partecl_finish_batch(&slots[(n + 1) % "
+             "num_slots], "
+          << (isCompacted ? "download" : "read_back") << resultsFile
+          << ");\n";
+  strFile << "    if(num_failures < 0)\n";
+  strFile << "    {\n";
+  strFile << "      status = 1;\n";
+  strFile << "      break;\n";
+  strFile << "    }\n";
+  strFile << "    total_failures += num_failures;\n";
+  strFile << "  }\n";
+  strFile << "  /* the batches still on the device, oldest first */\n";
+  strFile << "  for(int i = 1; i <= num_slots; i++)\n";
+  strFile << "  {\n";
+  strFile << "    int num_failures = partecl_finish_batch(&slots[(num_batches "
+             "+ i) % num_slots], "
+          << (isCompacted ? "download" : "read_back") << resultsFile
+          << ");\n";
+  strFile << "    if(num_failures < 0)\n";
+  strFile << "      status = 1;\n";
+  strFile << "    else\n";
+  strFile << "      total_failures += num_failures;\n";
+  strFile << "  }\n";
+  strFile << "  clock_gettime(CLOCK_MONOTONIC, &end);\n";
+  strFile << "  fprintf(stderr, \"Ran %ld test cases in %d batches in %.3f "
+             "s.\\n\", total, num_batches, (end.tv_sec - start.tv_sec) + "
+             "(end.tv_nsec - start.tv_nsec) / 1e9);\n";
+  strFile << "  if(exp_file != NULL)\n";
+  strFile << "    fprintf(stderr, \"%ld of them failed.\\n\", "
+             "total_failures);\n";
+  strFile << "  if(total_failures > 0)\n";
+  strFile << "    status = 1;\n";
+  strFile << "\n";
+  strFile << "  for(int i = 0; i < num_slots; i++)\n";
+  strFile << "  {\n";
+  strFile << "    clReleaseMemObject(slots[i].inputs_buf);\n";
+  strFile << "    clReleaseMemObject(slots[i].results_buf);\n";
+  strFile << "    clReleaseMemObject(slots[i].exp_results_buf);\n";
+  strFile << "    clReleaseMemObject(slots[i].num_failures_buf);\n";
+  if (!isCompacted) {
+    strFile << "    clReleaseMemObject(slots[i].fail_bits_buf);\n";
+    strFile << "    clReleaseMemObject(slots[i].failures_buf);\n";
+  }
+  strFile << "    free(slots[i].inputs);\n";
+  strFile << "    free(slots[i].results);\n";
+  strFile << "    free(slots[i].exp_results);\n";
+  strFile << "    free(slots[i].failures);\n";
+  strFile << "  }\n";
+  strFile << "  clReleaseCommandQueue(upload);\n";
+  strFile << "  clReleaseCommandQueue(compute);\n";
+  strFile << "  clReleaseCommandQueue(download);\n";
+  if (!isCompacted) {
+    strFile << "  clReleaseCommandQueue(read_back);\n";
+    strFile << "  free(zeros);\n";
+    strFile << "  if(compare_kernel != NULL)\n";
+    strFile << "    clReleaseKernel(compare_kernel);\n";
+  }
+  strFile << "  clReleaseKernel(kernel);\n";
+  strFile << "  clReleaseContext(context);\n";
+  strFile << "  fclose(reader.file);\n";
+  strFile << "  free(reader.buffer);\n";
+  strFile << "  if(exp_file != NULL)\n";
+  strFile << "    fclose(exp_file);\n";
+  if (!isCompacted) {
+    strFile << "  if(results_file != NULL && fclose(results_file) != 0)\n";
+    strFile << "  {\n";
+    strFile << "    fprintf(stderr, \"Could not write the results file "
+               "%s.\\n\", results_filename);\n";
+    strFile << "    status = 1;\n";
+    strFile << "  }\n";
+  }
+  strFile << "  return status;\n";
+  strFile << "}\n";
+}
+
+void generateHostDriver(const std::string &outputDirectory,
+                        const BufferOptions &options) {
+  std::stringstream strFile;
+  std::string driverFilename =
+      outputDirectory + "/" + filename_constants::HOST_GEN_FILENAME;
+
+  generateHostDriverHeader(strFile);
+  strFile << "\n";
+  generateHostDriverStructs(strFile, options.compactResults);
+  strFile << "\n";
+  generateReadBatch(strFile);
+  strFile << "\n";
+  generateBuildKernel(strFile);
+  strFile << "\n";
+  generateGetDevice(strFile);
+  strFile << "\n";
+  generateFinishBatch(strFile, options.compactResults);
+  strFile << "\n";
+  generateHostDriverMain(strFile, options.compactResults);
+
+  writeFileIfChanged(driverFilename, strFile.str());
+  addOutputFile(driverFilename, strFile.str().size());
+}
+
+/*
+ * Generate compare-gen.cl
+ */
+
+// An element of a result of the test case "idx", in the buffer of the
+// results or of the expected results
+std::string getResultElement(const std::string &buffer,
+                             const std::string &bufferPrefix,
+                             const struct Declaration &field,
+                             const std::string &el, bool isSoA) {
+  if (isSoA) {
+    std::string index = "idx";
+    if (isStoredAsArray(field))
+      index += " * " + getArraySize(field) + " + " + el;
+    return bufferPrefix + field.name + "[" + index + "]";
+  }
+
+  std::string element = buffer + "[idx]." + field.name;
+  if (isStoredAsArray(field))
+    element += "[" + el + "]";
+  return element;
+}
+
+// The kernel parameters of the result or the expected result buffers
+void generateResultParams(std::ostream &strFile, const std::string &name,
+                          const std::string &bufferPrefix,
+                          const std::list<struct Declaration> &fields,
+                          bool isSoA) {
+  if (!isSoA) {
+    strFile << "    __global const struct " << structs_constants::RESULT
+            << " *" << name << ",\n";
+    return;
+  }
+
+  for (auto &field : fields)
+    strFile << "    __global const " << getFieldType(field) << " *"
+            << bufferPrefix << field.name << ",\n";
+}
+
+void generateCompareKernel(
+    const std::string &outputDirectory,
+    const std::list<struct ResultDeclaration> &resultDecls,
+    const BufferOptions &options) {
+  messages() << "Generating comparison kernel... ";
+
+  bool isSoA = options.resultLayout == BufferLayout::structOfArrays;
+  auto resultFields = getStoredResultFields(resultDecls, options);
+  std::stringstream strFile;
+  std::string compareFilename =
+      outputDirectory + "/" + filename_constants::COMPARE_GEN_FILENAME;
+
+  strFile << "#include \"" << filename_constants::STRUCTS_FILENAME << "\"\n\n";
+  strFile << "#ifndef PARTECL_TOLERANCE\n";
+  strFile << "#define PARTECL_TOLERANCE 0\n";
+  strFile << "#endif\n\n";
+
+  // the bitmap and the failure count start zeroed; the failures are rare, so
+  // only they use atomics
+  strFile << "__kernel void compare_results_kernel(\n";
+  generateResultParams(strFile, "results",
+                       structs_constants::RESULT_BUFFER_PREFIX, resultFields,
+                       isSoA);
+  generateResultParams(strFile, "exp_results",
+                       structs_constants::EXPECTED_BUFFER_PREFIX, resultFields,
+                       isSoA);
+  strFile << "    __global uint *partecl_fail_bits, "
+             "__global uint *partecl_failures,\n";
+  strFile << "    __global uint *partecl_num_failures, int num_test_cases)\n";
+  strFile << "{\n";
+  strFile << "  int idx = get_global_id(0);\n";
+  strFile << "  if(idx >= num_test_cases)\n";
+  strFile << "    return;\n\n";
+  for (auto &resultDecl : resultDecls) {
+    if (resultDecl.declaration.isPointer &&
+        !isStoredAsArray(resultDecl.declaration))
+      messages() << "\nThe result '" << resultDecl.declaration.name
+                 << "' is a pointer, and is not compared on the device.\n";
+  }
+
+  strFile << "  int passed = 1;\n";
+  auto result = [isSoA](const struct Declaration &field,
+                        const std::string &el) {
+    return getResultElement("results", structs_constants::RESULT_BUFFER_PREFIX,
+                            field, el, isSoA);
+  };
+  auto expected = [isSoA](const struct Declaration &field,
+                          const std::string &el) {
+    return getResultElement("exp_results",
+                            structs_constants::EXPECTED_BUFFER_PREFIX, field,
+                            el, isSoA);
+  };
+  strFile << getResultChecks(resultDecls, result, expected, "passed");
+  strFile << "\n";
+  strFile << "  if(!passed)\n";
+  strFile << "  {\n";
+  strFile << "    atomic_or(&partecl_fail_bits[idx / 32], 1u << (idx % 32));\n";
+  strFile << "    partecl_failures[atomic_inc(partecl_num_failures)] = idx;\n";
+  strFile << "  }\n";
+  strFile << "}\n";
 
-  strFile.close();
+  writeFileIfChanged(compareFilename, strFile.str());
+  addOutputFile(compareFilename, strFile.str().size());
 
-  llvm::outs() << "DONE!\n";
+  messages() << "DONE!\n";
 }
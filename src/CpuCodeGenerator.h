@@ -23,9 +23,18 @@
 void generateStructs(const std::string &, const std::list<struct Declaration> &,
                      const std::list<struct Declaration> &,
                      const std::list<struct ResultDeclaration> &,
-                     const std::list<std::string> &);
+                     const std::list<std::string> &, const BufferOptions &);
 
 void generateCpuGen(const std::string &, const std::list<struct Declaration> &,
                     const std::list<struct ResultDeclaration> &,
-                    const std::list<struct Declaration> &);
+                    const std::list<struct Declaration> &,
+                    const BufferOptions &, const HostCodeOptions &);
+
+void generateCompileTestsTool(const std::string &);
+
+void generateHostDriver(const std::string &, const BufferOptions &);
+
+void generateCompareKernel(const std::string &,
+                           const std::list<struct ResultDeclaration> &,
+                           const BufferOptions &);
 #endif
@@ -14,91 +14,157 @@
  * limitations under the License.
  */
 
+#include "CodeGenContext.h"
 #include "Constants.h"
+#include "KernelGenerator.h"
+#include "PrecompiledHeader.h"
+#include "Timing.h"
 #include "Utils.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ParentMap.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/ASTMatchers/ASTMatchers.h"
+#include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Frontend/FrontendActions.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/PreprocessingRecord.h"
 #include "clang/Rewrite/Core/Rewriter.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/Refactoring.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ThreadPool.h"
 #include <algorithm>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <streambuf>
 #include <string>
-
-#define INPUT_1 1
-#define RESULT_1 2
+#include <thread>
+#include <unordered_set>
 
 using namespace clang;
 using namespace clang::tooling;
 using namespace clang::ast_matchers;
 
-LangOptions langOpts;
-PrintingPolicy printingPolicy(langOpts);
-
-// Global scope members
-bool isMainFile = false;
-std::string testClOutputDirectory;
-std::map<int, std::string> argvIdxToInput;
-std::map<const Expr *, bool> argvIdxToIsReplaced;
-std::map<const SourceLocation, bool> locationToPointerDereferenced;
-std::list<struct Declaration> inputs;
-std::map<std::string, bool> inputsToIsAddedDeclaration;
-std::list<struct Declaration> stdinInputs;
-std::list<struct ResultDeclaration> results;
-
-// a list of all the global vars
-std::list<const VarDecl *> globalVars;
-
-// a map of all global vars used in a function declaration (they need to be
-// added to the parameter list) //both original uses and added as parameters to
-// function calls
-std::map<const FunctionDecl *, std::vector<const ValueDecl *>> funcToGlobalVars;
-std::vector<const FunctionDecl *> functionsWhichUseTestInputs;
-std::vector<const FunctionDecl *> functionsWhichUseTestResults;
-std::vector<const FunctionDecl *> functionsWhichUseStdin;
-
-// a map of function calls to their caller
-std::map<const CallExpr *, const FunctionDecl *> funcCallToCallerDecl;
-
-// a map of function declarations to all their callers
-std::map<const FunctionDecl *, std::list<const FunctionDecl *>>
-    funcDeclToCallerDecls;
-
-// a map which contains all parameters that were added to a function
-// declaration, together with commas in front of them
-std::map<const FunctionDecl *, std::list<std::string>> funcToAddedParameters;
-
-// a map which contains all arguments that were added to a function call,
-// together with commas in front of them
-std::map<const CallExpr *, std::list<std::string>> funcCallToAddedArgs;
-
-// a list of include files to add
-std::list<std::string> includesToAdd;
+const LangOptions langOpts;
+const PrintingPolicy printingPolicy(langOpts);
+
+// Facts about a function, collected in the single traversal of the AST;
+// the rewrite phases read these instead of matching the AST again
+struct FunctionFacts {
+  // calls made from within the function, in traversal order
+  std::vector<const CallExpr *> callSites;
+  // calls to a function whose value is tested by a result
+  std::vector<const CallExpr *> testedValueCalls;
+};
+
+// A reference to a file scope variable from within a function; whether it is
+// a global var of the program is only known after all facts are merged
+struct GlobalVarUse {
+  const DeclRefExpr *expr;
+  std::string function;
+};
+
+// A read from stdin; the stdin input it reads is assigned after the reads in
+// all translation units are known, so that they are assigned in order
+struct StdinUse {
+  const CallExpr *call;
+  const DeclRefExpr *stdinArg; // null for scanf
+  const FunctionDecl *caller;
+  std::string inputName; // empty if there are not enough stdin inputs
+};
+
+// A rewriter which counts the rewrites made with it, for the statistics
+class CountingRewriter : public Rewriter {
+public:
+  unsigned rewrites = 0;
+
+  bool InsertText(SourceLocation loc, StringRef str, bool insertAfter = true,
+                  bool indentNewLines = false) {
+    return count(Rewriter::InsertText(loc, str, insertAfter, indentNewLines));
+  }
+
+  bool InsertTextAfter(SourceLocation loc, StringRef str) {
+    return count(Rewriter::InsertTextAfter(loc, str));
+  }
+
+  bool InsertTextBefore(SourceLocation loc, StringRef str) {
+    return count(Rewriter::InsertTextBefore(loc, str));
+  }
+
+  bool ReplaceText(SourceLocation start, unsigned origLength,
+                   StringRef newStr) {
+    return count(Rewriter::ReplaceText(start, origLength, newStr));
+  }
+
+private:
+  // the rewriter returns true if it could not make the rewrite
+  bool count(bool failed) {
+    if (!failed)
+      rewrites++;
+    return failed;
+  }
+};
+
+// The state of the code generation for a single translation unit
+struct TranslationUnitState {
+  TranslationUnitState(CodeGenContext &context, const std::string &filename)
+      : context(context), filename(filename) {}
+
+  CodeGenContext &context;
+  std::string filename;
+  std::unique_ptr<ASTUnit> ast;
+  std::time_t parseTime = 0; // when the source was last modified before parsing
+  CountingRewriter rewriter;
+  bool isMainFile = false;
+  std::string outputFilename; // empty until the kernel is written
+
+  // facts found in this translation unit, merged into context.programFacts
+  ProgramFacts facts;
+
+  // facts which only make sense for this translation unit
+  std::map<const FunctionDecl *, FunctionFacts> functionFacts;
+  // all function declarations, in traversal order
+  std::vector<const FunctionDecl *> functionDecls;
+  std::vector<const VarDecl *> globalVarDecls;
+  std::vector<GlobalVarUse> globalVarUses;
+  std::vector<StdinUse> stdinUses;
+
+  std::map<const Expr *, bool> argvIdxToIsReplaced;
+  std::map<const SourceLocation, bool> locationToPointerDereferenced;
+  std::map<std::string, bool> inputsToIsAddedDeclaration;
+
+  // a map which contains all parameters that were added to a function
+  // declaration, together with commas in front of them
+  std::map<const FunctionDecl *, std::list<std::string>> funcToAddedParameters;
+
+  // a map which contains all arguments that were added to a function call,
+  // together with commas in front of them
+  std::map<const CallExpr *, std::list<std::string>> funcCallToAddedArgs;
+};
 
 void replaceSourceRange(const SourceRange range, llvm::StringRef newRangeSource,
-                        Rewriter *rewriter) {
+                        CountingRewriter *rewriter) {
   int rangeSize = rewriter->getRangeSize(range);
   SourceLocation locStart = range.getBegin();
   rewriter->ReplaceText(locStart, rangeSize, newRangeSource);
 }
 
 void replaceParam(const ParmVarDecl *paramDecl, llvm::StringRef newParamSource,
-                  Rewriter *rewriter) {
+                  CountingRewriter *rewriter) {
   SourceRange range = paramDecl->getSourceRange();
   replaceSourceRange(range, newParamSource, rewriter);
 }
 
-void addNewParam(const FunctionDecl *funcDecl, llvm::StringRef newParamSource,
-                 Rewriter *rewriter) {
+void addNewParam(TranslationUnitState &tu, const FunctionDecl *funcDecl,
+                 llvm::StringRef newParamSource) {
   // get the location and determine if we need to add a comma before the new
   // param
   // 1. after parameters we have already added (add comma)
@@ -121,8 +187,8 @@ void addNewParam(const FunctionDecl *funcDecl, llvm::StringRef newParamSource,
   loc = funcDecl->getBody()->getLocStart().getLocWithOffset(-2);
 
   // check if we have already added parameters to the function
-  auto addedParamsTuple = funcToAddedParameters.find(funcDecl);
-  if (addedParamsTuple != funcToAddedParameters.end() &&
+  auto addedParamsTuple = tu.funcToAddedParameters.find(funcDecl);
+  if (addedParamsTuple != tu.funcToAddedParameters.end() &&
       addedParamsTuple->second.size() > 0)
     addComma = true;
 
@@ -133,14 +199,14 @@ void addNewParam(const FunctionDecl *funcDecl, llvm::StringRef newParamSource,
 
   paramSource.append(newParamSource);
 
-  rewriter->InsertTextAfter(loc, paramSource);
+  tu.rewriter.InsertTextAfter(loc, paramSource);
 
   // add the new parameter to the list of added parameters
-  funcToAddedParameters[funcDecl].push_back(paramSource);
+  tu.funcToAddedParameters[funcDecl].push_back(paramSource);
 }
 
 void replaceArgument(const CallExpr *call, const DeclRefExpr *oldArgument,
-                     llvm::StringRef newArgument, Rewriter *rewriter) {
+                     llvm::StringRef newArgument, CountingRewriter *rewriter) {
   // need to do a special thing, as stdin does not return a proper location
   // assuming that stdin is the last argument in the function's list
   auto argName = oldArgument->getDecl()->getNameAsString();
@@ -157,8 +223,8 @@ void replaceArgument(const CallExpr *call, const DeclRefExpr *oldArgument,
   rewriter->ReplaceText(locBegin, rangeSize, newArgument);
 }
 
-void addNewArgument(const CallExpr *call, llvm::StringRef newArgument,
-                    Rewriter *rewriter) {
+void addNewArgument(TranslationUnitState &tu, const CallExpr *call,
+                    llvm::StringRef newArgument) {
   // get the location and determine if we need to add a comma before the new Arg
   // 1. after parameters we have already added (add comma)
   // 2. at the end of existing parameters list (add comma)
@@ -173,8 +239,8 @@ void addNewArgument(const CallExpr *call, llvm::StringRef newArgument,
   loc = call->getLocEnd();
 
   // check if we have already added parameters to the function
-  auto addedArgsTuple = funcCallToAddedArgs.find(call);
-  if (addedArgsTuple != funcCallToAddedArgs.end() &&
+  auto addedArgsTuple = tu.funcCallToAddedArgs.find(call);
+  if (addedArgsTuple != tu.funcCallToAddedArgs.end() &&
       addedArgsTuple->second.size() > 0)
     addComma = true;
 
@@ -186,24 +252,25 @@ void addNewArgument(const CallExpr *call, llvm::StringRef newArgument,
   argSource.append(newArgument);
 
   // insert the new parameter
-  rewriter->InsertTextAfter(loc, argSource);
+  tu.rewriter.InsertTextAfter(loc, argSource);
 
   // add the new argument to the list of added arguments
-  funcCallToAddedArgs[call].push_back(argSource);
+  tu.funcCallToAddedArgs[call].push_back(argSource);
 }
 
-void commentOut(SourceRange range, Rewriter *rewriter) {
+void commentOut(SourceRange range, CountingRewriter *rewriter) {
   rewriter->InsertText(range.getBegin(), "/*");
   rewriter->InsertText(range.getEnd().getLocWithOffset(2), "*/");
 }
 
-void commentOut(SourceLocation start, SourceLocation end, Rewriter *rewriter) {
+void commentOut(SourceLocation start, SourceLocation end,
+                CountingRewriter *rewriter) {
   rewriter->InsertText(start, "/*");
   rewriter->InsertText(end.getLocWithOffset(2), "*/");
 }
 
 void insertOnNewLineAfter(SourceRange range, std::string textToInsert,
-                          Rewriter *rewriter) {
+                          CountingRewriter *rewriter) {
   auto location = range.getEnd();
   while (rewriter->getSourceMgr().getCharacterData(location)[0] != '\n') {
     location = location.getLocWithOffset(1);
@@ -212,7 +279,7 @@ void insertOnNewLineAfter(SourceRange range, std::string textToInsert,
   rewriter->InsertText(location, textToInsert, true, true);
 }
 
-void commentOutLine(SourceRange range, Rewriter *rewriter) {
+void commentOutLine(SourceRange range, CountingRewriter *rewriter) {
   auto beginLoc = range.getBegin();
   while (rewriter->getSourceMgr().getCharacterData(beginLoc)[0] != '\n') {
     beginLoc = beginLoc.getLocWithOffset(-1);
@@ -228,39 +295,129 @@ void commentOutLine(SourceRange range, Rewriter *rewriter) {
   commentOut(beginLoc, endLoc, rewriter);
 }
 
-void commentOutToEndOfLine(SourceRange range, Rewriter &rewriter) {
+void commentOutToEndOfLine(SourceRange range, CountingRewriter &rewriter) {
   auto beginLoc = range.getBegin();
   rewriter.InsertText(beginLoc, "//");
 }
 
-bool isGlobalVar(const DeclRefExpr *expr) {
-  for (auto &globalVar : globalVars) {
-    if (expr->getDecl() == globalVar)
+const struct GlobalVarFacts *findGlobalVar(const ProgramFacts &facts,
+                                           const std::string &name) {
+  auto globalVarIndex = facts.globalVarIndices.find(name);
+  if (globalVarIndex == facts.globalVarIndices.end())
+    return nullptr;
+
+  return &facts.globalVars[globalVarIndex->second];
+}
+
+bool isGlobalVar(const ProgramFacts &facts, const std::string &name) {
+  return findGlobalVar(facts, name) != nullptr;
+}
+
+// a global var which is never written to; it stays at program scope in
+// constant memory, instead of being copied into every work-item and passed
+// to the functions which use it
+bool isConstantGlobalVar(const ProgramFacts &facts, const std::string &name) {
+  auto globalVar = findGlobalVar(facts, name);
+  return globalVar && globalVar->canBeConstant &&
+         facts.writtenGlobalVars.count(name) == 0;
+}
+
+// add a global var, unless there is already one with the same name
+void addGlobalVar(ProgramFacts &facts, const struct GlobalVarFacts &globalVar) {
+  if (isGlobalVar(facts, globalVar.name))
+    return;
+
+  facts.globalVarIndices[globalVar.name] = facts.globalVars.size();
+  facts.globalVars.push_back(globalVar);
+}
+
+// remember where a function or a global var is defined, to check that no two
+// files define the same name where one of them is static
+void addDefinedSymbol(ProgramFacts &facts, const NamedDecl *decl,
+                      const SourceManager &sourceMgr, bool isInternal) {
+  auto loc = sourceMgr.getExpansionLoc(decl->getLocation());
+  if (sourceMgr.isInSystemHeader(loc))
+    return;
+
+  struct SymbolDefinition definition;
+  definition.file = sourceMgr.getFilename(loc).str();
+  definition.isInternal = isInternal;
+  facts.definedSymbols.insert(
+      std::make_pair(decl->getNameAsString(), definition));
+}
+
+bool isTestInput(const CodeGenContext &context, const std::string &varName,
+                 struct Declaration &inputRef) {
+  for (auto &input : context.inputs) {
+    if (varName == input.name) {
+      inputRef = input;
       return true;
+    }
   }
 
   return false;
 }
 
-bool isTestInput(const VarDecl *var, struct Declaration &inputRef) {
-  for (auto &input : inputs) {
-    if (var->getNameAsString() == input.name) {
-      inputRef = input;
+// whether the kernel reads the inputs in place in the buffer, through a
+// __global const pointer
+bool readsInputsInPlace(const CodeGenContext &context) {
+  auto &buffers = context.buffers;
+  return buffers.globalInputs &&
+         buffers.inputLayout == BufferLayout::arrayOfStructs &&
+         !hasInputView(context.inputs, buffers.packedInputs);
+}
+
+// inputs which the program writes to, so that they are copied into private
+// memory ("input_rw") when the inputs are read in place: the stdin inputs,
+// which the stdio functions take as private pointers, and the array inputs
+// which are written to
+bool isWrittenInput(const CodeGenContext &context, const std::string &name) {
+  for (auto &stdinInput : context.stdinInputs) {
+    if (stdinInput.name == name)
+      return true;
+  }
+
+  return context.programFacts.writtenInputs.count(name) != 0;
+}
+
+bool hasWrittenInputs(const CodeGenContext &context) {
+  for (auto &field : getInputFields(context.inputs, context.stdinInputs)) {
+    if (isWrittenInput(context, field.name))
       return true;
-    }
   }
 
   return false;
 }
 
-void addAssignmentForArrayTestInputs(const struct Declaration &input,
+// a reference to a field of the input of the test case, from main or from
+// another function
+std::string getInputRef(const CodeGenContext &context, const std::string &name,
+                        bool inMain) {
+  if (!readsInputsInPlace(context))
+    return (inMain ? "input_gen." : "input_gen->") + name;
+
+  if (isWrittenInput(context, name))
+    return (inMain ? "input_rw." : "input_rw->") + name;
+
+  return "input_gen->" + name;
+}
+
+void addAssignmentForArrayTestInputs(TranslationUnitState &tu,
+                                     const struct Declaration &input,
                                      std::stringstream &bbInsertion) {
   if (input.isArray) {
     bbInsertion << "  ";
-    if (input.isConst)
+    // packed, it points into the arena, and read in place, into the inputs
+    bool isPacked = tu.context.buffers.packedInputs && isVariableLength(input);
+    bool isInPlace = readsInputsInPlace(tu.context) &&
+                     !isWrittenInput(tu.context, input.name);
+    if (isPacked || isInPlace)
+      bbInsertion << "__global ";
+    if (input.isConst || isInPlace)
       bbInsertion << "const ";
     bbInsertion << input.type << " *" << input.name << ";\n";
-    bbInsertion << "  " << input.name << " = input_gen." << input.name << ";\n";
+    bbInsertion << "  " << input.name << " = "
+                << getInputRef(tu.context, input.name, true) << ";\n";
     /*
     bbInsertion << input.type << " " << input.name << "[" << input.size <<
     "];\n"; bbInsertion << "  for(int i = 0; i < " << input.size << "; i++)\n";
@@ -269,151 +426,170 @@ void addAssignmentForArrayTestInputs(const struct Declaration &input,
     "[i];\n"; bbInsertion << "  }\n";
     */
 
-    inputsToIsAddedDeclaration[input.name] = true;
+    tu.inputsToIsAddedDeclaration[input.name] = true;
   }
 }
 
-bool containsRefToGlobalVar(const FunctionDecl *decl) {
-  return funcToGlobalVars.find(decl) != funcToGlobalVars.end();
+bool containsRefToGlobalVar(const ProgramFacts &facts,
+                            const std::string &funcName) {
+  return facts.funcToGlobalVars.find(funcName) != facts.funcToGlobalVars.end();
 }
 
-bool containsRefToInput(const FunctionDecl *decl) {
-  return find(functionsWhichUseTestInputs.begin(),
-              functionsWhichUseTestInputs.end(),
-              decl) != functionsWhichUseTestInputs.end();
+bool containsRefToInput(const ProgramFacts &facts,
+                        const std::string &funcName) {
+  return facts.functionsWhichUseTestInputs.count(funcName) != 0;
 }
 
-bool containsRefToResult(const FunctionDecl *decl) {
-  return find(functionsWhichUseTestResults.begin(),
-              functionsWhichUseTestResults.end(),
-              decl) != functionsWhichUseTestResults.end();
+bool containsRefToResult(const ProgramFacts &facts,
+                         const std::string &funcName) {
+  return facts.functionsWhichUseTestResults.count(funcName) != 0;
 }
 
-bool containsRefToStdin(const FunctionDecl *decl) {
-  return find(functionsWhichUseStdin.begin(), functionsWhichUseStdin.end(),
-              decl) != functionsWhichUseStdin.end();
+bool containsRefToStdin(const ProgramFacts &facts,
+                        const std::string &funcName) {
+  return facts.functionsWhichUseStdin.count(funcName) != 0;
 }
 
 bool isResultPrintedChatByChar(const struct ResultDeclaration &result) {
   return result.testedValue.name == "fputc";
 }
 
+bool isMain(const std::string &funcName) { return funcName == "main"; }
+
 bool isMain(const FunctionDecl *decl) {
-  return decl->getNameAsString() == "main";
+  return isMain(decl->getNameAsString());
 }
 
-// recursively add global variables to the function and all functions which call
-// it
-void addGlobalVarsToFunctionDecl(const FunctionDecl *funcDecl,
-                                 std::vector<const ValueDecl *> globalVars) {
-  auto callerDeclsTuple = funcDeclToCallerDecls.find(funcDecl);
-  if (callerDeclsTuple == funcDeclToCallerDecls.end())
-    return;
+// add a global variable to the function, unless it already has it
+void addGlobalVarToFunction(ProgramFacts &facts, const std::string &funcName,
+                            const std::string &globalVar) {
+  facts.funcToGlobalVars[funcName].insert(globalVar);
+}
 
-  auto callerDecls = callerDeclsTuple->second;
+// add the global vars, inputs, results and stdin used by the callee to the
+// caller; returns true if the caller did not use all of them already
+bool addCalleeFactsToCaller(ProgramFacts &facts, const std::string &callee,
+                            const std::string &caller) {
+  bool changed = false;
+
+  auto calleeGlobalVars = facts.funcToGlobalVars.find(callee);
+  if (calleeGlobalVars != facts.funcToGlobalVars.end() &&
+      !calleeGlobalVars->second.empty()) {
+    auto &callerGlobalVars = facts.funcToGlobalVars[caller];
+    for (auto &globalVar : calleeGlobalVars->second)
+      changed |= callerGlobalVars.insert(globalVar);
+  }
 
-  for (auto &callerDecl : callerDecls) {
-    if (isMain(callerDecl))
-      continue;
+  if (containsRefToInput(facts, callee))
+    changed |= facts.functionsWhichUseTestInputs.insert(caller).second;
 
-    for (auto &globalVar : globalVars) {
-      // do not add a global var more than once to the same funciton
-      auto addedVarsTuple = funcToGlobalVars.find(callerDecl);
-      if (addedVarsTuple != funcToGlobalVars.end()) {
-        auto addedVars = addedVarsTuple->second;
-        if (find(addedVars.begin(), addedVars.end(), globalVar) !=
-            addedVars.end())
-          continue;
-      }
+  if (containsRefToResult(facts, callee))
+    changed |= facts.functionsWhichUseTestResults.insert(caller).second;
 
-      funcToGlobalVars[callerDecl].push_back(globalVar);
-    }
+  if (containsRefToStdin(facts, callee))
+    changed |= facts.functionsWhichUseStdin.insert(caller).second;
 
-    addGlobalVarsToFunctionDecl(callerDecl, globalVars);
-  }
+  return changed;
 }
 
-// recursively add inputs and results to the function and all functions which
-// call it
-void addInputAndResultsToFunctionDecl(const FunctionDecl *funcDecl,
-                                      int inputOrResult) {
-  auto callerDeclsTuple = funcDeclToCallerDecls.find(funcDecl);
-  if (callerDeclsTuple == funcDeclToCallerDecls.end())
-    return;
+// finds functions which call other functions that:
+// 1. call global variables directly
+// 2. use inputs and results
+// 3. use stdin
+// Whenever the facts of a function change, they are added to all its callers,
+// until nothing changes any more. This reaches callers at any depth, and a
+// function is only on the worklist once at a time, so recursion (direct or
+// through other functions) is handled too.
+void findAllFunctionsWhichUseSpecialVars(ProgramFacts &facts) {
+  std::deque<std::string> worklist;
+  std::unordered_set<std::string> inWorklist;
+  for (auto &funcDeclTuple : facts.funcDeclToCallerDecls) {
+    worklist.push_back(funcDeclTuple.first);
+    inWorklist.insert(funcDeclTuple.first);
+  }
+
+  while (!worklist.empty()) {
+    auto funcDecl = worklist.front();
+    worklist.pop_front();
+    inWorklist.erase(funcDecl);
 
-  auto callerDecls = callerDeclsTuple->second;
-  for (auto &callerDecl : callerDecls) {
-    if (isMain(callerDecl))
+    auto callerDeclsTuple = facts.funcDeclToCallerDecls.find(funcDecl);
+    if (callerDeclsTuple == facts.funcDeclToCallerDecls.end())
       continue;
 
-    switch (inputOrResult) {
-    case INPUT_1:
-      if (!containsRefToInput(callerDecl))
-        functionsWhichUseTestInputs.push_back(callerDecl);
-      break;
+    for (auto &callerDecl : callerDeclsTuple->second) {
+      // a recursive function already has its own facts
+      if (isMain(callerDecl) || callerDecl == funcDecl)
+        continue;
 
-    case RESULT_1:
-      if (!containsRefToResult(callerDecl))
-        functionsWhichUseTestResults.push_back(callerDecl);
-      break;
+      if (addCalleeFactsToCaller(facts, funcDecl, callerDecl) &&
+          inWorklist.insert(callerDecl).second)
+        worklist.push_back(callerDecl);
     }
-
-    addInputAndResultsToFunctionDecl(callerDecl, inputOrResult);
   }
 }
 
-void addStdinToFunctionDecl(const FunctionDecl *funcDecl) {
-  auto callerDeclsTuple = funcDeclToCallerDecls.find(funcDecl);
-  if (callerDeclsTuple == funcDeclToCallerDecls.end())
+void addInclude(ProgramFacts &facts, std::string includeToAdd) {
+  if (find(facts.includesToAdd.begin(), facts.includesToAdd.end(),
+           includeToAdd) != facts.includesToAdd.end())
     return;
 
-  auto callerDecls = callerDeclsTuple->second;
-  for (auto &callerDecl : callerDecls) {
-    if (isMain(callerDecl))
-      continue;
-
-    if (!containsRefToStdin(callerDecl))
-      functionsWhichUseStdin.push_back(callerDecl);
-
-    addStdinToFunctionDecl(callerDecl);
-  }
+  facts.includesToAdd.push_back(includeToAdd);
 }
 
-// finds functions which call other functions that:
-// 1. call global variables directly
-// 2. use inputs and results
-// 3. use stdin
-void findAllFunctionsWhichUseSpecialVars() {
-  for (auto &funcDeclTuple : funcDeclToCallerDecls) {
-    auto funcDecl = funcDeclTuple.first;
-
-    // TODO: remove doing the search in funcToGlobalVars twice
-    if (containsRefToGlobalVar(funcDecl)) {
-      auto globalVars = funcToGlobalVars.find(funcDecl)->second;
-      addGlobalVarsToFunctionDecl(funcDecl, globalVars);
-    }
+// merges the facts of a translation unit into the facts of the program; fails
+// if the translation unit defines a static function or global var whose name
+// is already defined in another file, as they are referred to by name
+int mergeFacts(ProgramFacts &facts, const ProgramFacts &tuFacts) {
+  int status = status_constants::SUCCESS;
+  for (auto &symbol : tuFacts.definedSymbols) {
+    auto defined = facts.definedSymbols.insert(symbol);
+    auto &other = defined.first->second;
+    if (defined.second || other.file == symbol.second.file ||
+        (!other.isInternal && !symbol.second.isInternal))
+      continue;
 
-    if (containsRefToInput(funcDecl))
-      addInputAndResultsToFunctionDecl(funcDecl, INPUT_1);
+    llvm::errs() << symbol.first << " is defined in both " << other.file
+                 << " and " << symbol.second.file
+                 << ", and is static in at least one of them; rename one of "
+                    "them, as they would be merged in the kernel.\n";
+    status = status_constants::FAIL;
+  }
 
-    if (containsRefToResult(funcDecl))
-      addInputAndResultsToFunctionDecl(funcDecl, RESULT_1);
+  for (auto &globalVar : tuFacts.globalVars)
+    addGlobalVar(facts, globalVar);
 
-    if (containsRefToStdin(funcDecl))
-      addStdinToFunctionDecl(funcDecl);
+  for (auto &funcTuple : tuFacts.funcToGlobalVars) {
+    for (auto &globalVar : funcTuple.second)
+      addGlobalVarToFunction(facts, funcTuple.first, globalVar);
+  }
+  facts.writtenGlobalVars.insert(tuFacts.writtenGlobalVars.begin(),
+                                 tuFacts.writtenGlobalVars.end());
+  facts.writtenInputs.insert(tuFacts.writtenInputs.begin(),
+                             tuFacts.writtenInputs.end());
+
+  facts.functionsWhichUseTestInputs.insert(
+      tuFacts.functionsWhichUseTestInputs.begin(),
+      tuFacts.functionsWhichUseTestInputs.end());
+  facts.functionsWhichUseTestResults.insert(
+      tuFacts.functionsWhichUseTestResults.begin(),
+      tuFacts.functionsWhichUseTestResults.end());
+  facts.functionsWhichUseStdin.insert(tuFacts.functionsWhichUseStdin.begin(),
+                                      tuFacts.functionsWhichUseStdin.end());
+
+  for (auto &funcTuple : tuFacts.funcDeclToCallerDecls) {
+    facts.funcDeclToCallerDecls[funcTuple.first].insert(
+        funcTuple.second.begin(), funcTuple.second.end());
   }
-}
-
-void addInclude(std::string includeToAdd) {
-  if (find(includesToAdd.begin(), includesToAdd.end(), includeToAdd) !=
-      includesToAdd.end())
-    return;
 
-  includesToAdd.push_back(includeToAdd);
+  for (auto &include : tuFacts.includesToAdd)
+    addInclude(facts, include);
+  return status;
 }
 
 // Returns false if it cannot find the InputParam in the map
-bool getInputParamFromArgvIndex(const ArraySubscriptExpr *argvExpr,
+bool getInputParamFromArgvIndex(const CodeGenContext &context,
+                                const ArraySubscriptExpr *argvExpr,
                                 std::string *newText) {
   // Get the index expression
   const Expr *arrayIndex = argvExpr->getRHS();
@@ -426,25 +602,27 @@ bool getInputParamFromArgvIndex(const ArraySubscriptExpr *argvExpr,
   std::stringstream indexss(s.str());
   if (!(indexss >> index)) {
     // TODO: Better error message
-    llvm::outs() << "The below argv index is not a valid StringLiteral - we "
-                    "cannot convert it to OpenCL.\n";
+    messages() << "The below argv index is not a valid StringLiteral - we "
+                  "cannot convert it to OpenCL.\n";
     arrayIndex->dump();
-    llvm::outs() << "\n";
+    messages() << "\n";
     return false;
   }
 
-  if (argvIdxToInput[index] == "") {
-    llvm::outs() << "there is no input param for argv index " << index
-                 << " - cannot convert it to OpenCL.\n";
+  // the context is shared between translation units, so do not insert into it
+  auto input = context.argvIdxToInput.find(index);
+  if (input == context.argvIdxToInput.end() || input->second == "") {
+    messages() << "there is no input param for argv index " << index
+               << " - cannot convert it to OpenCL.\n";
     return false;
   }
 
-  newText->append(argvIdxToInput[index]);
+  newText->append(input->second);
   return true;
 }
 
-bool isInputArgv() {
-  for (auto &input : inputs) {
+bool isInputArgv(const CodeGenContext &context) {
+  for (auto &input : context.inputs) {
     if (input.name == "argv")
       return true;
   }
@@ -452,9 +630,10 @@ bool isInputArgv() {
   return false;
 }
 
-void subtractOneIfArgvInput(const ArraySubscriptExpr *expr,
-                            Rewriter &rewriter) {
-  if (!isInputArgv())
+void subtractOneIfArgvInput(const CodeGenContext &context,
+                            const ArraySubscriptExpr *expr,
+                            CountingRewriter &rewriter) {
+  if (!isInputArgv(context))
     return;
 
   // get the current array index expression
@@ -482,25 +661,27 @@ StatementMatcher argvMatcher =
         .bind("argvArray");
 class ArgvHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
 
 public:
-  ArgvHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  ArgvHandler(TranslationUnitState &tu) : tu(tu), rewriter(tu.rewriter) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     if (const ArraySubscriptExpr *expr =
             Result.Nodes.getNodeAs<clang::ArraySubscriptExpr>("argvArray")) {
       // This reference to argv is not in a atoi call
-      if (!argvIdxToIsReplaced[expr->getIdx()]) {
-        std::string text = "input_gen.";
-        if (getInputParamFromArgvIndex(expr, &text)) {
+      if (!tu.argvIdxToIsReplaced[expr->getIdx()]) {
+        std::string text =
+            readsInputsInPlace(tu.context) ? "input_gen->" : "input_gen.";
+        if (getInputParamFromArgvIndex(tu.context, expr, &text)) {
           SourceRange range = expr->getSourceRange();
           int length = rewriter.getRangeSize(range);
           rewriter.ReplaceText(range.getBegin(), length, text);
         } else {
           // leave reference to argv, but if it is an input, then we need to
           // subtract 1 from the index expression
-          subtractOneIfArgvInput(expr, rewriter);
+          subtractOneIfArgvInput(tu.context, expr, rewriter);
         }
       }
     }
@@ -517,26 +698,28 @@ auto argvInAtoiMatcher =
 
 class ArgvInAtoiHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
 
 public:
-  ArgvInAtoiHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  ArgvInAtoiHandler(TranslationUnitState &tu) : tu(tu), rewriter(tu.rewriter) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     bool shouldReplace = true;
 
     // Get the input parameter to match
-    std::string newText = "input_gen.";
+    std::string newText =
+        readsInputsInPlace(tu.context) ? "input_gen->" : "input_gen.";
 
     if (const ArraySubscriptExpr *expr =
             Result.Nodes.getNodeAs<ArraySubscriptExpr>("argvArray")) {
-      argvIdxToIsReplaced[expr->getIdx()] = true;
+      tu.argvIdxToIsReplaced[expr->getIdx()] = true;
 
-      shouldReplace = getInputParamFromArgvIndex(expr, &newText);
+      shouldReplace = getInputParamFromArgvIndex(tu.context, expr, &newText);
       if (!shouldReplace) {
         // leave reference to argv, but if it is an input, then we need to
         // subtract 1 from the index expression
-        subtractOneIfArgvInput(expr, rewriter);
+        subtractOneIfArgvInput(tu.context, expr, rewriter);
       }
     }
 
@@ -554,50 +737,34 @@ auto inputsMatcher = callExpr(hasAncestor(functionDecl().bind("inputCaller")),
                               hasAnyArgument(ignoringImpCasts(
                                   declRefExpr(to(varDecl(hasName("stdin")))))));
 class InputsHandler : public MatchFinder::MatchCallback {
+private:
+  TranslationUnitState &tu;
+
 public:
-  InputsHandler() {}
+  InputsHandler(TranslationUnitState &tu) : tu(tu) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const FunctionDecl *inputCaller =
         Result.Nodes.getNodeAs<FunctionDecl>("inputCaller");
-    if (!isMain(inputCaller) && !containsRefToInput(inputCaller))
-      functionsWhichUseTestInputs.push_back(inputCaller);
-  }
-};
-
-auto resultsMatcher = callExpr(hasAncestor(functionDecl().bind("resultCaller")),
-                               callee(functionDecl()))
-                          .bind("resultCall");
-class ResultsHandler : public MatchFinder::MatchCallback {
-public:
-  ResultsHandler() {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *resultCall = Result.Nodes.getNodeAs<CallExpr>("resultCall");
-    for (auto &result : results) {
-      if (resultCall->getDirectCallee()->getNameAsString() ==
-          result.testedValue.name) {
-        const FunctionDecl *resultCaller =
-            Result.Nodes.getNodeAs<FunctionDecl>("resultCaller");
-        if (!isMain(resultCaller) && !containsRefToResult(resultCaller))
-          functionsWhichUseTestResults.push_back(resultCaller);
-      }
-    }
+    auto callerName = inputCaller->getNameAsString();
+    if (!isMain(callerName))
+      tu.facts.functionsWhichUseTestInputs.insert(callerName);
   }
 };
 
+// stdin is replaced with the stdin input after all reads from stdin in the
+// program are found
 auto stdinMatcher =
     callExpr(hasAncestor(functionDecl().bind("stdinCaller")),
              hasAnyArgument(ignoringImpCasts(
-                 declRefExpr(to(varDecl(hasName("stdin")))).bind("stdinArg")))
-             )
+                 declRefExpr(to(varDecl(hasName("stdin")))).bind("stdinArg"))))
         .bind("stdin");
 class StdinHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  StdinHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  StdinHandler(TranslationUnitState &tu) : tu(tu) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const CallExpr *stdinCallExpr = Result.Nodes.getNodeAs<CallExpr>("stdin");
@@ -608,26 +775,10 @@ public:
         Result.Nodes.getNodeAs<FunctionDecl>("stdinCaller");
 
     // add function in the list of functions
-    functionsWhichUseStdin.push_back(functionDecl);
-
-    // replace stdin with a reference to the input
-    // pick the name of the stdin var from test-params
-    auto stdinInput = stdinInputs.begin();
-    if (stdinInput == stdinInputs.end()) {
-      llvm::outs() << "There are fewer stdin parameters supplied than there "
-                      "are references to stdin in the code.\n";
-      return;
-    }
-
-    stdinInputs.pop_front();
-    std::string inputRef;
-    if (isMain(caller))
-      inputRef.append("input_gen.");
-    else
-      inputRef.append("input_gen->");
+    tu.facts.functionsWhichUseStdin.insert(functionDecl->getNameAsString());
 
-    inputRef.append(stdinInput->name);
-    replaceArgument(stdinCallExpr, stdinArgExpr, inputRef, &rewriter);
+    struct StdinUse stdinUse = {stdinCallExpr, stdinArgExpr, caller, ""};
+    tu.stdinUses.push_back(stdinUse);
   }
 };
 
@@ -636,10 +787,10 @@ auto scanfMatcher = callExpr(callee(functionDecl(hasName("scanf"))),
                         .bind("scanf");
 class ScanfHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  ScanfHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  ScanfHandler(TranslationUnitState &tu) : tu(tu) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const CallExpr *stdinCallExpr = Result.Nodes.getNodeAs<CallExpr>("scanf");
@@ -648,154 +799,10 @@ public:
         Result.Nodes.getNodeAs<FunctionDecl>("scanfCaller");
 
     // add function in the list of functions
-    functionsWhichUseStdin.push_back(functionDecl);
-
-    // stdin argument to the call of scanf
-    auto stdinInput = stdinInputs.begin();
-    if (stdinInput == stdinInputs.end()) {
-      llvm::outs() << "There are fewer stdin parameters supplied than there "
-                      "are references to stdin in the code.\n";
-      return;
-    }
-
-    stdinInputs.pop_front();
-    std::string inputRef;
-    if (isMain(caller))
-      inputRef.append("&input_gen.");
-    else
-      inputRef.append("&input_gen->");
-
-    inputRef.append(stdinInput->name);
-    addNewArgument(stdinCallExpr, inputRef, &rewriter);
-  }
-};
-
-auto mainMatcher = functionDecl(hasName("main")).bind("mainDecl");
-class MainHandler : public MatchFinder::MatchCallback {
-private:
-  Rewriter &rewriter;
-
-public:
-  MainHandler(Rewriter &rewrite) : rewriter(rewrite) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    isMainFile = true;
-
-    const FunctionDecl *decl = Result.Nodes.getNodeAs<FunctionDecl>("mainDecl");
-
-    // rename and label as kernel
-    std::string funcName = decl->getNameInfo().getName().getAsString();
-    rewriter.ReplaceText(decl->getLocation(), funcName.length(), "main_kernel");
-    rewriter.InsertTextBefore(decl->getTypeSpecStartLoc(), "__kernel ");
-
-    // make return type 'void'
-    SourceRange returnTypeRange = decl->getReturnTypeSourceRange();
-    int rangeSize = decl->getReturnType().getAsString().length();
-    rewriter.ReplaceText(returnTypeRange.getBegin(), rangeSize, "void");
+    tu.facts.functionsWhichUseStdin.insert(functionDecl->getNameAsString());
 
-    // change argument list
-    const ParmVarDecl *paramDeclArgc = decl->getParamDecl(0);
-    std::stringstream ssinput;
-    ssinput << "__global struct " << structs_constants::INPUT << "* inputs";
-    replaceParam(paramDeclArgc, ssinput.str(), &rewriter);
-
-    const ParmVarDecl *paramDeclArgv = decl->getParamDecl(1);
-    std::stringstream ssresult;
-    ssresult << "__global struct " << structs_constants::RESULT << "* results";
-    replaceParam(paramDeclArgv, ssresult.str(), &rewriter);
-
-    // add variables at the beginning of body
-    Stmt *body = decl->getBody();
-    auto bbLoc = body->getSourceRange().getBegin().getLocWithOffset(1);
-    auto eLoc = body->getSourceRange().getEnd();
-
-    std::stringstream bbInsertion;
-    std::stringstream eInsertion;
-
-    // append idx, input, argc and results lines
-    bbInsertion << "\n  int partecl_idx = get_global_id(0);\n";
-    bbInsertion << "  struct " << structs_constants::INPUT
-                << " input_gen = inputs[partecl_idx];\n";
-    bbInsertion << "  __global struct " << structs_constants::RESULT
-                << " *result_gen = &results[partecl_idx];\n";
-    bbInsertion << "  int " << structs_constants::ARGC
-                << " = input_gen.argc;\n";
-    bbInsertion << "  result_gen->" << structs_constants::TEST_CASE_NUM
-                << " = input_gen." << structs_constants::TEST_CASE_NUM << ";\n";
-
-    // add declarations for global variables
-    bbInsertion << "\n";
-    for (auto &globalVar : globalVars) {
-      // this is not a test input or it is one which isn't an array
-      struct Declaration inputRef;
-      if (!isTestInput(globalVar, inputRef) || !inputRef.isArray) {
-        // get original declaration
-        bbInsertion << "  ";
-        std::string stringLiteral;
-        llvm::raw_string_ostream s(stringLiteral);
-        globalVar->print(s, 0, true);
-
-        // if an array, make it private
-        if (globalVar->getType()->isArrayType())
-          bbInsertion << "private ";
-
-        bbInsertion << s.str() << ";\n";
-      } else {
-        // If an array based test input, add assignment here
-        addAssignmentForArrayTestInputs(inputRef, bbInsertion);
-      }
-    }
-
-    // add assignment for array based test inputs
-    for (auto &input : inputs) {
-      if (!inputsToIsAddedDeclaration[input.name])
-        addAssignmentForArrayTestInputs(input, bbInsertion);
-    }
-
-    // TODO: Handle multiple results more gracefully for fputc
-    for (auto &result : results) {
-      // add declaration for counter in case there is a result which is printed
-      // char by char
-      if (isResultPrintedChatByChar(result)) {
-        bbInsertion << "  int res_count_gen;\n"
-                    << "  res_count_gen = 0;\n";
-      }
-
-      // character termination in case result is printed char by char
-      if (isResultPrintedChatByChar(result)) {
-        eInsertion << "  *(result_gen->" << result.declaration.name
-                   << " + res_count_gen) = \'\\0\';\n";
-      }
-
-      // when the tested value is a variable, add an assignment to the result
-      // struct
-      if (result.testedValue.type == TestedValueType::variable) {
-        if (result.declaration.isArray) {
-          eInsertion << "  for(int i = 0; i < ";
-          eInsertion << result.declaration.size;
-          eInsertion << "; i++)\n";
-          eInsertion << "  {\n";
-          eInsertion << "    result_gen->";
-          eInsertion << result.declaration.name;
-          eInsertion << "[i] = ";
-          eInsertion << result.testedValue.name;
-          eInsertion << "[i];\n";
-          eInsertion << "  }\n";
-        } else {
-          eInsertion << "  result_gen->";
-          eInsertion << result.declaration.name;
-          eInsertion << " = ";
-          eInsertion << result.testedValue.name;
-          eInsertion << ";\n";
-        }
-      }
-    }
-
-    // insert in the beginning
-    rewriter.InsertText(bbLoc, bbInsertion.str());
-
-    // insert in the end
-    rewriter.InsertText(eLoc, eInsertion.str());
+    struct StdinUse stdinUse = {stdinCallExpr, nullptr, caller, ""};
+    tu.stdinUses.push_back(stdinUse);
   }
 };
 
@@ -803,10 +810,10 @@ auto returnInMainMatcher =
     returnStmt(hasAncestor(functionDecl(hasName("main")))).bind("returnInMain");
 class ReturnInMainHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  CountingRewriter &rewriter;
 
 public:
-  ReturnInMainHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  ReturnInMainHandler(TranslationUnitState &tu) : rewriter(tu.rewriter) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const ReturnStmt *returnStmt =
@@ -815,24 +822,70 @@ public:
   }
 };
 
-auto commentOutMatcher = callExpr(callee(functionDecl())).bind("commentOut");
-class CommentOutHandler : public MatchFinder::MatchCallback {
+bool isIOCall(const std::string &funcName) {
+  return funcName == "printf" || funcName == "fprintf" || funcName == "exit" ||
+         funcName == "abort" || funcName.find("fput") != std::string::npos;
+}
+
+bool isTestedValueCall(const CodeGenContext &context,
+                       const std::string &funcName) {
+  for (auto &result : context.results) {
+    if (result.testedValue.type == TestedValueType::functionCall &&
+        result.testedValue.name == funcName)
+      return true;
+  }
+
+  return false;
+}
+
+// Collect the facts about every call in one go:
+// 1. comment out I/O
+// 2. build a callee to caller map
+// 3. find functions which produce test results
+// 4. find calls to tested functions
+// 5. find functions which need special headers
+auto callSiteMatcher =
+    callExpr(callee(functionDecl()), hasAncestor(functionDecl().bind("caller")))
+        .bind("callSite");
+class CallSiteHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
 
 public:
-  CommentOutHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  CallSiteHandler(TranslationUnitState &tu) : tu(tu), rewriter(tu.rewriter) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *expr = Result.Nodes.getNodeAs<CallExpr>("commentOut");
-    auto funcName = expr->getDirectCallee()->getNameAsString();
-
-    if (funcName == "printf" || funcName == "fprintf" || funcName == "exit" ||
-        funcName == "abort" || funcName.find("fput") != std::string::npos) {
-      // Comment out
-      auto range = expr->getSourceRange();
-      commentOut(range, &rewriter);
+    const CallExpr *call = Result.Nodes.getNodeAs<CallExpr>("callSite");
+    const FunctionDecl *caller = Result.Nodes.getNodeAs<FunctionDecl>("caller");
+    auto funcName = call->getDirectCallee()->getNameAsString();
+    auto callerName = caller->getNameAsString();
+
+    auto &callerFacts = tu.functionFacts[caller];
+    callerFacts.callSites.push_back(call);
+
+    // comment out I/O
+    if (isIOCall(funcName))
+      commentOut(call->getSourceRange(), &rewriter);
+
+    // callee to caller map
+    tu.facts.funcDeclToCallerDecls[funcName].insert(callerName);
+
+    // the caller produces a test result
+    for (auto &result : tu.context.results) {
+      if (funcName == result.testedValue.name) {
+        if (!isMain(callerName))
+          tu.facts.functionsWhichUseTestResults.insert(callerName);
+      }
     }
+
+    if (isTestedValueCall(tu.context, funcName))
+      callerFacts.testedValueCalls.push_back(call);
+
+    // includes
+    auto headerName = functionToHeaderFile.find(funcName);
+    if (headerName != functionToHeaderFile.end())
+      addInclude(tu.facts, headerName->second);
   }
 };
 
@@ -841,10 +894,11 @@ public:
 auto variableLengthArraysMatcher = varDecl(hasType(variableArrayType().bind("variableLengthArrayType")));
 class VariableLengthArraysHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  CountingRewriter &rewriter;
 
 public:
-  VariableLengthArraysHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  VariableLengthArraysHandler(TranslationUnitState &tu)
+      : rewriter(tu.rewriter) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const VariableArrayType *type =
@@ -858,245 +912,807 @@ public:
 };
 
 // find global vars
-// comment out declarations
-// build a list of global var declarations
+// build a list of global var declarations (they are commented out or moved to
+// constant memory once it is known which ones are written to)
 auto globalVarMatcher = varDecl().bind("globalVar");
 class GlobalVarHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  GlobalVarHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  GlobalVarHandler(TranslationUnitState &tu) : tu(tu) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     if (const VarDecl *decl = Result.Nodes.getNodeAs<VarDecl>("globalVar")) {
       // find out if the declaration is global
       if (decl->isFileVarDecl() && !decl->hasExternalStorage()) {
-        // comment out the global variable
-        auto start = decl->getLocStart();
-        auto end = decl->getLocEnd();
-        // for arrays and initialised vars the end is where it should be
-        if (!decl->getType()->isArrayType() && !decl->getInit())
-          end = end.getLocWithOffset(decl->getNameAsString().length());
-
-        commentOut(start, end, &rewriter);
+        tu.globalVarDecls.push_back(decl);
 
         // add it to our list of variables
-        globalVars.push_back(decl);
+        addGlobalVar(tu.facts, getGlobalVarFacts(decl));
+        addDefinedSymbol(tu.facts, decl, *Result.SourceManager,
+                         decl->getStorageClass() == SC_Static);
       }
     }
   }
+
+private:
+  // keep everything we need from the declaration, as other translation units
+  // do not have access to it
+  struct GlobalVarFacts getGlobalVarFacts(const VarDecl *decl) {
+    struct GlobalVarFacts globalVar;
+    struct Declaration inputRef;
+    globalVar.name = decl->getNameAsString();
+
+    // get original declaration
+    std::string stringLiteral;
+    llvm::raw_string_ostream s(stringLiteral);
+    decl->print(s, 0, true);
+    globalVar.declaration = s.str();
+
+    auto varType = decl->getType();
+    globalVar.isArray = varType->isArrayType();
+
+    // the declaration as a function parameter
+    std::string newParam;
+    if (varType->isArrayType()) {
+      // if array, we want to take the base type only and add 'private'
+      // eg. int, not int[4]
+      newParam = "private ";
+      newParam.append(
+          varType->getAsArrayTypeUnsafe()->getElementType().getAsString());
+    } else {
+      newParam = varType.getAsString();
+    }
+    newParam.append(" ");
+
+    // turn it into a pointer
+    if (!varType->isArrayType()) {
+      newParam.append("*");
+    }
+    newParam.append(globalVar.name);
+
+    if (varType->isArrayType())
+      newParam.append("[]");
+
+    globalVar.param = newParam;
+
+    // only numbers, as pointers into constant memory would need their address
+    // space changed wherever they go
+    auto elementType = varType->getBaseElementTypeUnsafe();
+    globalVar.canBeConstant =
+        decl->getInit() != nullptr && elementType->isArithmeticType() &&
+        !isTestInput(tu.context, globalVar.name, inputRef);
+    return globalVar;
+  }
 };
 
-// Find all functions which use global vars directly and build a map for them
+// whether a use of a variable only reads its value, or the value of an element
+// of it; anything else, including passing it to a function, counts as a write
+bool isRead(ASTContext &context, const Expr *expr) {
+  while (true) {
+    auto parents = context.getParents(*expr);
+    if (parents.size() != 1)
+      return false;
+
+    if (const auto *cast = parents[0].get<ImplicitCastExpr>()) {
+      if (cast->getCastKind() == CK_LValueToRValue)
+        return true;
+      if (cast->getCastKind() != CK_ArrayToPointerDecay)
+        return false;
+      expr = cast;
+    } else if (const auto *subscript = parents[0].get<ArraySubscriptExpr>()) {
+      if (subscript->getBase() != expr)
+        return false;
+      expr = subscript;
+    } else if (const auto *paren = parents[0].get<ParenExpr>()) {
+      expr = paren;
+    } else {
+      return parents[0].get<UnaryExprOrTypeTraitExpr>() != nullptr;
+    }
+  }
+}
+
+// Find all references to file scope variables from functions; the ones which
+// turn out to be global vars are rewritten after all facts are merged
 auto globalVarUseMatcher =
-    declRefExpr(hasAncestor(functionDecl().bind("globalVarUseFunction")))
+    declRefExpr(to(varDecl(hasGlobalStorage())),
+                hasAncestor(functionDecl().bind("globalVarUseFunction")))
         .bind("globalVarUse");
 class GlobalVarUseHandler : public MatchFinder::MatchCallback {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  GlobalVarUseHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  GlobalVarUseHandler(TranslationUnitState &tu) : tu(tu) {}
 
   virtual void run(const MatchFinder::MatchResult &Result) {
     const auto *decl =
         Result.Nodes.getNodeAs<FunctionDecl>("globalVarUseFunction");
     const auto *expr = Result.Nodes.getNodeAs<DeclRefExpr>("globalVarUse");
 
+    const auto *varDecl = dyn_cast<VarDecl>(expr->getDecl());
+    if (!varDecl || !varDecl->isFileVarDecl())
+      return;
+
+    if (!isRead(*Result.Context, expr))
+      tu.facts.writtenGlobalVars.insert(varDecl->getNameAsString());
+
     // do not add new parameters to "main"
     if (isMain(decl))
       return;
 
-    if (!isGlobalVar(expr))
-      return;
+    struct GlobalVarUse globalVarUse = {expr, decl->getNameAsString()};
+    tu.globalVarUses.push_back(globalVarUse);
+  }
+};
 
-    // turn the reference into a pointer
-    auto varType = expr->getType();
-    if (!varType->isArrayType()) {
-      // gets the correct macro location when the expression is in a macro
-      const auto exprLoc =
-          rewriter.getSourceMgr().getSpellingLoc(expr->getLocStart());
+// Find the array inputs which the program writes to; they are copied into
+// private memory when the inputs are read in place
+auto inputUseMatcher = declRefExpr(to(varDecl())).bind("inputUse");
+class InputUseHandler : public MatchFinder::MatchCallback {
+private:
+  TranslationUnitState &tu;
 
-      // this map is used when we have a macro used in multiple places so we do
+public:
+  InputUseHandler(TranslationUnitState &tu) : tu(tu) {}
+
+  virtual void run(const MatchFinder::MatchResult &Result) {
+    // only needed when the inputs are read in place
+    if (!tu.context.buffers.globalInputs)
+      return;
+
+    const auto *expr = Result.Nodes.getNodeAs<DeclRefExpr>("inputUse");
+    const auto *varDecl = dyn_cast<VarDecl>(expr->getDecl());
+
+    // array inputs are global vars or variables of main
+    const auto *function =
+        dyn_cast_or_null<FunctionDecl>(varDecl->getParentFunctionOrMethod());
+    if (!varDecl->isFileVarDecl() && !(function && isMain(function)))
+      return;
+
+    struct Declaration inputRef;
+    auto varName = varDecl->getNameAsString();
+    if (isTestInput(tu.context, varName, inputRef) && inputRef.isArray &&
+        !isRead(*Result.Context, expr))
+      tu.facts.writtenInputs.insert(varName);
+  }
+};
+
+// Build the list of function declarations, which the rewrite phase walks
+auto functionDeclMatcher = functionDecl().bind("functionDecl");
+class FunctionDeclHandler : public MatchFinder::MatchCallback {
+private:
+  TranslationUnitState &tu;
+
+public:
+  FunctionDeclHandler(TranslationUnitState &tu) : tu(tu) {}
+
+  virtual void run(const MatchFinder::MatchResult &Result) {
+    const auto *decl = Result.Nodes.getNodeAs<FunctionDecl>("functionDecl");
+    tu.functionDecls.push_back(decl);
+    if (decl->isThisDeclarationADefinition())
+      addDefinedSymbol(tu.facts, decl, *Result.SourceManager,
+                       decl->getStorageClass() == SC_Static);
+  }
+};
+
+// OpenCL has its own bool, so comment out typedefs of it
+auto typedefBoolMatcher =
+    typedefDecl(hasName("bool"), isExpansionInMainFile()).bind("typedefBool");
+class TypedefBoolHandler : public MatchFinder::MatchCallback {
+private:
+  CountingRewriter &rewriter;
+
+public:
+  TypedefBoolHandler(TranslationUnitState &tu) : rewriter(tu.rewriter) {}
+
+  virtual void run(const MatchFinder::MatchResult &Result) {
+    const auto *decl = Result.Nodes.getNodeAs<TypedefDecl>("typedefBool");
+    auto &sourceMgr = rewriter.getSourceMgr();
+    auto start = decl->getLocStart();
+    if (start.isMacroID())
+      return;
+
+    // comment out up to and including the semicolon
+    auto end = Lexer::findLocationAfterToken(decl->getLocEnd(), tok::semi,
+                                             sourceMgr, langOpts, false);
+    if (end.isInvalid() || sourceMgr.getSpellingLineNumber(start) ==
+                               sourceMgr.getSpellingLineNumber(end)) {
+      commentOutToEndOfLine(decl->getSourceRange(), rewriter);
+      return;
+    }
+
+    rewriter.InsertText(start, "/*");
+    rewriter.InsertText(end, "*/");
+  }
+};
+
+// OpenCL has no system headers, so comment out the system includes of the
+// source; they are found in its preprocessing record, which also has the
+// includes which were skipped because the header was already included
+void commentOutSystemIncludes(TranslationUnitState &tu) {
+  auto record = tu.ast->getPreprocessor().getPreprocessingRecord();
+  if (!record) {
+    llvm::errs() << "There is no preprocessing record for " << tu.filename
+                 << "; its system includes are not commented out.\n";
+    return;
+  }
+
+  auto &sourceMgr = tu.ast->getSourceManager();
+  for (auto entity = record->local_begin(); entity != record->local_end();
+       entity++) {
+    auto include = dyn_cast_or_null<InclusionDirective>(*entity);
+    if (!include || include->wasInQuotes())
+      continue;
+
+    auto range = include->getSourceRange();
+    if (range.getBegin().isMacroID() ||
+        !sourceMgr.isWrittenInMainFile(range.getBegin()))
+      continue;
+
+    commentOutToEndOfLine(range, tu.rewriter);
+  }
+}
+
+/* Rewrite phase handlers
+ * These run after the facts about the whole program are collected
+ * and propagated through the call graph.
+ */
+
+// Turn the references to global vars into pointers
+class GlobalVarUseRewriter {
+private:
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
+
+public:
+  GlobalVarUseRewriter(TranslationUnitState &tu)
+      : tu(tu), rewriter(tu.rewriter) {}
+
+  void run(const struct GlobalVarUse &globalVarUse) {
+    const auto *expr = globalVarUse.expr;
+    auto varName = expr->getDecl()->getNameAsString();
+    if (!isGlobalVar(tu.context.programFacts, varName) ||
+        isConstantGlobalVar(tu.context.programFacts, varName))
+      return;
+
+    // turn the reference into a pointer
+    auto varType = expr->getType();
+    if (!varType->isArrayType()) {
+      // gets the correct macro location when the expression is in a macro
+      const auto exprLoc =
+          rewriter.getSourceMgr().getSpellingLoc(expr->getLocStart());
+
+      // this map is used when we have a macro used in multiple places so we do
       // not dereference multiple times
-      if (!locationToPointerDereferenced[exprLoc]) {
+      if (!tu.locationToPointerDereferenced[exprLoc]) {
         rewriter.InsertText(exprLoc, "(*");
         rewriter.InsertText(
             exprLoc.getLocWithOffset(expr->getDecl()->getNameAsString().size()),
             ")");
-        locationToPointerDereferenced[exprLoc] = true;
+        tu.locationToPointerDereferenced[exprLoc] = true;
       }
     }
+  }
+};
 
-    // check if the global var was already added to the argument list
-    auto visitedVarsTuple = funcToGlobalVars.find(decl);
-    if (visitedVarsTuple != funcToGlobalVars.end()) {
-      auto visitedVars = visitedVarsTuple->second;
-      if (find(visitedVars.begin(), visitedVars.end(), expr->getDecl()) !=
-          visitedVars.end())
-        return;
+// Comment out the declarations of global vars, which are declared in main
+// instead, and move the ones which are never written to constant memory
+class GlobalVarDeclRewriter {
+private:
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
+
+public:
+  GlobalVarDeclRewriter(TranslationUnitState &tu)
+      : tu(tu), rewriter(tu.rewriter) {}
+
+  void run(const VarDecl *decl) {
+    auto start = decl->getLocStart();
+    if (isConstantGlobalVar(tu.context.programFacts, decl->getNameAsString())) {
+      rewriter.InsertTextBefore(start, "__constant ");
+      return;
     }
 
-    funcToGlobalVars[decl].push_back(expr->getDecl());
+    // comment out the global variable
+    auto end = decl->getLocEnd();
+    // for arrays and initialised vars the end is where it should be
+    if (!decl->getType()->isArrayType() && !decl->getInit())
+      end = end.getLocWithOffset(decl->getNameAsString().length());
+
+    commentOut(start, end, &rewriter);
   }
 };
 
-// Build a callee to caller map
-auto calleeToCallerMatcher =
-    callExpr(hasAncestor(functionDecl().bind("caller"))).bind("callee");
-class CalleeToCallerHandler : public MatchFinder::MatchCallback {
+// Replace reads from stdin with references to the stdin inputs
+class StdinRewriter {
+private:
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
+
 public:
-  CalleeToCallerHandler() {}
+  StdinRewriter(TranslationUnitState &tu) : tu(tu), rewriter(tu.rewriter) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *callee = Result.Nodes.getNodeAs<CallExpr>("callee");
-    const FunctionDecl *caller = Result.Nodes.getNodeAs<FunctionDecl>("caller");
+  void run(const struct StdinUse &stdinUse) {
+    if (stdinUse.inputName == "")
+      return;
 
-    funcCallToCallerDecl[callee] = caller;
-    auto decl = callee->getDirectCallee();
-    funcDeclToCallerDecls[decl].push_back(caller);
+    // replace stdin with a reference to the input
+    std::string inputRef = getInputRef(tu.context, stdinUse.inputName,
+                                       isMain(stdinUse.caller));
+    replaceArgument(stdinUse.call, stdinUse.stdinArg, inputRef, &rewriter);
+  }
+};
+
+class ScanfRewriter {
+private:
+  TranslationUnitState &tu;
+
+public:
+  ScanfRewriter(TranslationUnitState &tu) : tu(tu) {}
+
+  void run(const struct StdinUse &stdinUse) {
+    if (stdinUse.inputName == "")
+      return;
+
+    // stdin argument to the call of scanf
+    std::string inputRef = "&" + getInputRef(tu.context, stdinUse.inputName,
+                                             isMain(stdinUse.caller));
+    addNewArgument(tu, stdinUse.call, inputRef);
+  }
+};
+
+// Add a kernel parameter for the buffer of each field (struct of arrays)
+void addBufferParams(std::stringstream &params,
+                     const std::list<struct Declaration> &fields,
+                     const std::string &prefix) {
+  bool first = true;
+  for (auto &field : fields) {
+    if (!first)
+      params << ", ";
+    params << "__global " << getFieldType(field) << " *" << prefix
+           << field.name;
+    first = false;
+  }
+}
+
+// Unpack the input of the test case from "input_packed" into "input_gen",
+// widening the inputs stored in narrower types, and pointing each packed
+// variable length input to its elements in the arena
+void addInputUnpacking(TranslationUnitState &tu,
+                       std::stringstream &bbInsertion) {
+  bbInsertion << "  struct " << structs_constants::INPUT_VIEW
+              << " input_gen;\n";
+  for (auto &field :
+       getInputFields(tu.context.inputs, tu.context.stdinInputs)) {
+    if (tu.context.buffers.packedInputs && isVariableLength(field)) {
+      bbInsertion << "  input_gen." << field.name << " = (__global "
+                  << field.type << " *)(" << structs_constants::ARENA
+                  << " + input_packed." << field.name
+                  << structs_constants::OFFSET_SUFFIX << ");\n";
+    } else if (isStoredAsArray(field)) {
+      bbInsertion << "  for(int el = 0; el < " << getArraySize(field)
+                  << "; el++)\n";
+      bbInsertion << "    input_gen." << field.name << "[el] = input_packed."
+                  << field.name << "[el];\n";
+    } else {
+      bbInsertion << "  input_gen." << field.name << " = input_packed."
+                  << field.name << ";\n";
+    }
+  }
+}
+
+// Copy the inputs which the program writes to from the buffer into
+// "input_rw", when the inputs are read in place
+void addWrittenInputsCopy(TranslationUnitState &tu,
+                          std::stringstream &bbInsertion) {
+  bbInsertion << "  struct " << structs_constants::INPUT << " input_rw;\n";
+  for (auto &field :
+       getInputFields(tu.context.inputs, tu.context.stdinInputs)) {
+    if (!isWrittenInput(tu.context, field.name))
+      continue;
+
+    if (isStoredAsArray(field)) {
+      bbInsertion << "  for(int el = 0; el < " << getArraySize(field)
+                  << "; el++)\n";
+      bbInsertion << "    input_rw." << field.name << "[el] = input_gen->"
+                  << field.name << "[el];\n";
+    } else {
+      bbInsertion << "  input_rw." << field.name << " = input_gen->"
+                  << field.name << ";\n";
+    }
+  }
+}
+
+// with the struct of arrays layout the result is scattered to the buffers at
+// the end of the kernel, and when compacting it is written only if it failed;
+// until then, it is kept in private memory
+bool isResultPrivate(const BufferOptions &buffers) {
+  return buffers.resultLayout == BufferLayout::structOfArrays ||
+         buffers.compactResults;
+}
+
+// Compare the result with the expected one, and write it to the front of the
+// results buffer if it differs. The work-items of a group first count their
+// failures in local memory, so that only one of them updates the global count.
+void addResultCompaction(TranslationUnitState &tu,
+                         std::stringstream &eInsertion) {
+  auto result = [](const struct Declaration &field, const std::string &el) {
+    return "result_gen->" + field.name +
+           (isStoredAsArray(field) ? "[" + el + "]" : "");
+  };
+  auto expected = [](const struct Declaration &field, const std::string &el) {
+    return "exp_results[partecl_idx]." + field.name +
+           (isStoredAsArray(field) ? "[" + el + "]" : "");
+  };
+
+  eInsertion << "\n";
+  eInsertion << getResultChecks(tu.context.results, result, expected,
+                                "partecl_passed");
+  // closes the check of num_test_cases, so that every work-item of the group
+  // reaches the barriers
+  eInsertion << "  }\n";
+  eInsertion << "  uint partecl_slot = 0;\n";
+  eInsertion << "  if(get_local_id(0) == 0)\n";
+  eInsertion << "    partecl_group_failures = 0;\n";
+  eInsertion << "  barrier(CLK_LOCAL_MEM_FENCE);\n";
+  eInsertion << "  if(!partecl_passed)\n";
+  eInsertion << "    partecl_slot = atomic_inc(&partecl_group_failures);\n";
+  eInsertion << "  barrier(CLK_LOCAL_MEM_FENCE);\n";
+  eInsertion << "  if(get_local_id(0) == 0 && partecl_group_failures > 0)\n";
+  eInsertion << "    partecl_group_base = atomic_add(partecl_num_failures, "
+                "partecl_group_failures);\n";
+  eInsertion << "  barrier(CLK_LOCAL_MEM_FENCE);\n";
+  eInsertion << "  if(!partecl_passed)\n";
+  eInsertion << "    results[partecl_group_base + partecl_slot] = "
+                "result_gen_rec;\n";
+}
+
+// Turn main into the kernel; runs after all global variables are discovered
+class MainHandler {
+private:
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
+
+public:
+  MainHandler(TranslationUnitState &tu) : tu(tu), rewriter(tu.rewriter) {}
+
+  void run(const FunctionDecl *decl) {
+    tu.isMainFile = true;
+
+    // rename and label as kernel
+    std::string funcName = decl->getNameInfo().getName().getAsString();
+    rewriter.ReplaceText(decl->getLocation(), funcName.length(), "main_kernel");
+    rewriter.InsertTextBefore(decl->getTypeSpecStartLoc(), "__kernel ");
+
+    // make return type 'void'
+    SourceRange returnTypeRange = decl->getReturnTypeSourceRange();
+    int rangeSize = decl->getReturnType().getAsString().length();
+    rewriter.ReplaceText(returnTypeRange.getBegin(), rangeSize, "void");
+
+    // change argument list
+    auto &buffers = tu.context.buffers;
+    auto inputFields = getStoredInputFields(tu.context.inputs,
+                                            tu.context.stdinInputs, buffers);
+    bool hasView = hasInputView(tu.context.inputs, buffers.packedInputs);
+    auto resultFields = getStoredResultFields(tu.context.results, buffers);
+    bool isInputSoA = buffers.inputLayout == BufferLayout::structOfArrays;
+    bool isResultSoA = buffers.resultLayout == BufferLayout::structOfArrays;
+    bool isInPlace = readsInputsInPlace(tu.context);
+
+    const ParmVarDecl *paramDeclArgc = decl->getParamDecl(0);
+    std::stringstream ssinput;
+    if (isInputSoA)
+      addBufferParams(ssinput, inputFields,
+                      structs_constants::INPUT_BUFFER_PREFIX);
+    else if (isInPlace)
+      ssinput << "__global const struct " << structs_constants::INPUT
+              << " * restrict inputs";
+    else
+      ssinput << "__global struct " << structs_constants::INPUT << "* inputs";
+    if (buffers.packedInputs)
+      ssinput << ", __global char *" << structs_constants::ARENA;
+    replaceParam(paramDeclArgc, ssinput.str(), &rewriter);
+
+    const ParmVarDecl *paramDeclArgv = decl->getParamDecl(1);
+    std::stringstream ssresult;
+    if (isResultSoA)
+      addBufferParams(ssresult, resultFields,
+                      structs_constants::RESULT_BUFFER_PREFIX);
+    else if (isInPlace)
+      ssresult << "__global struct " << structs_constants::RESULT
+               << " * restrict results";
+    else
+      ssresult << "__global struct " << structs_constants::RESULT
+               << "* results";
+    if (buffers.compactResults)
+      ssresult << ", __global const struct " << structs_constants::RESULT
+               << "* exp_results, __global uint* partecl_num_failures, "
+                  "int num_test_cases";
+    replaceParam(paramDeclArgv, ssresult.str(), &rewriter);
+
+    // add variables at the beginning of body
+    Stmt *body = decl->getBody();
+    auto bbLoc = body->getSourceRange().getBegin().getLocWithOffset(1);
+    auto eLoc = body->getSourceRange().getEnd();
+
+    std::stringstream bbInsertion;
+    std::stringstream eInsertion;
+
+    // append idx, input, argc and results lines
+    bbInsertion << "\n  int partecl_idx = get_global_id(0);\n";
+    if (buffers.compactResults) {
+      // the work-items past the last test case of a padded range only take
+      // part in the barriers of the compaction, as ones which passed
+      bbInsertion << "  __local uint partecl_group_failures;\n"
+                  << "  __local uint partecl_group_base;\n"
+                  << "  struct " << structs_constants::RESULT
+                  << " result_gen_rec;\n"
+                  << "  int partecl_passed = 1;\n"
+                  << "  if(partecl_idx < num_test_cases)\n"
+                  << "  {\n";
+    }
+    // inputs which are stored differently than declared are read into a
+    // struct of their own, and unpacked below
+    std::string input = hasView ? "input_packed" : "input_gen";
+    if (isInputSoA) {
+      // gather the input from the buffers
+      bbInsertion << "  struct " << structs_constants::INPUT << " " << input
+                  << ";\n";
+      for (auto &field : inputFields)
+        bbInsertion << getFieldCopy(field, input + ".",
+                                    structs_constants::INPUT_BUFFER_PREFIX,
+                                    "partecl_idx", false, "  ");
+    } else if (isInPlace) {
+      bbInsertion << "  __global const struct " << structs_constants::INPUT
+                  << " *input_gen = &inputs[partecl_idx];\n";
+      if (hasWrittenInputs(tu.context))
+        addWrittenInputsCopy(tu, bbInsertion);
+    } else {
+      bbInsertion << "  struct " << structs_constants::INPUT << " " << input
+                  << " = inputs[partecl_idx];\n";
+    }
+    if (hasView)
+      addInputUnpacking(tu, bbInsertion);
+    if (isResultPrivate(buffers)) {
+      // the result is written to private memory and stored at the end
+      if (!buffers.compactResults)
+        bbInsertion << "  struct " << structs_constants::RESULT
+                    << " result_gen_rec;\n";
+      bbInsertion << "  struct " << structs_constants::RESULT
+                  << " *result_gen = &result_gen_rec;\n";
+    } else {
+      bbInsertion << "  __global struct " << structs_constants::RESULT
+                  << " *result_gen = &results[partecl_idx];\n";
+    }
+    std::string inputAccess = isInPlace ? "input_gen->" : "input_gen.";
+    bbInsertion << "  int " << structs_constants::ARGC << " = " << inputAccess
+                << "argc;\n";
+    bbInsertion << "  result_gen->" << structs_constants::TEST_CASE_NUM
+                << " = " << inputAccess << structs_constants::TEST_CASE_NUM
+                << ";\n";
+
+    // add declarations for global variables (from all translation units)
+    bbInsertion << "\n";
+    for (auto &globalVar : tu.context.programFacts.globalVars) {
+      // already in constant memory
+      if (isConstantGlobalVar(tu.context.programFacts, globalVar.name))
+        continue;
+
+      // this is not a test input or it is one which isn't an array
+      struct Declaration inputRef;
+      if (!isTestInput(tu.context, globalVar.name, inputRef) ||
+          !inputRef.isArray) {
+        bbInsertion << "  ";
+
+        // if an array, make it private
+        if (globalVar.isArray)
+          bbInsertion << "private ";
+
+        bbInsertion << globalVar.declaration << ";\n";
+      } else {
+        // If an array based test input, add assignment here
+        addAssignmentForArrayTestInputs(tu, inputRef, bbInsertion);
+      }
+    }
+
+    // add assignment for array based test inputs
+    for (auto &input : tu.context.inputs) {
+      if (!tu.inputsToIsAddedDeclaration[input.name])
+        addAssignmentForArrayTestInputs(tu, input, bbInsertion);
+    }
+
+    // TODO: Handle multiple results more gracefully for fputc
+    for (auto &result : tu.context.results) {
+      // add declaration for counter in case there is a result which is printed
+      // char by char
+      if (isResultPrintedChatByChar(result)) {
+        bbInsertion << "  int res_count_gen;\n"
+                    << "  res_count_gen = 0;\n";
+      }
+
+      // character termination in case result is printed char by char
+      if (isResultPrintedChatByChar(result)) {
+        eInsertion << "  *(result_gen->" << result.declaration.name
+                   << " + res_count_gen) = \'\\0\';\n";
+      }
+
+      // when the tested value is a variable, add an assignment to the result
+      // struct
+      if (result.testedValue.type == TestedValueType::variable) {
+        if (result.declaration.isArray) {
+          eInsertion << "  for(int i = 0; i < ";
+          eInsertion << result.declaration.size;
+          eInsertion << "; i++)\n";
+          eInsertion << "  {\n";
+          eInsertion << "    result_gen->";
+          eInsertion << result.declaration.name;
+          eInsertion << "[i] = ";
+          eInsertion << result.testedValue.name;
+          eInsertion << "[i];\n";
+          eInsertion << "  }\n";
+        } else {
+          eInsertion << "  result_gen->";
+          eInsertion << result.declaration.name;
+          eInsertion << " = ";
+          eInsertion << result.testedValue.name;
+          eInsertion << ";\n";
+        }
+      }
+    }
+
+    // scatter the result to the buffers
+    if (isResultSoA) {
+      for (auto &field : resultFields)
+        eInsertion << getFieldCopy(field, "result_gen->",
+                                   structs_constants::RESULT_BUFFER_PREFIX,
+                                   "partecl_idx", true, "  ");
+    }
+    if (buffers.compactResults)
+      addResultCompaction(tu, eInsertion);
+
+    // insert in the beginning
+    rewriter.InsertText(bbLoc, bbInsertion.str());
+
+    // insert in the end
+    rewriter.InsertText(eLoc, eInsertion.str());
   }
 };
 
 // Add parameters to the declarations of all functions which use global
 // variables
-auto globalVarsAsParamsMatcher = functionDecl().bind("globalVarsAsParams");
-class GlobalVarsAsParamsHandler : public MatchFinder::MatchCallback {
+class GlobalVarsAsParamsHandler {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  GlobalVarsAsParamsHandler(Rewriter &rewrite) : rewriter(rewrite) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    auto *decl = Result.Nodes.getNodeAs<FunctionDecl>("globalVarsAsParams");
+  GlobalVarsAsParamsHandler(TranslationUnitState &tu) : tu(tu) {}
 
+  void run(const FunctionDecl *decl) {
     // do not add new parameters to "main"
     if (isMain(decl))
       return;
 
-    auto globalVarsIt = funcToGlobalVars.find(decl);
-    if (globalVarsIt == funcToGlobalVars.end())
+    auto &programFacts = tu.context.programFacts;
+    auto globalVarsIt =
+        programFacts.funcToGlobalVars.find(decl->getNameAsString());
+    if (globalVarsIt == programFacts.funcToGlobalVars.end())
       return;
 
-    auto globalVars = globalVarsIt->second;
+    auto &globalVars = globalVarsIt->second;
     for (auto var = globalVars.begin(); var != globalVars.end(); var++) {
-      auto varName = (*var)->getNameAsString();
-      auto varType = (*var)->getType();
-
       // add the global param to the function's argument list
-      std::string newParam;
-      if (varType->isArrayType()) {
-        // if array, we want to take the base type only and add 'private'
-        // eg. int, not int[4]
-        newParam = "private ";
-        newParam.append(
-            varType->getAsArrayTypeUnsafe()->getElementType().getAsString());
-      } else {
-        newParam = varType.getAsString();
-      }
-      newParam.append(" ");
+      auto globalVar = findGlobalVar(programFacts, *var);
 
-      // turn it into a pointer
-      if (!varType->isArrayType()) {
-        newParam.append("*");
+      // an array input which is read in place points into the buffer
+      struct Declaration inputRef;
+      if (readsInputsInPlace(tu.context) &&
+          isTestInput(tu.context, *var, inputRef) && inputRef.isArray &&
+          !isWrittenInput(tu.context, *var)) {
+        addNewParam(tu, decl,
+                    "__global const " + inputRef.type + " " + *var + "[]");
+        continue;
       }
-      newParam.append(varName);
 
-      if (varType->isArrayType())
-        newParam.append("[]");
-
-      addNewParam(decl, newParam, &rewriter);
+      addNewParam(tu, decl, globalVar->param);
     }
   }
 };
 
 // Add arguments to function calls which use global vars
-auto globalVarsAsArgsMatcher =
-    callExpr(hasAncestor(functionDecl().bind("globalVarsAsArgsCaller")))
-        .bind("globalVarsAsArgs");
-class GlobalVarsAsArgsHandler : public MatchFinder::MatchCallback {
+class GlobalVarsAsArgsHandler {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  GlobalVarsAsArgsHandler(Rewriter &rewrite) : rewriter(rewrite) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *call = Result.Nodes.getNodeAs<CallExpr>("globalVarsAsArgs");
-    const FunctionDecl *caller =
-        Result.Nodes.getNodeAs<FunctionDecl>("globalVarsAsArgsCaller");
+  GlobalVarsAsArgsHandler(TranslationUnitState &tu) : tu(tu) {}
 
+  void run(const CallExpr *call, const FunctionDecl *caller) {
     // find out if this is a call to a function which uses global vars
-    auto funcDecl = call->getDirectCallee();
+    auto funcName = call->getDirectCallee()->getNameAsString();
 
-    auto globalVarDeclsIt = funcToGlobalVars.find(funcDecl);
-    if (globalVarDeclsIt == funcToGlobalVars.end())
+    auto &programFacts = tu.context.programFacts;
+    auto globalVarDeclsIt = programFacts.funcToGlobalVars.find(funcName);
+    if (globalVarDeclsIt == programFacts.funcToGlobalVars.end())
       return;
 
     // add the global var as an argument
-    auto globalVars = globalVarDeclsIt->second;
+    auto &globalVars = globalVarDeclsIt->second;
     for (auto &var : globalVars) {
       std::string newArg;
 
       // find out if we added the global vars to the caller;
       // if we did, then do not add &, as they are already pointers
-      auto callerGlobalVars = funcToGlobalVars.find(caller);
-      if (callerGlobalVars == funcToGlobalVars.end()) {
-        if (!var->getType()->isArrayType())
+      if (!containsRefToGlobalVar(programFacts, caller->getNameAsString())) {
+        if (!findGlobalVar(programFacts, var)->isArray)
           newArg.append("&");
       }
 
-      newArg.append(var->getNameAsString());
+      newArg.append(var);
 
-      addNewArgument(call, newArg, &rewriter);
+      addNewArgument(tu, call, newArg);
     }
   }
 };
 
-// Add parameters to the declarations of all functions which use global
-// variables
-auto inputsAndResultsAsParamsMatcher =
-    functionDecl().bind("inputsAndResultsAsParams");
-class InputsAndResultsAsParamsHandler : public MatchFinder::MatchCallback {
+// Add parameters to the declarations of all functions which use inputs and
+// results
+class InputsAndResultsAsParamsHandler {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  InputsAndResultsAsParamsHandler(Rewriter &rewrite) : rewriter(rewrite) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    auto *decl =
-        Result.Nodes.getNodeAs<FunctionDecl>("inputsAndResultsAsParams");
+  InputsAndResultsAsParamsHandler(TranslationUnitState &tu) : tu(tu) {}
 
+  void run(const FunctionDecl *decl) {
     // do not add new parameters to "main"
     if (isMain(decl))
       return;
 
-    if (containsRefToInput(decl)) {
+    auto funcName = decl->getNameAsString();
+    auto &programFacts = tu.context.programFacts;
+    if (containsRefToInput(programFacts, funcName) &&
+        readsInputsInPlace(tu.context)) {
+      // the input in the buffer, and the inputs which are written to
+      std::string newParam = "__global const struct ";
+      newParam.append(structs_constants::INPUT);
+      newParam.append(" *input_gen");
+      addNewParam(tu, decl, newParam);
+      if (hasWrittenInputs(tu.context)) {
+        std::string newParam2 = "struct ";
+        newParam2.append(structs_constants::INPUT);
+        newParam2.append(" *input_rw");
+        addNewParam(tu, decl, newParam2);
+      }
+    } else if (containsRefToInput(programFacts, funcName)) {
       // add the input to the function's argument list
       std::string newParam;
       newParam.append("struct ");
-      newParam.append(structs_constants::INPUT);
+      newParam.append(hasInputView(tu.context.inputs,
+                                   tu.context.buffers.packedInputs)
+                          ? structs_constants::INPUT_VIEW
+                          : structs_constants::INPUT);
       newParam.append(" *input_gen");
-      addNewParam(decl, newParam, &rewriter);
+      addNewParam(tu, decl, newParam);
     }
 
-    if (containsRefToResult(decl)) {
+    if (containsRefToResult(programFacts, funcName)) {
       // add the result to the function's argument list
       std::string newParam;
-      newParam.append("__global struct");
+      if (!isResultPrivate(tu.context.buffers))
+        newParam.append("__global ");
+      newParam.append("struct ");
       newParam.append(structs_constants::RESULT);
       newParam.append(" *result_gen");
-      addNewParam(decl, newParam, &rewriter);
+      addNewParam(tu, decl, newParam);
 
       // if the result is printed char by char, add a pointer to the counter
-      for (auto &result : results) {
+      for (auto &result : tu.context.results) {
         if (isResultPrintedChatByChar(result)) {
           std::string newParam2;
           newParam2.append("int *res_count_gen");
-          addNewParam(decl, newParam2, &rewriter);
+          addNewParam(tu, decl, newParam2);
           break;
         }
       }
@@ -1105,54 +1721,58 @@ public:
 };
 
 // Add arguments to function calls which use inputs and results
-auto inputsAndResultsAsArgsMatcher =
-    callExpr(hasAncestor(functionDecl().bind("inputsAndResultsAsArgsCaller")))
-        .bind("inputsAndResultsAsArgs");
-class InputsAndResultsAsArgsHandler : public MatchFinder::MatchCallback {
+class InputsAndResultsAsArgsHandler {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
 
 public:
-  InputsAndResultsAsArgsHandler(Rewriter &rewrite) : rewriter(rewrite) {}
-
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *call =
-        Result.Nodes.getNodeAs<CallExpr>("inputsAndResultsAsArgs");
-    const FunctionDecl *caller =
-        Result.Nodes.getNodeAs<FunctionDecl>("inputsAndResultsAsArgsCaller");
+  InputsAndResultsAsArgsHandler(TranslationUnitState &tu) : tu(tu) {}
 
+  void run(const CallExpr *call, const FunctionDecl *caller) {
     // find out if this is a call to a function which inputs and results
-    auto funcDecl = call->getDirectCallee();
+    auto funcName = call->getDirectCallee()->getNameAsString();
 
-    if (isMain(funcDecl))
+    if (isMain(funcName))
       return;
 
     // handle inputs
-    if (containsRefToInput(funcDecl)) {
+    auto &programFacts = tu.context.programFacts;
+    if (containsRefToInput(programFacts, funcName)) {
       // if the caller is Main, then add '&', as input isn't a pointer
+      // (unless it is read in place)
+      bool isInPlace = readsInputsInPlace(tu.context);
       std::string newArg;
-      if (isMain(caller)) {
+      if (isMain(caller) && !isInPlace) {
         newArg.append("&");
       }
       newArg.append("input_gen");
-      addNewArgument(call, newArg, &rewriter);
+      addNewArgument(tu, call, newArg);
+
+      if (isInPlace && hasWrittenInputs(tu.context)) {
+        std::string newArg2;
+        if (isMain(caller)) {
+          newArg2.append("&");
+        }
+        newArg2.append("input_rw");
+        addNewArgument(tu, call, newArg2);
+      }
     }
 
-    if (containsRefToResult(funcDecl)) {
+    if (containsRefToResult(programFacts, funcName)) {
       // no need to add '&' in main, as result is a pointer
       std::string newArg;
       newArg.append("result_gen");
-      addNewArgument(call, newArg, &rewriter);
+      addNewArgument(tu, call, newArg);
 
       // if the result is printed char by char, add a pointer to the counter
-      for (auto &result : results) {
+      for (auto &result : tu.context.results) {
         if (isResultPrintedChatByChar(result)) {
           std::string newArg2;
           if (isMain(caller)) {
             newArg2.append("&");
           }
           newArg2.append("res_count_gen");
-          addNewArgument(call, newArg2, &rewriter);
+          addNewArgument(tu, call, newArg2);
         }
       }
     }
@@ -1160,28 +1780,24 @@ public:
 };
 
 // Handle tested values which are in function calls
-// auto functionToTestMatcher = callExpr(
-auto testedValueFunctionCallMatcher =
-    callExpr(callee(functionDecl())).bind("functionToTest");
-// class FunctionToTestHandler : public MatchFinder::MatchCallback
-class TestedValueFunctionCallHandler : public MatchFinder::MatchCallback {
+class TestedValueFunctionCallHandler {
 private:
-  Rewriter &rewriter;
+  TranslationUnitState &tu;
+  CountingRewriter &rewriter;
 
 public:
-  TestedValueFunctionCallHandler(Rewriter &rewrite) : rewriter(rewrite) {}
+  TestedValueFunctionCallHandler(TranslationUnitState &tu)
+      : tu(tu), rewriter(tu.rewriter) {}
 
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    for (auto &result : results) {
+  void run(const CallExpr *expr) {
+    for (auto &result : tu.context.results) {
       if (result.testedValue.type != TestedValueType::functionCall)
         break;
 
-      const CallExpr *expr = Result.Nodes.getNodeAs<CallExpr>("functionToTest");
-
       // find out if we are testing for a function call and this is a call to
       // the tested function
       auto name = expr->getDirectCallee()->getNameAsString();
-      auto resultDecl = results.front();
+      auto resultDecl = tu.context.results.front();
 
       if (name != result.testedValue.name)
         return;
@@ -1191,11 +1807,11 @@ public:
       if (result.testedValue.name == "fputc") {
         if (resultDecl.declaration.type != "char*" &&
             resultDecl.declaration.type != "char *") {
-          llvm::outs() << "The tested function is fputc, so the type of the "
-                          "result in the config file should be 'char *' and "
-                          "not '"
-                       << resultDecl.declaration.type
-                       << "'. Please change it.\n";
+          messages() << "The tested function is fputc, so the type of the "
+                        "result in the config file should be 'char *' and "
+                        "not '"
+                     << resultDecl.declaration.type
+                     << "'. Please change it.\n";
         }
 
         // get the first argument
@@ -1229,8 +1845,8 @@ public:
 
           // if the function uses global vars, we need to add them as arguments
           // to the call
-          auto globalVarArgsIt = funcCallToAddedArgs.find(expr);
-          if (globalVarArgsIt != funcCallToAddedArgs.end()) {
+          auto globalVarArgsIt = tu.funcCallToAddedArgs.find(expr);
+          if (globalVarArgsIt != tu.funcCallToAddedArgs.end()) {
             auto globalVars = globalVarArgsIt->second;
             for (auto var = globalVars.begin(); var != globalVars.end();
                  var++) {
@@ -1278,45 +1894,41 @@ public:
   }
 };
 
-auto includesMatcher = callExpr(callee(functionDecl())).bind("includes");
-class IncludesHandler : public MatchFinder::MatchCallback {
-public:
-  IncludesHandler() {}
+// Counts the matches of a handler, for the statistics
+class MatchCounter : public MatchFinder::MatchCallback {
+private:
+  MatchFinder::MatchCallback &handler;
 
-  virtual void run(const MatchFinder::MatchResult &Result) {
-    const CallExpr *expr = Result.Nodes.getNodeAs<CallExpr>("includes");
-    auto funcName = expr->getDirectCallee()->getNameAsString();
+public:
+  std::string handlerName;
+  unsigned count = 0;
 
-    auto headerName = functionToHeaderFile.find(funcName);
-    if (headerName == functionToHeaderFile.end())
-      return;
+  MatchCounter(const std::string &handlerName,
+               MatchFinder::MatchCallback &handler)
+      : handler(handler), handlerName(handlerName) {}
 
-    addInclude(headerName->second);
+  virtual void run(const MatchFinder::MatchResult &Result) {
+    count++;
+    handler.run(Result);
   }
 };
 
-/* AST Consumer */
-class KernelGenClassConsumer : public clang::ASTConsumer {
+/* Fact collection
+ * A single traversal of the AST collects the facts and does the rewrites which
+ * do not depend on other translation units.
+ */
+class KernelGenFactCollector {
 private:
-  MatchFinder argvMatchFinder;
-  MatchFinder ioMatchFinder;
-  MatchFinder variableLengthArraysMatchFinder;
-  MatchFinder discoverGlobalVarsMatchFinder;
-  MatchFinder rewriteGlobalVarsMatchFinder;
-  MatchFinder mainMatchFinder;
-  MatchFinder includesMatchFinder;
-
-  // Handlers (in the order we run the matchers in)
+  MatchFinder factsMatchFinder;
+  std::list<MatchCounter> matchCounters;
+
+  // Handlers (in the order we register the matchers in)
   // argv
   ArgvInAtoiHandler argvInAtoiHandler;
   ArgvHandler argvHandler;
 
-  // stdin
-  StdinHandler stdinHandler;
-  ScanfHandler scanfHandler;
-
-  // I/O
-  CommentOutHandler commentOutHandler;
+  // calls: I/O, callers, results, tested values and includes
+  CallSiteHandler callSiteHandler;
 
   // variable length arrays
   VariableLengthArraysHandler variableLengthArraysHandler;
@@ -1324,195 +1936,505 @@ private:
   // global vars
   GlobalVarHandler globalVarHandler;
   GlobalVarUseHandler globalVarUseHandler;
-  CalleeToCallerHandler calleeToCallerHandler;
+  InputUseHandler inputUseHandler;
+
+  // stdin
   InputsHandler inputsHandler;
-  ResultsHandler resultsHandler;
-  InputsAndResultsAsParamsHandler inputsAndResultsAsParamsHandler;
-  InputsAndResultsAsArgsHandler inputsAndResultsAsArgsHandler;
+  StdinHandler stdinHandler;
+  ScanfHandler scanfHandler;
+
+  // functions and main
+  FunctionDeclHandler functionDeclHandler;
+  ReturnInMainHandler returnInMainHandler;
+
+  // typedef bool
+  TypedefBoolHandler typedefBoolHandler;
+
+public:
+  KernelGenFactCollector(TranslationUnitState &tu)
+      : argvInAtoiHandler(tu), argvHandler(tu), callSiteHandler(tu),
+        variableLengthArraysHandler(tu), globalVarHandler(tu),
+        globalVarUseHandler(tu), inputUseHandler(tu), inputsHandler(tu),
+        stdinHandler(tu), scanfHandler(tu), functionDeclHandler(tu),
+        returnInMainHandler(tu), typedefBoolHandler(tu) {
+
+    addMatcher(argvInAtoiMatcher, "ArgvInAtoiHandler", argvInAtoiHandler);
+    addMatcher(argvMatcher, "ArgvHandler", argvHandler);
+    addMatcher(callSiteMatcher, "CallSiteHandler", callSiteHandler);
+    addMatcher(variableLengthArraysMatcher, "VariableLengthArraysHandler",
+               variableLengthArraysHandler);
+    addMatcher(globalVarMatcher, "GlobalVarHandler", globalVarHandler);
+    addMatcher(globalVarUseMatcher, "GlobalVarUseHandler", globalVarUseHandler);
+    addMatcher(inputUseMatcher, "InputUseHandler", inputUseHandler);
+    addMatcher(inputsMatcher, "InputsHandler", inputsHandler);
+    addMatcher(stdinMatcher, "StdinHandler", stdinHandler);
+    addMatcher(scanfMatcher, "ScanfHandler", scanfHandler);
+    addMatcher(functionDeclMatcher, "FunctionDeclHandler", functionDeclHandler);
+    addMatcher(returnInMainMatcher, "ReturnInMainHandler", returnInMainHandler);
+    addMatcher(typedefBoolMatcher, "TypedefBoolHandler", typedefBoolHandler);
+  }
+
+  void collect(ASTContext &Context) {
+    factsMatchFinder.matchAST(Context);
+
+    for (auto &matchCounter : matchCounters)
+      addMatchCount(matchCounter.handlerName, matchCounter.count);
+  }
+
+private:
+  template <typename T>
+  void addMatcher(const T &matcher, const std::string &handlerName,
+                  MatchFinder::MatchCallback &handler) {
+    matchCounters.emplace_back(handlerName, handler);
+    factsMatchFinder.addMatcher(matcher, &matchCounters.back());
+  }
+};
+
+/* Rewriting
+ * Rewrites a translation unit from its own facts and the facts of the program.
+ */
+class KernelGenRewriter {
+private:
+  TranslationUnitState &tu;
+
+  // global vars and stdin
+  GlobalVarDeclRewriter globalVarDeclRewriter;
+  GlobalVarUseRewriter globalVarUseRewriter;
+  StdinRewriter stdinRewriter;
+  ScanfRewriter scanfRewriter;
+
+  // global vars, inputs and results
   GlobalVarsAsParamsHandler globalVarsAsParamsHandler;
+  InputsAndResultsAsParamsHandler inputsAndResultsAsParamsHandler;
   GlobalVarsAsArgsHandler globalVarsAsArgsHandler;
+  InputsAndResultsAsArgsHandler inputsAndResultsAsArgsHandler;
 
   // result
   TestedValueFunctionCallHandler testedValueFunctionCallHandler;
 
   // main
   MainHandler mainHandler;
-  ReturnInMainHandler returnInMainHandler;
-
-  // includes
-  IncludesHandler includesHandler;
 
 public:
-  KernelGenClassConsumer(Rewriter &R)
-      : argvInAtoiHandler(R), argvHandler(R), stdinHandler(R), scanfHandler(R),
-        commentOutHandler(R), variableLengthArraysHandler(R),
-        globalVarHandler(R), globalVarUseHandler(R), calleeToCallerHandler(),
-        inputsHandler(), resultsHandler(), inputsAndResultsAsParamsHandler(R),
-        inputsAndResultsAsArgsHandler(R), globalVarsAsParamsHandler(R),
-        globalVarsAsArgsHandler(R), testedValueFunctionCallHandler(R),
-        mainHandler(R), returnInMainHandler(R), includesHandler() {
-
-    argvMatchFinder.addMatcher(argvInAtoiMatcher, &argvInAtoiHandler);
-    argvMatchFinder.addMatcher(argvMatcher, &argvHandler);
-
-    ioMatchFinder.addMatcher(commentOutMatcher, &commentOutHandler);
-
-    variableLengthArraysMatchFinder.addMatcher(variableLengthArraysMatcher,
-                                               &variableLengthArraysHandler);
-
-    discoverGlobalVarsMatchFinder.addMatcher(globalVarMatcher,
-                                             &globalVarHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(globalVarUseMatcher,
-                                             &globalVarUseHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(calleeToCallerMatcher,
-                                             &calleeToCallerHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(inputsMatcher, &inputsHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(resultsMatcher, &resultsHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(stdinMatcher, &stdinHandler);
-    discoverGlobalVarsMatchFinder.addMatcher(scanfMatcher, &scanfHandler);
-
-    rewriteGlobalVarsMatchFinder.addMatcher(globalVarsAsParamsMatcher,
-                                            &globalVarsAsParamsHandler);
-    rewriteGlobalVarsMatchFinder.addMatcher(globalVarsAsArgsMatcher,
-                                            &globalVarsAsArgsHandler);
-    rewriteGlobalVarsMatchFinder.addMatcher(inputsAndResultsAsParamsMatcher,
-                                            &inputsAndResultsAsParamsHandler);
-    rewriteGlobalVarsMatchFinder.addMatcher(inputsAndResultsAsArgsMatcher,
-                                            &inputsAndResultsAsArgsHandler);
-
-    mainMatchFinder.addMatcher(testedValueFunctionCallMatcher,
-                               &testedValueFunctionCallHandler);
-    mainMatchFinder.addMatcher(mainMatcher, &mainHandler);
-    mainMatchFinder.addMatcher(returnInMainMatcher, &returnInMainHandler);
-
-    includesMatchFinder.addMatcher(includesMatcher, &includesHandler);
-  }
-
-  void HandleTranslationUnit(ASTContext &Context) override {
-    argvMatchFinder.matchAST(Context);
-    ioMatchFinder.matchAST(Context);
-    variableLengthArraysMatchFinder.matchAST(Context);
-    discoverGlobalVarsMatchFinder.matchAST(Context);
-
-    findAllFunctionsWhichUseSpecialVars();
-
-    rewriteGlobalVarsMatchFinder.matchAST(Context);
-    mainMatchFinder.matchAST(Context);
-    includesMatchFinder.matchAST(Context);
+  KernelGenRewriter(TranslationUnitState &tu)
+      : tu(tu), globalVarDeclRewriter(tu), globalVarUseRewriter(tu),
+        stdinRewriter(tu), scanfRewriter(tu), globalVarsAsParamsHandler(tu),
+        inputsAndResultsAsParamsHandler(tu), globalVarsAsArgsHandler(tu),
+        inputsAndResultsAsArgsHandler(tu), testedValueFunctionCallHandler(tu),
+        mainHandler(tu) {}
+
+  void rewrite() {
+    rewriteGlobalVarUsesAndStdin();
+    rewriteParamsAndArgs();
+    rewriteTestedValueCalls();
+    rewriteMain();
   }
-};
 
-/* Frontend Action
- * NB: A new FrontEndAction will be created for each source file
- */
-class KernelGenClassAction : public clang::ASTFrontendAction {
 private:
-  Rewriter rewriter;
+  void rewriteGlobalVarUsesAndStdin() {
+    for (auto decl : tu.globalVarDecls)
+      globalVarDeclRewriter.run(decl);
+
+    for (auto &globalVarUse : tu.globalVarUses)
+      globalVarUseRewriter.run(globalVarUse);
+
+    for (auto &stdinUse : tu.stdinUses) {
+      if (stdinUse.stdinArg)
+        stdinRewriter.run(stdinUse);
+      else
+        scanfRewriter.run(stdinUse);
+    }
+  }
 
-public:
-  // Write results in a new file
-  void EndSourceFileAction() override {
+  // add global vars, inputs and results to function declarations and calls
+  void rewriteParamsAndArgs() {
+    for (auto decl : tu.functionDecls) {
+      globalVarsAsParamsHandler.run(decl);
+      inputsAndResultsAsParamsHandler.run(decl);
 
-    auto filename = getCurrentFile().rsplit('/').second;
-    auto &sourceMgr = rewriter.getSourceMgr();
+      auto factsIt = tu.functionFacts.find(decl);
+      if (factsIt == tu.functionFacts.end())
+        continue;
 
-    // get the rewritebuffer and declare source for the current file
-    std::string rewriteBuffer;
-    std::string source;
-    auto buffer = rewriter.getRewriteBufferFor(sourceMgr.getMainFileID());
-    if (buffer == NULL) { // Rewrite buffer is null. No modification for file
-                          // the current file."
-      rewriteBuffer = sourceMgr.getBufferData(sourceMgr.getMainFileID());
-    } else {
-      rewriteBuffer = std::string(buffer->begin(), buffer->end());
+      for (auto call : factsIt->second.callSites) {
+        globalVarsAsArgsHandler.run(call, decl);
+        inputsAndResultsAsArgsHandler.run(call, decl);
+      }
     }
+  }
 
-    // if file ends in .c, change to .cl
-    auto filenameStr = filename.str();
-    if (filename.endswith(".c")) {
-      filename = filename.rsplit('.').first;
-      filenameStr = filename.str() + ".cl";
+  // tested values have to be rewritten after the arguments are added
+  void rewriteTestedValueCalls() {
+    for (auto decl : tu.functionDecls) {
+      auto factsIt = tu.functionFacts.find(decl);
+      if (factsIt == tu.functionFacts.end())
+        continue;
+
+      for (auto call : factsIt->second.testedValueCalls)
+        testedValueFunctionCallHandler.run(call);
     }
+  }
 
-    // if this is the main file, change to main.cl
-    if (isMainFile) {
-      isMainFile = false;
-
-      filenameStr = "main.cl";
-
-      // include for 'structs.h' and special headers
-      source = "#include \"";
-      source.append(filename_constants::STRUCTS_FILENAME);
-      source.append("\"\n");
-      for (auto inc = includesToAdd.begin(); inc != includesToAdd.end();
-           inc++) {
-        source.append("#include \"");
-        source.append(*inc);
-        source.append("\"\n");
-      }
+  void rewriteMain() {
+    for (auto decl : tu.functionDecls) {
+      if (isMain(decl))
+        mainHandler.run(decl);
     }
+  }
+};
 
-    // comment out includes and typedef bool
-    std::string line;
-    std::istringstream bufferStream(rewriteBuffer);
-    while (getline(bufferStream, line)) {
-      std::istringstream iss(line);
-      std::string token1, token2;
-      iss >> token1;
-      iss >> token2;
-
-      // includes (only for system headers)
-      if (token1.find("#include") != std::string::npos ||
-          token2.find("include") != std::string::npos) {
-        if (line.find("<") != std::string::npos)
-          source.append("//");
-      }
+/* Phases of the kernel generation
+ * Every phase except merging the facts runs on each translation unit
+ * independently, so it can be run in parallel.
+ */
+void parseTranslationUnit(const CompilationDatabase &compilations,
+                          const PrecompiledHeader &pch,
+                          TranslationUnitState &tu) {
+  llvm::sys::fs::file_status status;
+  if (!llvm::sys::fs::status(tu.filename, status))
+    tu.parseTime = llvm::sys::toTimeT(status.getLastModificationTime());
+
+  // the system includes are found in the preprocessing record
+  auto recordAdjuster = getInsertArgumentAdjuster(
+      CommandLineArguments{"-Xclang", "-detailed-preprocessing-record"},
+      ArgumentInsertPosition::BEGIN);
+
+  std::vector<std::unique_ptr<ASTUnit>> asts;
+  bool failedWithPch = false;
+  if (pch.filename != "" && pch.sources.count(tu.filename)) {
+    ClangTool tool(compilations, tu.filename);
+    tool.appendArgumentsAdjuster(recordAdjuster);
+    tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
+        CommandLineArguments{"-include-pch", pch.filename},
+        ArgumentInsertPosition::BEGIN));
+    tool.buildASTs(asts);
+
+    // the precompiled header may be out of date; parse the headers instead
+    if (asts.empty() || !asts.front() ||
+        asts.front()->getDiagnostics().hasErrorOccurred()) {
+      failedWithPch = true;
+      asts.clear();
+    }
+  }
+
+  if (asts.empty()) {
+    ClangTool tool(compilations, tu.filename);
+    tool.appendArgumentsAdjuster(recordAdjuster);
+    tool.buildASTs(asts);
+
+    // if it was the precompiled header which failed, build it again next time
+    if (failedWithPch && !asts.empty() && asts.front() &&
+        !asts.front()->getDiagnostics().hasErrorOccurred()) {
+      llvm::errs() << "The precompiled header could not be used for "
+                   << tu.filename << "; it will be built again.\n";
+      invalidatePrecompiledHeader(pch);
+    }
+  }
+
+  if (asts.empty() || !asts.front()) {
+    llvm::errs() << "Failed to parse " << tu.filename << ".\n";
+    return;
+  }
+
+  tu.ast = std::move(asts.front());
+  tu.rewriter.setSourceMgr(tu.ast->getSourceManager(), tu.ast->getLangOpts());
+}
+
+// Returns true if a file which the translation unit was parsed from (the
+// source or any header it includes) changed since then
+bool isOutOfDate(const TranslationUnitState &tu) {
+  // if it failed to parse, only try again when the source changes
+  if (!tu.ast) {
+    llvm::sys::fs::file_status status;
+    return llvm::sys::fs::status(tu.filename, status) ||
+           llvm::sys::toTimeT(status.getLastModificationTime()) != tu.parseTime;
+  }
+
+  auto &sourceMgr = tu.ast->getSourceManager();
+  for (auto file = sourceMgr.fileinfo_begin(); file != sourceMgr.fileinfo_end();
+       file++) {
+    const FileEntry *entry = file->first;
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(entry->getName(), status))
+      return true;
 
-      // typedef bool
-      if (token1.find("typedef") != std::string::npos) {
-        std::string token3;
-        iss >> token3;
-        if (token3.find("bool") != std::string::npos)
-          source.append("//");
+    if (llvm::sys::toTimeT(status.getLastModificationTime()) !=
+            entry->getModificationTime() ||
+        status.getSize() != (uint64_t)entry->getSize())
+      return true;
+  }
+
+  return false;
+}
+
+// Returns a new state for the translation unit, which reuses its AST if none
+// of its files changed since it was parsed; the facts and rewrites of the
+// previous generation are dropped
+std::shared_ptr<TranslationUnitState>
+reuseTranslationUnit(CodeGenContext &context, const std::string &source) {
+  auto tu = std::make_shared<TranslationUnitState>(context, source);
+
+  for (auto &previous : context.translationUnits) {
+    if (previous->filename != source || !previous->ast ||
+        isOutOfDate(*previous))
+      continue;
+
+    tu->ast = std::move(previous->ast);
+    tu->rewriter.setSourceMgr(tu->ast->getSourceManager(),
+                              tu->ast->getLangOpts());
+    break;
+  }
+
+  return tu;
+}
+
+bool haveKernelSourcesChanged(const CodeGenContext &context) {
+  if (context.translationUnits.empty())
+    return true;
+
+  for (auto &tu : context.translationUnits) {
+    if (isOutOfDate(*tu))
+      return true;
+  }
+
+  return false;
+}
+
+void collectFacts(TranslationUnitState &tu) {
+  KernelGenFactCollector collector(tu);
+  collector.collect(tu.ast->getASTContext());
+  commentOutSystemIncludes(tu);
+}
+
+// merge the facts of all translation units and propagate them through the
+// call graph
+int mergeAndPropagateFacts(
+    CodeGenContext &context,
+    std::vector<std::shared_ptr<TranslationUnitState>> &tus) {
+  auto &programFacts = context.programFacts;
+  programFacts = ProgramFacts();
+  int status = status_constants::SUCCESS;
+  for (auto &tu : tus) {
+    if (tu->ast &&
+        mergeFacts(programFacts, tu->facts) != status_constants::SUCCESS)
+      status = status_constants::FAIL;
+  }
+  if (status != status_constants::SUCCESS)
+    return status;
+
+  // uses of global vars declared in any translation unit
+  for (auto &tu : tus) {
+    for (auto &globalVarUse : tu->globalVarUses) {
+      auto varName = globalVarUse.expr->getDecl()->getNameAsString();
+      if (isGlobalVar(programFacts, varName) &&
+          !isConstantGlobalVar(programFacts, varName))
+        addGlobalVarToFunction(programFacts, globalVarUse.function, varName);
+    }
+  }
+
+  // assign stdin inputs to reads from stdin, in order
+  auto stdinInput = context.stdinInputs.begin();
+  for (auto &tu : tus) {
+    for (auto &stdinUse : tu->stdinUses) {
+      if (stdinInput == context.stdinInputs.end()) {
+        messages() << "There are fewer stdin parameters supplied than there "
+                      "are references to stdin in the code.\n";
+        continue;
       }
 
-      source.append(line);
-      source.append("\n");
+      stdinUse.inputName = stdinInput->name;
+      stdinInput++;
+    }
+  }
+
+  findAllFunctionsWhichUseSpecialVars(programFacts);
+  return status_constants::SUCCESS;
+}
+
+void rewriteTranslationUnit(TranslationUnitState &tu) {
+  KernelGenRewriter rewriter(tu);
+  rewriter.rewrite();
+}
+
+// Write results in a new file, streaming them straight from the rewrite
+// buffer; includes and typedef bool were already commented out by rewrites
+void writeTranslationUnit(TranslationUnitState &tu) {
+  auto filename = llvm::StringRef(tu.filename).rsplit('/').second;
+  if (filename.empty())
+    filename = tu.filename;
+  auto &sourceMgr = tu.rewriter.getSourceMgr();
+  auto mainFileID = sourceMgr.getMainFileID();
+
+  // if file ends in .c, change to .cl
+  auto filenameStr = filename.str();
+  if (filename.endswith(".c")) {
+    filename = filename.rsplit('.').first;
+    filenameStr = filename.str() + ".cl";
+  }
+
+  // if this is the main file, change to main.cl
+  if (tu.isMainFile)
+    filenameStr = "main.cl";
+
+  uint64_t bytes = 0;
+  auto outputFile = tu.context.outputDirectory + "/" + filenameStr;
+  writeFileIfChanged(outputFile, [&](llvm::raw_ostream &os) {
+    // include for 'structs.h' and special headers
+    if (tu.isMainFile) {
+      os << "#include \"" << filename_constants::STRUCTS_FILENAME << "\"\n";
+      for (auto &include : tu.context.programFacts.includesToAdd)
+        os << "#include \"" << include << "\"\n";
     }
 
-    // Write into file
-    auto outputFile = testClOutputDirectory + "/" + filenameStr;
-    std::ofstream clFile;
-    clFile.open(outputFile);
-    clFile << source;
-    clFile.close();
+    auto buffer = tu.rewriter.getRewriteBufferFor(mainFileID);
+    if (buffer == NULL) // no modification for the current file
+      os << sourceMgr.getBufferData(mainFileID);
+    else
+      buffer->write(os);
+
+    bytes = os.tell();
+  });
+
+  addOutputFile(outputFile, bytes, tu.rewriter.rewrites);
+  tu.outputFilename = filenameStr;
+}
+
+// runs a phase on every parsed translation unit, using up to `jobs` threads,
+// and times it for each of them
+void forEachTranslationUnit(
+    std::vector<std::shared_ptr<TranslationUnitState>> &tus, unsigned jobs,
+    const std::string &phaseName,
+    std::function<void(TranslationUnitState &)> phase) {
+  auto timedPhase = [&phaseName, &phase](TranslationUnitState &tu) {
+    PhaseTimer timer(phaseName, tu.filename);
+    phase(tu);
+  };
+
+  if (jobs <= 1 || tus.size() <= 1) {
+    for (auto &tu : tus) {
+      if (tu->ast)
+        timedPhase(*tu);
+    }
+    return;
   }
 
-  virtual std::unique_ptr<ASTConsumer>
-  CreateASTConsumer(CompilerInstance &Compiler, StringRef InFile) override {
-    rewriter.setSourceMgr(Compiler.getSourceManager(), Compiler.getLangOpts());
-    return llvm::make_unique<KernelGenClassConsumer>(rewriter);
+  llvm::ThreadPool pool(std::min<unsigned>(jobs, tus.size()));
+  for (auto &tu : tus) {
+    if (!tu->ast)
+      continue;
+
+    TranslationUnitState *tuPtr = tu.get();
+    pool.async([&timedPhase, tuPtr] { timedPhase(*tuPtr); });
   }
-};
+  pool.wait();
+}
+
+int generateKernel(CodeGenContext &context,
+                   const CompilationDatabase &compilations,
+                   const std::vector<std::string> &sources) {
+  messages() << "Generating kernel code... ";
+
+  unsigned jobs = context.jobs;
+  if (jobs == 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  // reuse the translation units of the previous generation which did not
+  // change, and parse the rest
+  std::vector<std::shared_ptr<TranslationUnitState>> tus;
+  std::vector<TranslationUnitState *> tusToParse;
+  for (auto &source : sources) {
+    auto tu = reuseTranslationUnit(context, source);
+    if (!tu->ast)
+      tusToParse.push_back(tu.get());
+    tus.push_back(tu);
+  }
+  context.translationUnits.clear();
+
+  // share the parsed system headers between translation units and runs
+  PrecompiledHeader pch;
+  if (!tusToParse.empty() && context.pchDirectory != "") {
+    PhaseTimer timer("kernel: precompile headers");
+    std::vector<std::string> sourcesToParse;
+    for (auto tu : tusToParse)
+      sourcesToParse.push_back(tu->filename);
+    pch = getPrecompiledHeader(compilations, sourcesToParse,
+                               context.pchDirectory);
+  }
+
+  {
+    PhaseTimer timer("kernel: parse");
+    llvm::ThreadPool pool(
+        std::max(1u, std::min<unsigned>(jobs, tusToParse.size())));
+    for (auto tu : tusToParse) {
+      pool.async([&compilations, &pch, tu] {
+        PhaseTimer timer("kernel: parse", tu->filename);
+        parseTranslationUnit(compilations, pch, *tu);
+      });
+    }
+    pool.wait();
+  }
+  context.dependencies.insert(pch.dependencies.begin(),
+                              pch.dependencies.end());
+
+  int status = status_constants::SUCCESS;
+  uint64_t sourceBytes = 0;
+  uint64_t parsedBytes = 0;
+  for (auto &tu : tus) {
+    if (!tu->ast) {
+      status = status_constants::FAIL;
+      continue;
+    }
+
+    auto &sourceMgr = tu->ast->getSourceManager();
+    auto bytes = sourceMgr.getBufferData(sourceMgr.getMainFileID()).size();
+    sourceBytes += bytes;
+    if (find(tusToParse.begin(), tusToParse.end(), tu.get()) !=
+        tusToParse.end())
+      parsedBytes += bytes;
+  }
+  addPhaseBytes("kernel: parse", parsedBytes);
+  addPhaseBytes("kernel: collect facts", sourceBytes);
+
+  {
+    PhaseTimer timer("kernel: collect facts");
+    forEachTranslationUnit(tus, jobs, "kernel: collect facts", collectFacts);
+  }
+
+  {
+    PhaseTimer timer("kernel: propagate facts");
+    if (mergeAndPropagateFacts(context, tus) != status_constants::SUCCESS)
+      return status_constants::FAIL;
+  }
+
+  {
+    PhaseTimer timer("kernel: rewrite");
+    forEachTranslationUnit(tus, jobs, "kernel: rewrite",
+                           rewriteTranslationUnit);
+  }
+
+  {
+    PhaseTimer timer("kernel: write");
+    forEachTranslationUnit(tus, jobs, "kernel: write", writeTranslationUnit);
+  }
+
+  // record the files written and the files they were generated from
+  for (auto &tu : tus) {
+    if (!tu->ast)
+      continue;
+
+    if (tu->outputFilename != "")
+      context.outputFiles.insert(tu->outputFilename);
+
+    auto &sourceMgr = tu->ast->getSourceManager();
+    for (auto file = sourceMgr.fileinfo_begin();
+         file != sourceMgr.fileinfo_end(); file++)
+      context.dependencies.insert(file->first->getName());
+  }
+
+  if (context.keepTranslationUnits)
+    context.translationUnits = tus;
 
-void generateKernel(ClangTool *_tool, std::string outputDirectory,
-                    std::map<int, std::string> _argvIdxToInput,
-                    std::list<struct Declaration> _inputs,
-                    std::list<struct Declaration> _stdinInputs,
-                    std::list<struct ResultDeclaration> _results) {
-  llvm::outs() << "Generating kernel code... ";
-
-  // set global scope variables
-  testClOutputDirectory = outputDirectory;
-  argvIdxToInput = _argvIdxToInput;
-  inputs = _inputs;
-  stdinInputs = _stdinInputs;
-  results = _results;
-
-  // generate the kernel code
-  Rewriter rewriter;
-  _tool->run(newFrontendActionFactory<KernelGenClassAction>().get());
-
-  llvm::outs() << "DONE!\n";
-  llvm::outs() << "Finished!\n";
+  messages() << "DONE!\n";
+  messages() << "Finished!\n";
+  return status;
 }
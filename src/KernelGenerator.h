@@ -17,13 +17,21 @@
 #ifndef KERNEL_GENERATOR_H
 #define KERNEL_GENERATOR_H
 
-#include "Utils.h"
-#include "clang/Tooling/Tooling.h"
+#include "CodeGenContext.h"
+#include "clang/Tooling/CompilationDatabase.h"
 #include <string>
+#include <vector>
 
-void generateKernel(clang::tooling::ClangTool *, std::string,
-                    std::map<int, std::string>, std::list<struct Declaration>,
-                    std::list<struct Declaration>,
-                    std::list<struct ResultDeclaration>);
+// Generates the kernel from the given sources, using the configuration in the
+// context. The translation units are processed by up to context.jobs threads.
+// Translation units kept in the context are reused, unless their files changed.
+// Returns status_constants::SUCCESS or status_constants::FAIL.
+int generateKernel(CodeGenContext &,
+                   const clang::tooling::CompilationDatabase &,
+                   const std::vector<std::string> &);
+
+// Returns true if any file used by the kernel changed since it was generated.
+// Always true unless the context keeps its translation units.
+bool haveKernelSourcesChanged(const CodeGenContext &);
 
 #endif
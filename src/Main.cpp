@@ -14,10 +14,11 @@
  * limitations under the License.
  */
 
-#include "ConfigParser.h"
+#include "BatchGenerator.h"
+#include "CodeGenContext.h"
+#include "CodeGenerator.h"
 #include "Constants.h"
-#include "CpuCodeGenerator.h"
-#include "KernelGenerator.h"
+#include "Timing.h"
 #include "Utils.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
@@ -26,55 +27,366 @@
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 static llvm::cl::OptionCategory MscToolCategory("kernel-gen options");
 static llvm::cl::extrahelp
     CommonHelp(clang::tooling::CommonOptionsParser::HelpMessage);
 
-// ParTeCL-CodeGen requires the following command line options:
+// ParTeCL-CodeGen requires the following command line options, unless it
+// is given a manifest:
 //  config filename
 //  output directory
 static llvm::cl::opt<std::string>
     ConfigFilename("config", llvm::cl::desc("Specify config filename"),
-                   llvm::cl::value_desc("filename"), llvm::cl::Required);
+                   llvm::cl::value_desc("filename"));
 static llvm::cl::opt<std::string>
     OutputDir("output", llvm::cl::desc("Specify output directory"),
-              llvm::cl::value_desc("dir"), llvm::cl::Required);
+              llvm::cl::value_desc("dir"));
 
-int main(int argc, const char **argv) {
-  clang::tooling::CommonOptionsParser OptionsParser(argc, argv,
-                                                    MscToolCategory);
-
-  std::map<int, std::string> argvIdxToInput;
-  std::list<struct Declaration> stdinInputs;
-  std::list<struct Declaration> inputDeclarations;
-  std::list<struct ResultDeclaration> resultDeclarations;
-  std::list<std::string> includes;
-
-  // parse the configuration file
-  if (parseConfig(ConfigFilename, argvIdxToInput, stdinInputs,
-                  inputDeclarations, resultDeclarations,
-                  includes) == status_constants::FAIL) {
-    llvm::outs() << "\nFailed to parse the configuration file "
-                 << ConfigFilename << ". \nTERMINATING!\n";
+// Optional command line options
+static llvm::cl::opt<bool> TimePhases(
+    "time-phases",
+    llvm::cl::desc("Print the time spent in each code generation phase, "
+                   "together with other statistics"));
+static llvm::cl::opt<std::string> StatsJson(
+    "stats-json",
+    llvm::cl::desc("Write the time spent in each code generation phase, "
+                   "together with other statistics, as JSON"),
+    llvm::cl::value_desc("filename"));
+static llvm::cl::opt<unsigned>
+    Jobs("j",
+         llvm::cl::desc("Number of translation units to process in parallel "
+                        "(0 uses all hardware threads)"),
+         llvm::cl::value_desc("N"), llvm::cl::init(1));
+static llvm::cl::opt<bool> NoCache(
+    "no-cache",
+    llvm::cl::desc("Do not reuse the code generated by earlier runs, and do "
+                   "not cache the generated code"));
+static llvm::cl::opt<std::string> PchDir(
+    "pch-dir",
+    llvm::cl::desc("Directory in which to cache the precompiled system "
+                   "headers (default: partecl-codegen-pch in the system temp "
+                   "directory)"),
+    llvm::cl::value_desc("dir"));
+static llvm::cl::opt<bool>
+    NoPch("no-pch", llvm::cl::desc("Parse the system headers with every "
+                                   "source, instead of precompiling them"));
+static llvm::cl::opt<bool>
+    Watch("watch", llvm::cl::desc("Keep running and regenerate the code "
+                                  "whenever the sources or the config change"));
+static llvm::cl::opt<unsigned> WatchInterval(
+    "watch-interval",
+    llvm::cl::desc("How often to check for changes in watch mode"),
+    llvm::cl::value_desc("milliseconds"), llvm::cl::init(500));
+static llvm::cl::opt<std::string> Manifest(
+    "manifest",
+    llvm::cl::desc("Generate the code for all programs in the manifest, one "
+                   "per line: <config file> <output directory> <source file> "
+                   "[<source file> ...]; -j is then the number of programs "
+                   "to generate in parallel"),
+    llvm::cl::value_desc("filename"));
+static llvm::cl::opt<BufferLayout> Layout(
+    "layout",
+    llvm::cl::desc("Layout of the test inputs and results in the buffers "
+                   "passed to the kernel:"),
+    llvm::cl::values(
+        clEnumValN(BufferLayout::arrayOfStructs, "aos",
+                   "an array of structs, one per test case (default)"),
+        clEnumValN(BufferLayout::structOfArrays, "soa",
+                   "a struct of arrays, one per field, so that the work-items "
+                   "read and write adjacent elements")),
+    llvm::cl::init(BufferLayout::arrayOfStructs));
+static llvm::cl::opt<BufferLayout> InputLayout(
+    "input-layout",
+    llvm::cl::desc("Layout of the test inputs, overriding -layout:"),
+    llvm::cl::values(clEnumValN(BufferLayout::arrayOfStructs, "aos",
+                                "an array of structs"),
+                     clEnumValN(BufferLayout::structOfArrays, "soa",
+                                "a struct of arrays")));
+static llvm::cl::opt<BufferLayout> ResultLayout(
+    "result-layout",
+    llvm::cl::desc("Layout of the test results, overriding -layout:"),
+    llvm::cl::values(clEnumValN(BufferLayout::arrayOfStructs, "aos",
+                                "an array of structs"),
+                     clEnumValN(BufferLayout::structOfArrays, "soa",
+                                "a struct of arrays")));
+static llvm::cl::opt<bool> PackedInputs(
+    "packed-inputs",
+    llvm::cl::desc("Pass the inputs which are strings or arrays of variable "
+                   "size to the kernel in a single buffer, one after the "
+                   "other, instead of in arrays of fixed size"));
+static llvm::cl::opt<bool> GlobalInputs(
+    "global-inputs",
+    llvm::cl::desc("Read the inputs in place through a __global const "
+                   "pointer, copying only the ones the program writes to into "
+                   "private memory (array of structs inputs only)"));
+static llvm::cl::opt<bool> CompareOnDevice(
+    "compare-on-device",
+    llvm::cl::desc("Also generate a kernel which compares the results with "
+                   "the expected ones on the device, and marks the failures "
+                   "in a bitmap and a list"));
+static llvm::cl::opt<bool> CompactResults(
+    "compact-results",
+    llvm::cl::desc("Compare the results with the expected ones at the end of "
+                   "the kernel, and write only the failing ones to the "
+                   "results buffer, one after the other (array of structs "
+                   "results only)"));
+static llvm::cl::opt<bool> HostArena(
+    "host-arena",
+    llvm::cl::desc("Copy the inputs which are strings into an arena given to "
+                   "populate_inputs, which is reset once per batch of test "
+                   "cases, instead of allocating each of them"));
+static llvm::cl::opt<bool> BinaryTests(
+    "binary-tests",
+    llvm::cl::desc("Also generate a tool which compiles a tests file into "
+                   "ready-made partecl_input records, and a loader which maps "
+                   "them into memory (array of structs inputs only)"));
+static llvm::cl::opt<bool> TestsParser(
+    "tests-parser",
+    llvm::cl::desc("Also generate a parser which reads tests files straight "
+                   "into partecl_input records, in chunks (array of structs "
+                   "inputs only)"));
+static llvm::cl::opt<bool> ParallelTests(
+    "parallel-tests",
+    llvm::cl::desc("Also generate populate_inputs_parallel, which parses a "
+                   "tests file on several threads (implies -tests-parser)"));
+static llvm::cl::opt<bool> HostDriver(
+    "host-driver",
+    llvm::cl::desc("Also generate host-gen.c, which runs a tests file through "
+                   "the kernel in batches, parsing, copying and running "
+                   "different batches at the same time, and prints the "
+                   "failures (implies -tests-parser, and -compare-on-device "
+                   "unless -compact-results is given)"));
+static llvm::cl::opt<bool> AbiSafeLayout(
+    "abi-safe-layout",
+    llvm::cl::desc("Store the inputs and the results in fixed width types, "
+                   "ordered to avoid padding, and check in structs.h that the "
+                   "host and the device lay them out the same way"));
+static llvm::cl::opt<std::string> Tests(
+    "tests",
+    llvm::cl::desc("Size the strings and the arrays of variable size in the "
+                   "inputs for the longest ones in this tests file, instead "
+                   "of giving them 500 elements"),
+    llvm::cl::value_desc("filename"));
+static llvm::cl::opt<unsigned> TestsAlignment(
+    "tests-alignment",
+    llvm::cl::desc("With -tests, round the sizes up to a multiple of this "
+                   "many bytes"),
+    llvm::cl::value_desc("bytes"), llvm::cl::init(16));
+static llvm::cl::opt<bool> NarrowInputs(
+    "narrow-inputs",
+    llvm::cl::desc("With -tests, store the integer inputs in the narrowest "
+                   "type which holds all their values in the tests file"));
+static llvm::cl::opt<std::string> Summary(
+    "summary",
+    llvm::cl::desc("Write the status of every program in the manifest as tab "
+                   "separated values"),
+    llvm::cl::value_desc("filename"));
+
+void reportStatistics() {
+  if (TimePhases)
+    printStatistics(llvm::outs());
+
+  if (StatsJson != "") {
+    std::string json;
+    llvm::raw_string_ostream jsonStream(json);
+    printStatisticsAsJSON(jsonStream);
+
+    std::ofstream jsonFile(StatsJson);
+    jsonFile << jsonStream.str();
+    if (!jsonFile)
+      llvm::outs() << "Could not write the statistics to " << StatsJson
+                   << ".\n";
+  }
+}
+
+std::string getPchDirectory() {
+  if (NoPch)
+    return "";
+
+  llvm::SmallString<256> pchDir(PchDir);
+  if (pchDir.empty()) {
+    llvm::sys::path::system_temp_directory(true, pchDir);
+    llvm::sys::path::append(pchDir, cache_constants::PCH_DIRECTORY);
+  }
+  return pchDir.str().str();
+}
+
+// the options which apply to every program
+void setOptions(CodeGenContext &context) {
+  context.pchDirectory = getPchDirectory();
+  auto &buffers = context.buffers;
+  buffers.inputLayout = InputLayout.getNumOccurrences() ? InputLayout : Layout;
+  buffers.resultLayout =
+      ResultLayout.getNumOccurrences() ? ResultLayout : Layout;
+  buffers.packedInputs = PackedInputs;
+  buffers.abiSafeLayout = AbiSafeLayout;
+  buffers.globalInputs = GlobalInputs;
+  // the driver compares the results on the device, unless the kernel does
+  buffers.compareOnDevice = CompareOnDevice || (HostDriver && !CompactResults);
+  buffers.compactResults = CompactResults;
+  auto &hostCode = context.hostCode;
+  hostCode.hostArena = HostArena;
+  hostCode.binaryTests = BinaryTests;
+  hostCode.testsParser = TestsParser || ParallelTests || HostDriver;
+  hostCode.parallelTests = ParallelTests;
+  hostCode.hostDriver = HostDriver;
+  context.capacityAlignment = std::max(1u, (unsigned)TestsAlignment);
+}
+
+// generates the code for all programs in the manifest
+int generateManifest(const clang::tooling::CompilationDatabase &compilations) {
+  std::vector<BatchEntry> entries;
+  if (readManifest(Manifest, entries) != status_constants::SUCCESS)
     return status_constants::FAIL;
+
+  int status = status_constants::SUCCESS;
+  {
+    PhaseTimer timer("batch");
+    CodeGenContext options("", "");
+    options.useCache = !NoCache;
+    setOptions(options);
+    status = generateBatch(entries, compilations, Jobs, options);
+  }
+  printBatchSummary(entries, llvm::outs());
+
+  if (Summary != "") {
+    std::string summary;
+    llvm::raw_string_ostream summaryStream(summary);
+    writeBatchSummary(entries, summaryStream);
+
+    std::ofstream summaryFile(Summary);
+    summaryFile << summaryStream.str();
+    if (!summaryFile)
+      llvm::outs() << "Could not write the summary to " << Summary << ".\n";
   }
 
-  // generate the struct file
-  generateStructs(OutputDir, stdinInputs, inputDeclarations, resultDeclarations,
-                  includes);
-  // generate CPU code
-  generateCpuGen(OutputDir, inputDeclarations, resultDeclarations, stdinInputs);
+  reportStatistics();
+  return status;
+}
+
+// the sources of the programs in a manifest are not given on the command line
+bool isManifestGiven(int argc, const char **argv) {
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef arg(argv[i]);
+    if (arg == "--")
+      return false;
+    if (arg.startswith("-manifest") || arg.startswith("--manifest"))
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, const char **argv) {
+  // without sources, the compile flags must come after --, even if there are
+  // none, as there is no source to look for a compilation database for
+  std::vector<const char *> args(argv, argv + argc);
+  if (isManifestGiven(argc, argv) &&
+      std::find(args.begin(), args.end(), llvm::StringRef("--")) == args.end())
+    args.push_back("--");
+  int argsCount = args.size();
 
-  // generate kernel
-  clang::tooling::ClangTool Tool(OptionsParser.getCompilations(),
-                                 OptionsParser.getSourcePathList());
+  clang::tooling::CommonOptionsParser OptionsParser(
+      argsCount, args.data(), MscToolCategory, llvm::cl::ZeroOrMore);
+
+  if (NarrowInputs && Tests == "") {
+    llvm::errs() << "-narrow-inputs needs -tests.\n";
+    return 1;
+  }
+
+  // the other options read the inputs into a private struct of their own
+  bool isInputSoA = (InputLayout.getNumOccurrences() ? InputLayout : Layout) ==
+                    BufferLayout::structOfArrays;
+  if (GlobalInputs && (isInputSoA || PackedInputs || NarrowInputs)) {
+    llvm::errs() << "-global-inputs cannot be used with the struct of arrays "
+                    "input layout, -packed-inputs or -narrow-inputs.\n";
+    return 1;
+  }
+
+  // the records are whole partecl_input structs, with no pointers out of them
+  bool isParsed = TestsParser || ParallelTests || HostDriver;
+  if ((BinaryTests || isParsed) && (isInputSoA || PackedInputs)) {
+    llvm::errs() << "-binary-tests and -tests-parser cannot be used with the "
+                    "struct of arrays input layout or -packed-inputs.\n";
+    return 1;
+  }
+
+  // the failures are written to the results buffer as whole structs
+  bool isResultSoA =
+      (ResultLayout.getNumOccurrences() ? ResultLayout : Layout) ==
+      BufferLayout::structOfArrays;
+  if (CompactResults && isResultSoA) {
+    llvm::errs() << "-compact-results cannot be used with the struct of "
+                    "arrays result layout.\n";
+    return 1;
+  }
+
+  // the driver passes the kernel one buffer of inputs and one of results
+  if (HostDriver && isResultSoA) {
+    llvm::errs() << "-host-driver cannot be used with the struct of arrays "
+                    "result layout.\n";
+    return 1;
+  }
+
+  if (Manifest != "") {
+    if (Watch) {
+      llvm::errs() << "-watch cannot be used with -manifest.\n";
+      return 1;
+    }
+    if (Tests != "") {
+      llvm::errs() << "-tests cannot be used with -manifest.\n";
+      return 1;
+    }
+
+    int status = generateManifest(OptionsParser.getCompilations());
+    return status == status_constants::SUCCESS ? 0 : 1;
+  }
+
+  if (ConfigFilename == "" || OutputDir == "" ||
+      OptionsParser.getSourcePathList().empty()) {
+    llvm::errs() << "Please, specify the source files, -config and -output, "
+                    "or -manifest.\n";
+    return 1;
+  }
+
+  CodeGenContext context(ConfigFilename, OutputDir, Jobs);
+  context.testsFilename = Tests;
+  context.narrowInputs = NarrowInputs;
+  context.keepTranslationUnits = Watch;
+  // watch mode keeps its own state, so it needs the ASTs and not the cache
+  context.useCache = !NoCache && !Watch;
+  setOptions(context);
+
+  int status = generateCode(context, OptionsParser.getCompilations(),
+                            OptionsParser.getSourcePathList());
+
+  reportStatistics();
+
+  // regenerate what changed, until the process is stopped
+  if (Watch) {
+    llvm::outs() << "\nWatching " << ConfigFilename
+                 << " and the sources for changes...\n";
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(WatchInterval));
+
+      resetStatistics();
+      regenerateChangedCode(context, OptionsParser.getCompilations(),
+                            OptionsParser.getSourcePathList());
+
+      reportStatistics();
+      llvm::outs().flush();
+    }
+  }
 
-  generateKernel(&Tool, OutputDir, argvIdxToInput, inputDeclarations,
-                 stdinInputs, resultDeclarations);
+  return status == status_constants::SUCCESS ? 0 : 1;
 }
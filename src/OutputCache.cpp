@@ -0,0 +1,248 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OutputCache.h"
+#include "Constants.h"
+#include "Timing.h"
+#include "Utils.h"
+#include "clang/Basic/Version.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+std::string getCacheDirectory(const CodeGenContext &context) {
+  llvm::StringRef outputDirectory(context.outputDirectory);
+  outputDirectory = outputDirectory.rtrim('/');
+  return outputDirectory.str() + cache_constants::DIRECTORY_SUFFIX;
+}
+
+std::string getEntryFilename(const std::string &entryDirectory,
+                             const std::string &filename) {
+  llvm::SmallString<256> path(entryDirectory);
+  llvm::sys::path::append(path, filename);
+  return std::string(path.str());
+}
+
+// returns a placeholder if the file does not exist, so that the hash is
+// always a single word in the manifest
+std::string hashFile(const std::string &filename) {
+  if (!llvm::sys::fs::is_regular_file(filename))
+    return cache_constants::MISSING_HASH;
+
+  llvm::MD5 hash;
+  addToHash(hash, read_file(filename));
+  return getHashAsString(hash);
+}
+
+// the version of the tool, including the build of the executable, so that a
+// rebuilt tool does not use outputs generated by an older one
+void addToolVersionToHash(llvm::MD5 &hash) {
+  addToHash(hash, cache_constants::CODEGEN_VERSION);
+  addToHash(hash, clang::getClangFullVersion());
+
+  auto executable = llvm::sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&addToolVersionToHash));
+  llvm::sys::fs::file_status status;
+  if (!llvm::sys::fs::status(executable, status)) {
+    addToHash(hash, executable);
+    addToHash(hash, std::to_string(status.getSize()));
+    addToHash(hash, std::to_string(llvm::sys::toTimeT(
+                        status.getLastModificationTime())));
+  }
+}
+
+std::string computeCacheKey(
+    const CodeGenContext &context,
+    const clang::tooling::CompilationDatabase &compilations,
+    const std::vector<std::string> &sources) {
+  llvm::MD5 hash;
+  addToolVersionToHash(hash);
+  addToHash(hash, read_file(context.configFilename));
+  auto &buffers = context.buffers;
+  addToHash(hash, buffers.inputLayout == BufferLayout::structOfArrays ? "soa"
+                                                                      : "aos");
+  addToHash(hash, buffers.resultLayout == BufferLayout::structOfArrays ? "soa"
+                                                                       : "aos");
+  addToHash(hash, buffers.packedInputs ? "packed" : "padded");
+  addToHash(hash, buffers.abiSafeLayout ? "abi-safe" : "");
+  addToHash(hash, buffers.globalInputs ? "global-inputs" : "");
+  addToHash(hash, buffers.compareOnDevice ? "compare-on-device" : "");
+  addToHash(hash, buffers.compactResults ? "compact-results" : "");
+  auto &hostCode = context.hostCode;
+  addToHash(hash, hostCode.hostArena ? "host-arena" : "");
+  addToHash(hash, hostCode.binaryTests ? "binary-tests" : "");
+  addToHash(hash, hostCode.testsParser ? "tests-parser" : "");
+  addToHash(hash, hostCode.parallelTests ? "parallel-tests" : "");
+  addToHash(hash, hostCode.hostDriver ? "host-driver" : "");
+  if (context.testsFilename != "") {
+    addToHash(hash, read_file(context.testsFilename));
+    for (auto &stdinFile : context.stdinFiles) {
+      addToHash(hash, stdinFile.first);
+      addToHash(hash, hashFile(stdinFile.first));
+    }
+    addToHash(hash, std::to_string(context.capacityAlignment));
+    addToHash(hash, context.narrowInputs ? "narrow" : "");
+  }
+
+  for (auto &source : sources) {
+    addToHash(hash, source);
+    for (auto &command : compilations.getCompileCommands(source)) {
+      addToHash(hash, command.Directory);
+      for (auto &arg : command.CommandLine)
+        addToHash(hash, arg);
+    }
+
+    addToHash(hash, hashFile(source));
+  }
+
+  return getHashAsString(hash);
+}
+
+bool restoreFromCache(CodeGenContext &context, const std::string &key) {
+  auto entryDirectory = getEntryFilename(getCacheDirectory(context), key);
+  auto manifestFilename =
+      getEntryFilename(entryDirectory, cache_constants::MANIFEST_FILENAME);
+
+  // the manifest is written last, so an entry without one is incomplete
+  std::ifstream manifest(manifestFilename);
+  if (!manifest.is_open())
+    return false;
+
+  // check that the dependencies did not change
+  std::string manifestContents;
+  std::set<std::string> dependencies;
+  std::list<std::string> outputs;
+  std::string line;
+  while (getline(manifest, line)) {
+    manifestContents.append(line + "\n");
+
+    std::istringstream iss(line);
+    std::string annot;
+    iss >> annot;
+
+    std::string value;
+    if (annot == cache_constants::DEPENDENCY) {
+      std::string expectedHash;
+      iss >> expectedHash;
+      getline(iss >> std::ws, value);
+      if (hashFile(value) != expectedHash)
+        return false;
+      dependencies.insert(value);
+    } else if (annot == cache_constants::OUTPUT) {
+      getline(iss >> std::ws, value);
+      if (!llvm::sys::fs::is_regular_file(
+              getEntryFilename(entryDirectory, value)))
+        return false;
+      outputs.push_back(value);
+    }
+  }
+  manifest.close();
+
+  messages() << "Restoring the generated code from the cache... ";
+  for (auto &output : outputs) {
+    auto contents = read_file(getEntryFilename(entryDirectory, output));
+    auto outputFilename = context.outputDirectory + "/" + output;
+    writeFileIfChanged(outputFilename, contents);
+    addOutputFile(outputFilename, contents.size());
+    context.outputFiles.insert(output);
+  }
+  context.dependencies = dependencies;
+
+  // rewrite the manifest, so that recently used entries are kept the longest;
+  // another run may be reading it at the same time
+  writeFileAtomically(manifestFilename, manifestContents);
+
+  messages() << "DONE!\n";
+  return true;
+}
+
+void removeCacheEntry(const std::string &entryDirectory) {
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator file(entryDirectory, ec), end;
+       file != end && !ec; file.increment(ec))
+    llvm::sys::fs::remove(file->path());
+
+  llvm::sys::fs::remove(entryDirectory);
+}
+
+// remove the least recently used entries, so that the cache does not grow
+// forever
+void pruneCache(const std::string &cacheDirectory) {
+  std::vector<std::pair<std::time_t, std::string>> entries;
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator entry(cacheDirectory, ec), end;
+       entry != end && !ec; entry.increment(ec)) {
+    llvm::sys::fs::file_status status;
+    auto manifestFilename = getEntryFilename(
+        entry->path(), cache_constants::MANIFEST_FILENAME);
+    std::time_t lastUsed = 0;
+    if (!llvm::sys::fs::status(manifestFilename, status))
+      lastUsed = llvm::sys::toTimeT(status.getLastModificationTime());
+    entries.push_back(std::make_pair(lastUsed, entry->path()));
+  }
+
+  if (entries.size() <= cache_constants::MAX_ENTRIES)
+    return;
+
+  std::sort(entries.begin(), entries.end());
+  for (unsigned i = 0; i < entries.size() - cache_constants::MAX_ENTRIES; i++)
+    removeCacheEntry(entries[i].second);
+}
+
+void storeInCache(const CodeGenContext &context, const std::string &key) {
+  auto cacheDirectory = getCacheDirectory(context);
+  auto entryDirectory = getEntryFilename(cacheDirectory, key);
+  if (llvm::sys::fs::create_directories(entryDirectory)) {
+    messages() << "Could not create the cache directory " << entryDirectory
+               << ".\n";
+    return;
+  }
+
+  // invalidate the entry while its files are being replaced
+  auto manifestFilename =
+      getEntryFilename(entryDirectory, cache_constants::MANIFEST_FILENAME);
+  llvm::sys::fs::remove(manifestFilename);
+
+  std::stringstream manifest;
+  for (auto &dependency : context.dependencies) {
+    manifest << cache_constants::DEPENDENCY << " " << hashFile(dependency)
+             << " " << dependency << "\n";
+  }
+
+  // each file is replaced whole, and the manifest goes last, so that a
+  // concurrent restore sees either the old entry, none, or the new one
+  for (auto &output : context.outputFiles) {
+    auto contents = read_file(context.outputDirectory + "/" + output);
+    if (!writeFileAtomically(getEntryFilename(entryDirectory, output),
+                             contents)) {
+      messages() << "Could not store " << output << " in the cache.\n";
+      return;
+    }
+    manifest << cache_constants::OUTPUT << " " << output << "\n";
+  }
+
+  if (!writeFileAtomically(manifestFilename, manifest.str()))
+    messages() << "Could not store the cache manifest.\n";
+
+  pruneCache(cacheDirectory);
+}
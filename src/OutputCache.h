@@ -0,0 +1,42 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OUTPUT_CACHE_H
+#define OUTPUT_CACHE_H
+
+#include "CodeGenContext.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include <string>
+#include <vector>
+
+// The output cache keeps copies of the generated files beside the output
+// directory. An entry is found by a hash of the tool version, the config file
+// and the sources with their compile commands, and is only used if none of the
+// headers the kernel was generated from changed since it was stored.
+
+// Returns the key of the cache entry for generating the sources.
+std::string computeCacheKey(const CodeGenContext &,
+                            const clang::tooling::CompilationDatabase &,
+                            const std::vector<std::string> &);
+
+// Copies the cached files into the output directory, leaving the files which
+// are already up to date untouched. Returns false if there is no valid entry.
+bool restoreFromCache(CodeGenContext &, const std::string &);
+
+// Stores the generated files and their dependencies in the cache.
+void storeInCache(const CodeGenContext &, const std::string &);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PrecompiledHeader.h"
+#include "Utils.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace clang;
+using namespace clang::tooling;
+
+// Returns the system includes at the top of the source, before any other code
+// (comments and empty lines are skipped). Anything else, including other
+// directives, may change what the headers declare, so it ends the list.
+std::vector<std::string> getLeadingSystemIncludes(const std::string &source) {
+  std::vector<std::string> includes;
+  if (!llvm::sys::fs::is_regular_file(source))
+    return includes;
+
+  std::istringstream sourceStream(read_file(source));
+  std::string line;
+  bool inComment = false;
+  while (getline(sourceStream, line)) {
+    auto text = llvm::StringRef(line).trim();
+
+    // comments
+    if (inComment || text.startswith("/*")) {
+      auto commentEnd = text.find("*/", inComment ? 0 : 2);
+      inComment = commentEnd == llvm::StringRef::npos;
+      if (inComment)
+        continue;
+
+      text = text.substr(commentEnd + 2).trim();
+    }
+
+    if (text.empty() || text.startswith("//"))
+      continue;
+
+    // system includes
+    if (!text.startswith("#"))
+      break;
+
+    text = text.drop_front().ltrim();
+    if (!text.startswith("include"))
+      break;
+
+    text = text.drop_front(strlen("include")).ltrim();
+    auto headerEnd = text.find('>');
+    if (!text.startswith("<") || headerEnd == llvm::StringRef::npos)
+      break;
+
+    auto rest = text.substr(headerEnd + 1).trim();
+    if (!rest.empty() && !rest.startswith("//"))
+      break;
+
+    includes.push_back("#include " + text.substr(0, headerEnd + 1).str());
+  }
+
+  return includes;
+}
+
+// the arguments of the compile command, without the compiler, the source and
+// the output
+std::vector<std::string> getCompileFlags(const CompileCommand &command,
+                                         const std::string &source) {
+  std::vector<std::string> flags;
+  auto &commandLine = command.CommandLine;
+  for (unsigned i = 1; i < commandLine.size(); i++) {
+    auto &arg = commandLine[i];
+    if (arg == "-c" || arg == source)
+      continue;
+
+    if (arg == "-o") {
+      i++;
+      continue;
+    }
+
+    if (llvm::StringRef(arg).startswith("-o"))
+      continue;
+
+    flags.push_back(arg);
+  }
+
+  return flags;
+}
+
+// Generates the precompiled header, recording the headers it was built from
+class PrecompiledHeaderAction : public GeneratePCHAction {
+private:
+  std::string outputFile;
+  std::set<std::string> &dependencies;
+
+public:
+  PrecompiledHeaderAction(const std::string &outputFile,
+                          std::set<std::string> &dependencies)
+      : outputFile(outputFile), dependencies(dependencies) {}
+
+protected:
+  bool BeginSourceFileAction(CompilerInstance &CI,
+                             llvm::StringRef Filename) override {
+    CI.getFrontendOpts().OutputFile = outputFile;
+    return GeneratePCHAction::BeginSourceFileAction(CI, Filename);
+  }
+
+  void EndSourceFileAction() override {
+    auto &sourceMgr = getCompilerInstance().getSourceManager();
+    for (auto file = sourceMgr.fileinfo_begin();
+         file != sourceMgr.fileinfo_end(); file++)
+      dependencies.insert(file->first->getName());
+
+    GeneratePCHAction::EndSourceFileAction();
+  }
+};
+
+class PrecompiledHeaderActionFactory : public FrontendActionFactory {
+private:
+  std::string outputFile;
+  std::set<std::string> &dependencies;
+
+public:
+  PrecompiledHeaderActionFactory(const std::string &outputFile,
+                                 std::set<std::string> &dependencies)
+      : outputFile(outputFile), dependencies(dependencies) {}
+
+  FrontendAction *create() override {
+    return new PrecompiledHeaderAction(outputFile, dependencies);
+  }
+};
+
+std::string getFileInfo(const std::string &filename) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(filename, status))
+    return "";
+
+  std::stringstream fileInfo;
+  fileInfo << llvm::sys::toTimeT(status.getLastModificationTime()) << " "
+           << status.getSize();
+  return fileInfo.str();
+}
+
+// Reads the headers which the precompiled header was built from; returns false
+// if any of them changed since then
+bool readDependencies(const std::string &dependenciesFilename,
+                      std::set<std::string> &dependencies) {
+  std::ifstream dependenciesFile(dependenciesFilename);
+  if (!dependenciesFile.is_open())
+    return false;
+
+  std::string line;
+  while (getline(dependenciesFile, line)) {
+    // <modification time> <size> <filename>
+    std::istringstream iss(line);
+    std::string time, size, filename;
+    iss >> time >> size;
+    getline(iss >> std::ws, filename);
+
+    if (getFileInfo(filename) != time + " " + size)
+      return false;
+
+    dependencies.insert(filename);
+  }
+
+  return true;
+}
+
+bool buildPrecompiledHeader(const CompileCommand &command,
+                            const std::vector<std::string> &flags,
+                            const std::string &headerFilename,
+                            const std::string &pchFilename,
+                            const std::string &dependenciesFilename,
+                            std::set<std::string> &dependencies) {
+  llvm::SmallString<256> tempFilename;
+  if (llvm::sys::fs::createUniqueFile(pchFilename + "-%%%%%%.tmp",
+                                      tempFilename))
+    return false;
+
+  FixedCompilationDatabase compilations(command.Directory, flags);
+  ClangTool tool(compilations, headerFilename);
+  tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(
+      CommandLineArguments{"-x", "c-header"}, ArgumentInsertPosition::BEGIN));
+
+  PrecompiledHeaderActionFactory factory(tempFilename.str().str(),
+                                         dependencies);
+  if (tool.run(&factory) != 0 ||
+      llvm::sys::fs::rename(tempFilename, pchFilename)) {
+    llvm::sys::fs::remove(tempFilename);
+    return false;
+  }
+
+  // the dependencies are written last, as they mark the header as complete
+  std::stringstream dependenciesStream;
+  for (auto &dependency : dependencies)
+    dependenciesStream << getFileInfo(dependency) << " " << dependency << "\n";
+
+  return writeFileAtomically(dependenciesFilename, dependenciesStream.str());
+}
+
+std::string getDependenciesFilename(const std::string &pchFilename) {
+  return llvm::StringRef(pchFilename).drop_back(strlen(".pch")).str() + ".deps";
+}
+
+PrecompiledHeader getPrecompiledHeader(const CompilationDatabase &compilations,
+                                       const std::vector<std::string> &sources,
+                                       const std::string &cacheDirectory) {
+  PrecompiledHeader pch;
+  if (sources.empty() || cacheDirectory.empty())
+    return pch;
+
+  // find the system includes which all sources start with
+  auto includes = getLeadingSystemIncludes(sources.front());
+  for (auto &source : sources) {
+    auto sourceIncludes = getLeadingSystemIncludes(source);
+    if (sourceIncludes.size() < includes.size())
+      includes.resize(sourceIncludes.size());
+
+    auto mismatch =
+        std::mismatch(includes.begin(), includes.end(), sourceIncludes.begin());
+    includes.erase(mismatch.first, includes.end());
+  }
+
+  if (includes.empty())
+    return pch;
+
+  // the header is only valid for sources compiled with the same flags
+  auto commands = compilations.getCompileCommands(sources.front());
+  if (commands.empty())
+    return pch;
+
+  auto &command = commands.front();
+  auto flags = getCompileFlags(command, sources.front());
+  for (auto &source : sources) {
+    auto sourceCommands = compilations.getCompileCommands(source);
+    if (sourceCommands.empty())
+      continue;
+
+    auto &sourceCommand = sourceCommands.front();
+    if (sourceCommand.Directory == command.Directory &&
+        getCompileFlags(sourceCommand, source) == flags)
+      pch.sources.insert(source);
+  }
+
+  // name the header by everything which goes into it
+  std::string headerSource;
+  for (auto &include : includes)
+    headerSource.append(include + "\n");
+
+  llvm::MD5 hash;
+  addToHash(hash, clang::getClangFullVersion());
+  addToHash(hash, command.Directory);
+  for (auto &flag : flags)
+    addToHash(hash, flag);
+  addToHash(hash, headerSource);
+  auto key = getHashAsString(hash);
+
+  llvm::SmallString<256> basename(cacheDirectory);
+  llvm::sys::path::append(basename, "pch-" + key);
+  auto headerFilename = basename.str().str() + ".h";
+  auto pchFilename = basename.str().str() + ".pch";
+  auto dependenciesFilename = getDependenciesFilename(pchFilename);
+
+  // reuse the header from an earlier run, unless its headers changed
+  if (llvm::sys::fs::exists(pchFilename) &&
+      readDependencies(dependenciesFilename, pch.dependencies)) {
+    pch.filename = pchFilename;
+    return pch;
+  }
+
+  messages() << "Precompiling the system headers... ";
+  pch.dependencies.clear();
+  // the header is named by its contents, so it never needs to be rewritten
+  if (llvm::sys::fs::create_directories(cacheDirectory) ||
+      (!llvm::sys::fs::exists(headerFilename) &&
+       !writeFileAtomically(headerFilename, headerSource)) ||
+      !buildPrecompiledHeader(command, flags, headerFilename, pchFilename,
+                              dependenciesFilename, pch.dependencies)) {
+    messages() << "FAILED! Parsing the headers with every source.\n";
+    pch.dependencies.clear();
+    return pch;
+  }
+  messages() << "DONE!\n";
+
+  pch.filename = pchFilename;
+  return pch;
+}
+
+void invalidatePrecompiledHeader(const PrecompiledHeader &pch) {
+  if (pch.filename != "")
+    llvm::sys::fs::remove(getDependenciesFilename(pch.filename));
+}
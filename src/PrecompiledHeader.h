@@ -0,0 +1,44 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PRECOMPILED_HEADER_H
+#define PRECOMPILED_HEADER_H
+
+#include "clang/Tooling/CompilationDatabase.h"
+#include <set>
+#include <string>
+#include <vector>
+
+// A precompiled header for the system headers which the sources include before
+// any other code. It is built once and kept in a cache directory, so that
+// neither later translation units nor later runs parse these headers again.
+struct PrecompiledHeader {
+  std::string filename; // empty if there is no precompiled header
+  std::set<std::string> sources;      // the sources which can use it
+  std::set<std::string> dependencies; // the headers it was built from
+};
+
+// Finds the precompiled header for the sources in the cache directory, and
+// builds it if it is not there or any of its headers changed.
+PrecompiledHeader
+getPrecompiledHeader(const clang::tooling::CompilationDatabase &,
+                     const std::vector<std::string> &, const std::string &);
+
+// Makes sure the precompiled header is built again by the next run, eg. when
+// it cannot be loaded.
+void invalidatePrecompiledHeader(const PrecompiledHeader &);
+
+#endif
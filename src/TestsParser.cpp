@@ -0,0 +1,351 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TestsParser.h"
+#include "Constants.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+// reads the standard input of a test case from a file, relative to the tests
+// file, and gives the path it was read from
+int readStdinFile(const std::string &testsFilename,
+                  const std::string &stdinFilename, std::string &stdinText,
+                  std::string &stdinPath) {
+  llvm::SmallString<256> filename(stdinFilename);
+  if (llvm::sys::path::is_relative(filename)) {
+    filename = llvm::sys::path::parent_path(testsFilename);
+    llvm::sys::path::append(filename, stdinFilename);
+  }
+
+  auto file = llvm::MemoryBuffer::getFile(filename);
+  if (!file) {
+    messages() << "Could not read the standard input file " << filename
+               << ".\n";
+    return status_constants::FAIL;
+  }
+
+  stdinText = (*file)->getBuffer().str();
+  stdinPath = filename.str().str();
+  return status_constants::SUCCESS;
+}
+
+// reads a quoted string or a word, starting at `pos`
+std::string parseTestsToken(const std::string &line, size_t &pos) {
+  size_t end;
+  if (line[pos] == '"') {
+    end = line.find('"', pos + 1);
+    if (end == std::string::npos)
+      end = line.size();
+    auto token = line.substr(pos + 1, end - pos - 1);
+    pos = std::min(end + 1, line.size());
+    return token;
+  }
+
+  end = line.find_first_of(" \t", pos);
+  if (end == std::string::npos)
+    end = line.size();
+  auto token = line.substr(pos, end - pos);
+  pos = end;
+  return token;
+}
+
+int parseTestCase(const std::string &testsFilename, const std::string &line,
+                  struct TestCase &testCase) {
+  size_t pos = 0;
+  while (true) {
+    pos = line.find_first_not_of(" \t\r", pos);
+    if (pos == std::string::npos)
+      return status_constants::SUCCESS;
+
+    if (line[pos] != '<') {
+      testCase.args.push_back(parseTestsToken(line, pos));
+      continue;
+    }
+
+    // a standard input: either quoted text, or the name of a file
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string::npos) {
+      messages() << "Missing standard input at the end of line "
+                 << testCase.line << " of " << testsFilename << ".\n";
+      return status_constants::FAIL;
+    }
+
+    bool isFile = line[pos] != '"';
+    auto token = parseTestsToken(line, pos);
+    if (isFile) {
+      std::string stdinText;
+      std::string stdinPath;
+      if (readStdinFile(testsFilename, token, stdinText, stdinPath) ==
+          status_constants::FAIL)
+        return status_constants::FAIL;
+      token = stdinText;
+      testCase.stdinFiles.push_back(stdinPath);
+    }
+    testCase.stdins.push_back(token);
+  }
+}
+
+int parseTests(const std::string &testsFilename,
+               std::vector<struct TestCase> &testCases) {
+  messages() << "Parsing tests file... ";
+
+  std::ifstream infile(testsFilename);
+  if (!infile.is_open()) {
+    messages() << "Error opening tests file: " << testsFilename << ".\n";
+    return status_constants::FAIL;
+  }
+
+  std::string line;
+  unsigned lineNumber = 0;
+  while (getline(infile, line)) {
+    lineNumber++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+
+    struct TestCase testCase;
+    testCase.line = lineNumber;
+    if (parseTestCase(testsFilename, line, testCase) == status_constants::FAIL)
+      return status_constants::FAIL;
+    testCases.push_back(testCase);
+  }
+
+  messages() << "DONE!\n";
+  return status_constants::SUCCESS;
+}
+
+// the number of elements of an input in a test case, or -1 if the test case
+// does not give it
+long getElementCount(const struct TestCase &testCase,
+                     const std::vector<std::string> &values, size_t idx,
+                     const struct Declaration &input) {
+  if (input.isPointer) {
+    // a string, with its terminating character
+    if (idx >= values.size())
+      return -1;
+    return values[idx].size() + 1;
+  }
+
+  // an array, whose size is the value of another input
+  if (idx >= testCase.args.size())
+    return -1;
+  return std::max(0L, std::atol(testCase.args[idx].c_str()));
+}
+
+// finds the largest number of elements of an input, and sets its capacity
+void inferCapacity(const std::vector<struct TestCase> &testCases,
+                   struct Declaration &input, bool isStdin, size_t idx,
+                   unsigned alignment, uint64_t &bytesBefore,
+                   uint64_t &bytesAfter, llvm::raw_ostream &report) {
+  long maxCount = -1;
+  for (auto &testCase : testCases) {
+    auto &values = isStdin ? testCase.stdins : testCase.args;
+    maxCount =
+        std::max(maxCount, getElementCount(testCase, values, idx, input));
+  }
+  if (maxCount < 0)
+    return;
+
+  // round the size up to the alignment
+  uint64_t elementSize = getTypeSize(input.type);
+  uint64_t bytes = std::max(1L, maxCount) * elementSize;
+  bytes = (bytes + alignment - 1) / alignment * alignment;
+  input.capacity = (bytes + elementSize - 1) / elementSize;
+
+  // a string is a pointer in the struct, unless it has a capacity
+  uint64_t before = input.isPointer
+                        ? sizeof(char *)
+                        : structs_constants::POINTER_ARRAY_SIZE * elementSize;
+  uint64_t after = input.capacity * elementSize;
+  bytesBefore += before;
+  bytesAfter += after;
+  report << "  " << llvm::left_justify(input.name, 24)
+         << llvm::format(" %10ld %10d %12llu %12llu\n", maxCount,
+                         input.capacity, (unsigned long long)before,
+                         (unsigned long long)after);
+}
+
+void inferCapacities(const std::vector<struct TestCase> &testCases,
+                     std::list<struct Declaration> &inputs,
+                     std::list<struct Declaration> &stdinInputs,
+                     unsigned alignment, llvm::raw_ostream &report) {
+  report << "\nCapacities inferred from " << testCases.size()
+         << " test cases (aligned to " << alignment << " bytes):\n";
+  report << "  " << llvm::left_justify("input", 24)
+         << llvm::right_justify("elements", 11)
+         << llvm::right_justify("capacity", 11)
+         << llvm::right_justify("bytes before", 13)
+         << llvm::right_justify("bytes after", 13) << "\n";
+
+  uint64_t bytesBefore = 0;
+  uint64_t bytesAfter = 0;
+
+  // the command line arguments start from index 1, in the order of the inputs
+  size_t argIdx = 0;
+  for (auto &input : inputs) {
+    argIdx++;
+    if (!isVariableLength(input))
+      continue;
+
+    if (input.isPointer) {
+      inferCapacity(testCases, input, false, argIdx, alignment, bytesBefore,
+                    bytesAfter, report);
+      continue;
+    }
+
+    // the size of the array is given by another input
+    auto sizeInput = std::find_if(
+        inputs.begin(), inputs.end(),
+        [&input](const struct Declaration &sizeInput) {
+          return sizeInput.name == input.size;
+        });
+    if (sizeInput == inputs.end()) {
+      report << "  " << llvm::left_justify(input.name, 24)
+             << " (the size " << input.size << " is not an input)\n";
+      continue;
+    }
+    inferCapacity(testCases, input, false,
+                  std::distance(inputs.begin(), sizeInput) + 1, alignment,
+                  bytesBefore, bytesAfter, report);
+  }
+
+  size_t stdinIdx = 0;
+  for (auto &stdinInput : stdinInputs) {
+    if (stdinInput.isPointer)
+      inferCapacity(testCases, stdinInput, true, stdinIdx, alignment,
+                    bytesBefore, bytesAfter, report);
+    stdinIdx++;
+  }
+
+  if (bytesAfter == 0) {
+    report << "  (none)\n";
+    return;
+  }
+  report << "Bytes per test case: " << bytesBefore << " before, " << bytesAfter
+         << " after";
+  if (bytesBefore >= bytesAfter)
+    report << " (" << bytesBefore - bytesAfter << " saved)\n";
+  else
+    report << " (" << bytesAfter - bytesBefore << " more)\n";
+}
+
+// the range of the values of an input in the test cases; returns false if one
+// of them is not an integer, or no test case gives the input
+bool getValueRange(const std::vector<struct TestCase> &testCases,
+                   const std::list<struct Declaration> &inputs,
+                   const struct Declaration &input, size_t argIdx, long &min,
+                   long &max) {
+  // the number of elements of an array is either a number or another input
+  size_t sizeIdx = 0;
+  if (input.isArray && isVariableLength(input)) {
+    auto sizeInput = std::find_if(
+        inputs.begin(), inputs.end(),
+        [&input](const struct Declaration &sizeInput) {
+          return sizeInput.name == input.size;
+        });
+    if (sizeInput == inputs.end())
+      return false;
+    sizeIdx = std::distance(inputs.begin(), sizeInput) + 1;
+  }
+
+  bool found = false;
+  for (auto &testCase : testCases) {
+    long count = 1;
+    if (input.isArray && sizeIdx > 0)
+      count = sizeIdx < testCase.args.size()
+                  ? std::atol(testCase.args[sizeIdx].c_str())
+                  : 0;
+    else if (input.isArray)
+      count = std::atol(input.size.c_str());
+
+    for (long i = 0; i < count && argIdx + i < testCase.args.size(); i++) {
+      auto &arg = testCase.args[argIdx + i];
+      char *end;
+      long value = std::strtol(arg.c_str(), &end, 10);
+      if (arg.empty() || *end != '\0')
+        return false;
+
+      min = found ? std::min(min, value) : value;
+      max = found ? std::max(max, value) : value;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void inferStorageTypes(const std::vector<struct TestCase> &testCases,
+                       std::list<struct Declaration> &inputs, bool packed,
+                       llvm::raw_ostream &report) {
+  report << "\nStorage types inferred from " << testCases.size()
+         << " test cases:\n";
+  report << "  " << llvm::left_justify("input", 24)
+         << llvm::right_justify("min", 12) << llvm::right_justify("max", 12)
+         << "  " << llvm::left_justify("stored as", 16)
+         << llvm::right_justify("bytes before", 13)
+         << llvm::right_justify("bytes after", 13) << "\n";
+
+  uint64_t bytesBefore = 0;
+  uint64_t bytesAfter = 0;
+
+  // the command line arguments start from index 1, in the order of the inputs
+  size_t argIdx = 0;
+  for (auto &input : inputs) {
+    argIdx++;
+    if (input.isPointer || (packed && isVariableLength(input)))
+      continue;
+    if (input.type != "int" && input.type != "long" && input.type != "short")
+      continue;
+
+    long min, max;
+    if (!getValueRange(testCases, inputs, input, argIdx, min, max))
+      continue;
+
+    auto &storageTypes = getStorageTypes();
+    auto typeSize = getTypeSize(input.type);
+    auto storageType = std::find_if(
+        storageTypes.begin(), storageTypes.end(),
+        [min, max, typeSize](const struct StorageType &storageType) {
+          return storageType.size < typeSize && min >= storageType.min &&
+                 max <= storageType.max;
+        });
+    if (storageType == storageTypes.end())
+      continue;
+
+    input.storageType = storageType->name;
+
+    uint64_t count = input.isArray ? std::atol(getArraySize(input).c_str()) : 1;
+    uint64_t before = count * typeSize;
+    uint64_t after = count * storageType->size;
+    bytesBefore += before;
+    bytesAfter += after;
+    report << "  " << llvm::left_justify(input.name, 24)
+           << llvm::format(" %11ld %11ld  ", min, max)
+           << llvm::left_justify(input.storageType, 16)
+           << llvm::format(" %12llu %12llu\n", (unsigned long long)before,
+                           (unsigned long long)after);
+  }
+
+  if (bytesAfter == 0) {
+    report << "  (none)\n";
+    return;
+  }
+  report << "Bytes per test case: " << bytesBefore << " before, " << bytesAfter
+         << " after (" << bytesBefore - bytesAfter << " saved)\n";
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_PARSER_H
+#define TESTS_PARSER_H
+
+#include "Utils.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+// A test case, as given on a line of the tests file
+struct TestCase {
+  std::vector<std::string> args;   // starting with the test case number
+  std::vector<std::string> stdins; // the standard inputs, in order
+  std::vector<std::string> stdinFiles; // the files some of them were read from
+  unsigned line = 0;
+};
+
+// Reads a tests file (see doc/Tests.md).
+// Returns status_constants::SUCCESS or status_constants::FAIL.
+int parseTests(const std::string &, std::vector<struct TestCase> &);
+
+// Sets the capacity of every string input, and every input array whose size is
+// another input, to the largest number of elements it has in any of the test
+// cases, rounded up to a multiple of `alignment` bytes. Inputs which no test
+// case gives are left as they are. Prints the capacities and the bytes they
+// take per test case, before and after, to `report`.
+void inferCapacities(const std::vector<struct TestCase> &,
+                     std::list<struct Declaration> &inputs,
+                     std::list<struct Declaration> &stdinInputs,
+                     unsigned alignment, llvm::raw_ostream &report);
+
+// Sets the storage type of every integer input (or input array) whose values
+// in all the test cases fit in a narrower type, to the narrowest such type.
+// Packed variable length inputs are left as they are. Prints the ranges of the
+// values and the bytes the inputs take per test case, before and after, to
+// `report`.
+void inferStorageTypes(const std::vector<struct TestCase> &,
+                       std::list<struct Declaration> &inputs, bool packed,
+                       llvm::raw_ostream &report);
+
+#endif
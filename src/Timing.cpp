@@ -0,0 +1,306 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Timing.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+struct PhaseTime {
+  llvm::TimeRecord time;
+  unsigned count = 0;
+  uint64_t bytes = 0;
+};
+
+struct UnitTime {
+  std::string unit;
+  std::string phase;
+  double wall;
+  double cpu;
+};
+
+struct OutputFileStatistics {
+  uint64_t bytes = 0;
+  unsigned rewrites = 0;
+};
+
+// accumulated times, together with the order in which the phases first ran
+std::map<std::string, PhaseTime> phaseTimes;
+std::vector<std::string> phaseOrder;
+std::vector<UnitTime> unitTimes;
+std::map<std::string, uint64_t> matchCounts;
+std::map<std::string, OutputFileStatistics> outputFiles;
+// phases may be timed from several threads
+std::mutex phaseTimesMutex;
+
+PhaseTime &getPhaseTime(const std::string &phase) {
+  auto phaseTimeIt = phaseTimes.find(phase);
+  if (phaseTimeIt == phaseTimes.end()) {
+    phaseOrder.push_back(phase);
+    return phaseTimes[phase];
+  }
+
+  return phaseTimeIt->second;
+}
+
+// CPU time of the calling thread, or of the process if that is not available
+double getThreadTime() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+    return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+  return llvm::TimeRecord::getCurrentTime(false).getProcessTime();
+}
+
+// in bytes, or 0 if it is not known
+uint64_t getPeakResidentSetSize() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+PhaseTimer::PhaseTimer(const std::string &phase, const std::string &unit,
+                       bool startNow)
+    : phase(phase), unit(unit), startThreadTime(0), running(false) {
+  if (startNow)
+    start();
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (running)
+    stop();
+}
+
+void PhaseTimer::start() {
+  startTime = llvm::TimeRecord::getCurrentTime(true);
+  if (unit != "")
+    startThreadTime = getThreadTime();
+  running = true;
+}
+
+void PhaseTimer::stop() {
+  if (!running)
+    return;
+
+  llvm::TimeRecord elapsed = llvm::TimeRecord::getCurrentTime(false);
+  elapsed -= startTime;
+  running = false;
+
+  if (unit != "") {
+    double threadTime = getThreadTime() - startThreadTime;
+    std::lock_guard<std::mutex> lock(phaseTimesMutex);
+    unitTimes.push_back({unit, phase, elapsed.getWallTime(), threadTime});
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  auto &phaseTime = getPhaseTime(phase);
+  phaseTime.time += elapsed;
+  phaseTime.count++;
+}
+
+void addPhaseBytes(const std::string &phase, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  getPhaseTime(phase).bytes += bytes;
+}
+
+void addMatchCount(const std::string &handler, uint64_t count) {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  matchCounts[handler] += count;
+}
+
+void addOutputFile(const std::string &filename, uint64_t bytes,
+                   unsigned rewrites) {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  auto &outputFile = outputFiles[filename];
+  outputFile.bytes = bytes;
+  outputFile.rewrites = rewrites;
+}
+
+// unit times grouped by unit, in the order the units first ran
+std::vector<UnitTime> getUnitTimesByUnit() {
+  std::map<std::string, size_t> unitOrder;
+  for (auto &unitTime : unitTimes)
+    unitOrder.insert(std::make_pair(unitTime.unit, unitOrder.size()));
+
+  auto sortedUnitTimes = unitTimes;
+  std::stable_sort(sortedUnitTimes.begin(), sortedUnitTimes.end(),
+                   [&unitOrder](const UnitTime &time1, const UnitTime &time2) {
+                     return unitOrder[time1.unit] < unitOrder[time2.unit];
+                   });
+  return sortedUnitTimes;
+}
+
+void printStatistics(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  if (phaseOrder.empty())
+    return;
+
+  os << "\nPhase times:\n";
+  os << "  " << llvm::left_justify("phase", 32)
+     << llvm::right_justify("wall (s)", 11)
+     << llvm::right_justify("cpu (s)", 11) << llvm::right_justify("runs", 7)
+     << llvm::right_justify("MB/s", 13) << "\n";
+
+  for (auto &phase : phaseOrder) {
+    auto &phaseTime = phaseTimes[phase];
+    double wall = phaseTime.time.getWallTime();
+    double cpu = phaseTime.time.getProcessTime();
+
+    os << "  " << llvm::left_justify(phase, 32)
+       << llvm::format(" %10.4f %10.4f %6u ", wall, cpu, phaseTime.count);
+    if (phaseTime.bytes > 0 && wall > 0)
+      os << llvm::format("%12.2f", phaseTime.bytes / wall / (1024 * 1024));
+    else
+      os << llvm::right_justify("-", 12);
+    os << "\n";
+  }
+
+  if (!unitTimes.empty()) {
+    os << "\nTranslation unit times:\n";
+    os << "  " << llvm::left_justify("phase", 32)
+       << llvm::right_justify("wall (s)", 11)
+       << llvm::right_justify("cpu (s)", 11) << "\n";
+
+    std::string unit;
+    for (auto &unitTime : getUnitTimesByUnit()) {
+      if (unitTime.unit != unit) {
+        unit = unitTime.unit;
+        os << "  " << unit << "\n";
+      }
+      os << "    " << llvm::left_justify(unitTime.phase, 30)
+         << llvm::format(" %10.4f %10.4f\n", unitTime.wall, unitTime.cpu);
+    }
+  }
+
+  if (!matchCounts.empty()) {
+    os << "\nMatches:\n";
+    for (auto &matchCount : matchCounts)
+      os << "  " << llvm::left_justify(matchCount.first, 32)
+         << llvm::format(" %10llu\n", (unsigned long long)matchCount.second);
+  }
+
+  if (!outputFiles.empty()) {
+    os << "\nOutput files:\n";
+    os << "  " << llvm::left_justify("file", 32)
+       << llvm::right_justify("bytes", 11)
+       << llvm::right_justify("rewrites", 11) << "\n";
+    for (auto &outputFile : outputFiles)
+      os << "  " << llvm::left_justify(outputFile.first, 32)
+         << llvm::format(" %10llu %10u\n",
+                         (unsigned long long)outputFile.second.bytes,
+                         outputFile.second.rewrites);
+  }
+
+  auto peakRSS = getPeakResidentSetSize();
+  if (peakRSS > 0)
+    os << llvm::format("\nPeak RSS: %.2f MB\n", peakRSS / (1024.0 * 1024));
+}
+
+void printJSONString(llvm::raw_ostream &os, const std::string &str) {
+  os << "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      os << "\\" << c;
+    else if ((unsigned char)c < 0x20)
+      os << llvm::format("\\u%04x", (unsigned)c);
+    else
+      os << c;
+  }
+  os << "\"";
+}
+
+void printStatisticsAsJSON(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+
+  os << "{\n  \"phases\": [";
+  for (size_t i = 0; i < phaseOrder.size(); i++) {
+    auto &phaseTime = phaseTimes[phaseOrder[i]];
+    os << (i > 0 ? ",\n" : "\n") << "    {\"name\": ";
+    printJSONString(os, phaseOrder[i]);
+    os << llvm::format(", \"wall\": %.6f, \"cpu\": %.6f, \"runs\": %u, ",
+                       phaseTime.time.getWallTime(),
+                       phaseTime.time.getProcessTime(), phaseTime.count)
+       << "\"bytes\": " << phaseTime.bytes << "}";
+  }
+  os << "\n  ],\n";
+
+  os << "  \"translationUnits\": [";
+  std::string unit;
+  for (auto &unitTime : getUnitTimesByUnit()) {
+    if (unitTime.unit != unit) {
+      os << (unit != "" ? "\n    ]},\n" : "\n") << "    {\"name\": ";
+      printJSONString(os, unitTime.unit);
+      os << ", \"phases\": [\n";
+      unit = unitTime.unit;
+    } else {
+      os << ",\n";
+    }
+    os << "      {\"name\": ";
+    printJSONString(os, unitTime.phase);
+    os << llvm::format(", \"wall\": %.6f, \"cpu\": %.6f}", unitTime.wall,
+                       unitTime.cpu);
+  }
+  os << (unit != "" ? "\n    ]}" : "") << "\n  ],\n";
+
+  os << "  \"matches\": {";
+  bool first = true;
+  for (auto &matchCount : matchCounts) {
+    os << (first ? "\n" : ",\n") << "    ";
+    printJSONString(os, matchCount.first);
+    os << ": " << matchCount.second;
+    first = false;
+  }
+  os << "\n  },\n";
+
+  os << "  \"outputFiles\": [";
+  first = true;
+  for (auto &outputFile : outputFiles) {
+    os << (first ? "\n" : ",\n") << "    {\"name\": ";
+    printJSONString(os, outputFile.first);
+    os << ", \"bytes\": " << outputFile.second.bytes
+       << ", \"rewrites\": " << outputFile.second.rewrites << "}";
+    first = false;
+  }
+  os << "\n  ],\n";
+
+  os << "  \"peakRSS\": " << getPeakResidentSetSize() << "\n}\n";
+}
+
+void resetStatistics() {
+  std::lock_guard<std::mutex> lock(phaseTimesMutex);
+  phaseTimes.clear();
+  phaseOrder.clear();
+  unitTimes.clear();
+  matchCounts.clear();
+  outputFiles.clear();
+}
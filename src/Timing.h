@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Vanya Yaneva, The University of Edinburgh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+// Measures the wall and CPU time of a code generation phase.
+// Times of phases with the same name are accumulated, so a phase which runs
+// once per translation unit is reported as a single line.
+// If a unit (eg. the translation unit) is given, the time is reported for that
+// unit separately instead, using the CPU time of the calling thread, so that
+// units processed in parallel do not count each other's time.
+class PhaseTimer {
+private:
+  std::string phase;
+  std::string unit;
+  llvm::TimeRecord startTime;
+  double startThreadTime;
+  bool running;
+
+public:
+  PhaseTimer(const std::string &phase, const std::string &unit = "",
+             bool startNow = true);
+  ~PhaseTimer();
+
+  void start();
+  void stop();
+};
+
+// record the number of source bytes processed by a phase (for throughput)
+void addPhaseBytes(const std::string &phase, uint64_t bytes);
+
+// record how many times the matcher of a handler matched
+void addMatchCount(const std::string &handler, uint64_t count);
+
+// record a generated file, by its path, so that the files of different
+// programs are kept apart, with the number of rewrites it was made with
+void addOutputFile(const std::string &filename, uint64_t bytes,
+                   unsigned rewrites = 0);
+
+// print the accumulated times of all phases (in the order they first ran),
+// the times of each unit, the match counts, the output files and the peak
+// memory use
+void printStatistics(llvm::raw_ostream &os);
+
+// print the same as JSON, for processing by other tools
+void printStatisticsAsJSON(llvm::raw_ostream &os);
+
+// forget all the statistics (except the peak memory use, which is per process)
+void resetStatistics();
+
+#endif
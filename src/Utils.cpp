@@ -14,8 +14,14 @@
  * limitations under the License.
  */
 
+#include "Utils.h"
+#include "Constants.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <streambuf>
@@ -39,6 +45,381 @@ std::string read_file(std::string filename) {
   return str;
 }
 
+// Writes into a temporary file first, so that other runs never see a
+// partially written file. Returns true if the file was written.
+bool writeFileAtomically(const std::string &filename,
+                         const std::string &contents) {
+  llvm::SmallString<256> tempFilename;
+  if (llvm::sys::fs::createUniqueFile(filename + "-%%%%%%.tmp", tempFilename))
+    return false;
+
+  std::ofstream file(tempFilename.str().str());
+  file << contents;
+  file.close();
+  if (!file || llvm::sys::fs::rename(tempFilename, filename)) {
+    llvm::sys::fs::remove(tempFilename);
+    return false;
+  }
+  return true;
+}
+
+// Writes the contents into the file, unless the file already has exactly these
+// contents, so that its modification time only changes when the contents do.
+// Returns true if the file was written.
+bool writeFileIfChanged(const std::string &filename,
+                        const std::string &contents) {
+  std::ifstream existingFile(filename);
+  if (existingFile.is_open()) {
+    existingFile.seekg(0, std::ios::end);
+    if (existingFile.tellg() == (std::streamoff)contents.size()) {
+      existingFile.seekg(0, std::ios::beg);
+      std::string existingContents;
+      existingContents.assign(std::istreambuf_iterator<char>(existingFile),
+                              std::istreambuf_iterator<char>());
+      if (existingContents == contents)
+        return false;
+    }
+    existingFile.close();
+  }
+
+  std::ofstream file(filename);
+  file << contents;
+  file.close();
+  return true;
+}
+
+// Like the above, but the contents are streamed into the file by `write`, so
+// that they are never held in memory as a whole. They are written into a
+// temporary file next to the file, which replaces it only if they differ.
+bool writeFileIfChanged(
+    const std::string &filename,
+    const std::function<void(llvm::raw_ostream &)> &write) {
+  int fd;
+  llvm::SmallString<256> tempFilename;
+  if (llvm::sys::fs::createUniqueFile(filename + "-%%%%%%.tmp", fd,
+                                      tempFilename)) {
+    llvm::errs() << "Could not write " << filename << ".\n";
+    return false;
+  }
+
+  {
+    llvm::raw_fd_ostream tempFile(fd, true);
+    write(tempFile);
+    tempFile.close();
+    if (tempFile.has_error()) {
+      tempFile.clear_error();
+      llvm::sys::fs::remove(tempFilename);
+      llvm::errs() << "Could not write " << filename << ".\n";
+      return false;
+    }
+  }
+
+  uint64_t existingSize, newSize;
+  if (!llvm::sys::fs::file_size(filename, existingSize) &&
+      !llvm::sys::fs::file_size(tempFilename, newSize) &&
+      existingSize == newSize) {
+    auto existingFile = llvm::MemoryBuffer::getFile(filename);
+    auto newFile = llvm::MemoryBuffer::getFile(tempFilename);
+    if (existingFile && newFile &&
+        (*existingFile)->getBuffer() == (*newFile)->getBuffer()) {
+      llvm::sys::fs::remove(tempFilename);
+      return false;
+    }
+  }
+
+  if (llvm::sys::fs::rename(tempFilename, filename)) {
+    llvm::sys::fs::remove(tempFilename);
+    llvm::errs() << "Could not write " << filename << ".\n";
+    return false;
+  }
+  return true;
+}
+
+struct Declaration getIntDeclaration(const std::string &name) {
+  struct Declaration declaration;
+  declaration.type = "int";
+  declaration.name = name;
+  declaration.isArray = false;
+  declaration.isConst = false;
+  declaration.isPointer = false;
+  return declaration;
+}
+
+bool isVariableLength(const struct Declaration &declaration) {
+  return declaration.isPointer ||
+         (declaration.isArray &&
+          declaration.size.find_first_not_of("0123456789") !=
+              std::string::npos);
+}
+
+std::list<struct Declaration>
+getInputFields(const std::list<struct Declaration> &inputs,
+               const std::list<struct Declaration> &stdinInputs) {
+  std::list<struct Declaration> fields;
+  fields.push_back(getIntDeclaration(structs_constants::TEST_CASE_NUM));
+  fields.push_back(getIntDeclaration(structs_constants::ARGC));
+  fields.insert(fields.end(), inputs.begin(), inputs.end());
+  fields.insert(fields.end(), stdinInputs.begin(), stdinInputs.end());
+  return fields;
+}
+
+// In the ABI safe layout, stores the fields in fixed width types, and orders
+// them from the most aligned, so that there is no padding between them.
+// Pointers keep their type, as they can not be shared with the device anyway.
+void applyLayout(std::list<struct Declaration> &fields,
+                 const BufferOptions &options) {
+  if (!options.abiSafeLayout)
+    return;
+
+  for (auto &field : fields) {
+    if (!field.isPointer && getFixedWidthType(field.type) != "")
+      field.type = getFixedWidthType(field.type);
+  }
+
+  // the sort is stable, so fields with the same alignment keep their order
+  fields.sort([](const struct Declaration &field1,
+                 const struct Declaration &field2) {
+    unsigned size1 = 0, alignment1 = 0, size2 = 0, alignment2 = 0;
+    getFieldLayout(field1, size1, alignment1);
+    getFieldLayout(field2, size2, alignment2);
+    return alignment1 > alignment2;
+  });
+}
+
+std::list<struct Declaration>
+getStoredInputFields(const std::list<struct Declaration> &inputs,
+                     const std::list<struct Declaration> &stdinInputs,
+                     const BufferOptions &options) {
+  std::list<struct Declaration> storedFields;
+  for (auto field : getInputFields(inputs, stdinInputs)) {
+    if (options.packedInputs && isVariableLength(field)) {
+      storedFields.push_back(
+          getIntDeclaration(field.name + structs_constants::OFFSET_SUFFIX));
+      storedFields.push_back(
+          getIntDeclaration(field.name + structs_constants::LENGTH_SUFFIX));
+      continue;
+    }
+
+    if (field.storageType != "")
+      field.type = field.storageType;
+    storedFields.push_back(field);
+  }
+  applyLayout(storedFields, options);
+  return storedFields;
+}
+
+bool canCompileTests(const std::list<struct Declaration> &inputs,
+                     const std::list<struct Declaration> &stdinInputs,
+                     const BufferOptions &options) {
+  auto fields = getStoredInputFields(inputs, stdinInputs, options);
+  return std::none_of(fields.begin(), fields.end(),
+                      [](const struct Declaration &field) {
+                        return field.isPointer && !isStoredAsArray(field);
+                      });
+}
+
+bool hasInputView(const std::list<struct Declaration> &inputs, bool packed) {
+  return packed ||
+         std::any_of(inputs.begin(), inputs.end(),
+                     [](const struct Declaration &input) {
+                       return input.storageType != "";
+                     });
+}
+
+std::list<struct Declaration>
+getResultFields(const std::list<struct ResultDeclaration> &results) {
+  std::list<struct Declaration> fields;
+  fields.push_back(getIntDeclaration(structs_constants::TEST_CASE_NUM));
+  for (auto &result : results)
+    fields.push_back(result.declaration);
+  return fields;
+}
+
+std::list<struct Declaration>
+getStoredResultFields(const std::list<struct ResultDeclaration> &results,
+                      const BufferOptions &options) {
+  auto storedFields = getResultFields(results);
+  applyLayout(storedFields, options);
+  return storedFields;
+}
+
+bool isStoredAsArray(const struct Declaration &declaration) {
+  if (declaration.isPointer)
+    return declaration.capacity > 0;
+
+  return declaration.isArray;
+}
+
+std::string getArraySize(const struct Declaration &declaration) {
+  if (declaration.capacity > 0)
+    return std::to_string(declaration.capacity);
+
+  if (declaration.size.find_first_not_of("0123456789") != std::string::npos)
+    return std::to_string(structs_constants::POINTER_ARRAY_SIZE);
+
+  return declaration.size;
+}
+
+const std::vector<struct ConfigType> &getConfigTypes() {
+  // bool is not allowed in the kernel arguments, and the host char is kept for
+  // the string functions (it has the same size as cl_char everywhere)
+  static const std::vector<struct ConfigType> configTypes = {
+      {"bool", "uchar", "cl_uchar", 1},    {"char", "char", "char", 1},
+      {"short", "short", "cl_short", 2},   {"int", "int", "cl_int", 4},
+      {"float", "float", "cl_float", 4},   {"long", "long", "cl_long", 8},
+      {"double", "double", "cl_double", 8}};
+  return configTypes;
+}
+
+std::string getFixedWidthType(const std::string &type) {
+  for (auto &configType : getConfigTypes()) {
+    if (type == configType.name)
+      return std::string("partecl_") + configType.name;
+  }
+  return "";
+}
+
+unsigned getTypeSize(const std::string &type) {
+  for (auto &configType : getConfigTypes()) {
+    if (type == configType.name)
+      return configType.size;
+  }
+  return 4;
+}
+
+bool getFieldLayout(const struct Declaration &field, unsigned &size,
+                    unsigned &alignment) {
+  if (field.isPointer && !isStoredAsArray(field)) {
+    size = alignment = 8;
+    return true;
+  }
+
+  unsigned typeSize = 0;
+  for (auto &configType : getConfigTypes()) {
+    if (field.type == configType.name ||
+        field.type == getFixedWidthType(configType.name))
+      typeSize = configType.size;
+  }
+  for (auto &storageType : getStorageTypes()) {
+    if (field.type == storageType.name)
+      typeSize = storageType.size;
+  }
+  if (typeSize == 0)
+    return false;
+
+  size = alignment = typeSize;
+  if (isStoredAsArray(field))
+    size *= std::stoul(getArraySize(field));
+  return true;
+}
+
+const std::vector<struct StorageType> &getStorageTypes() {
+  static const std::vector<struct StorageType> storageTypes = {
+      {"partecl_uint8", "uchar", "uint8_t", 0, 255, 1},
+      {"partecl_int8", "char", "int8_t", -128, 127, 1},
+      {"partecl_uint16", "ushort", "uint16_t", 0, 65535, 2},
+      {"partecl_int16", "short", "int16_t", -32768, 32767, 2}};
+  return storageTypes;
+}
+
+std::string getFieldType(const struct Declaration &declaration) {
+  if (declaration.isPointer && !isStoredAsArray(declaration))
+    return declaration.type + "*";
+
+  return declaration.type;
+}
+
+std::string getFieldCopy(const struct Declaration &field,
+                         const std::string &structRef,
+                         const std::string &bufferRef, const std::string &index,
+                         bool toBuffer, const std::string &indent) {
+  std::string structField = structRef + field.name;
+  std::string bufferField = bufferRef + field.name + "[" + index;
+  std::string copy;
+  if (isStoredAsArray(field)) {
+    auto size = getArraySize(field);
+    // the index may itself be named i
+    structField += "[el]";
+    bufferField += " * " + size + " + el]";
+    copy = indent + "for(int el = 0; el < " + size + "; el++)\n  ";
+  } else {
+    bufferField += "]";
+  }
+
+  if (toBuffer)
+    return copy + indent + bufferField + " = " + structField + ";\n";
+  return copy + indent + structField + " = " + bufferField + ";\n";
+}
+
+std::string
+getResultChecks(const std::list<struct ResultDeclaration> &resultDecls,
+                const ResultElement &result, const ResultElement &expected,
+                const std::string &flag) {
+  std::string checks;
+  for (auto &resultDecl : resultDecls) {
+    auto &field = resultDecl.declaration;
+    if (field.isPointer && !isStoredAsArray(field))
+      continue;
+
+    std::string differs = result(field, "el") + " != " + expected(field, "el");
+    if (field.type == "float" || field.type == "double")
+      differs = "fabs(" + result(field, "el") + " - " + expected(field, "el") +
+                ") > PARTECL_TOLERANCE";
+
+    if (!isStoredAsArray(field)) {
+      checks += "  if(" + differs + ")\n";
+      checks += "    " + flag + " = 0;\n";
+      continue;
+    }
+
+    std::string bound = getArraySize(field);
+    for (auto &sizeDecl : resultDecls) {
+      if (sizeDecl.declaration.name == field.size)
+        bound += " && el < " + expected(sizeDecl.declaration, "el");
+    }
+    checks += "  for(int el = 0; el < " + bound + "; el++)\n";
+    checks += "  {\n";
+    checks += "    if(" + differs + ")\n";
+    checks += "    {\n";
+    checks += "      " + flag + " = 0;\n";
+    checks += "      break;\n";
+    checks += "    }\n";
+    if (field.type == "char")
+      checks += "    if(" + expected(field, "el") + " == '\\0')\n" +
+                "      break;\n";
+    checks += "  }\n";
+  }
+  return checks;
+}
+
+thread_local llvm::raw_ostream *messageStream = nullptr;
+
+llvm::raw_ostream &messages() {
+  return messageStream ? *messageStream : llvm::outs();
+}
+
+MessageRedirect::MessageRedirect(llvm::raw_ostream &os)
+    : previous(messageStream) {
+  messageStream = &os;
+}
+
+MessageRedirect::~MessageRedirect() { messageStream = previous; }
+
+// add a field to the hash; fields are separated, so that moving text from one
+// field to the next changes the hash
+void addToHash(llvm::MD5 &hash, llvm::StringRef field) {
+  hash.update(field);
+  hash.update(llvm::StringRef("\0", 1));
+}
+
+std::string getHashAsString(llvm::MD5 &hash) {
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> resultString;
+  llvm::MD5::stringifyResult(result, resultString);
+  return std::string(resultString.str());
+}
+
 std::string getDeclAsString(clang::Decl *decl, clang::Rewriter rewriter) {
   clang::SourceRange declRange = decl->getSourceRange();
   std::string declString;
@@ -19,13 +19,39 @@
 
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include <functional>
+#include <list>
+#include <map>
 #include <string>
+#include <vector>
 
 bool contains(const std::string &, const std::string &);
 std::string read_file(std::string filename);
+bool writeFileAtomically(const std::string &, const std::string &);
+bool writeFileIfChanged(const std::string &, const std::string &);
+bool writeFileIfChanged(const std::string &,
+                        const std::function<void(llvm::raw_ostream &)> &);
+void addToHash(llvm::MD5 &, llvm::StringRef);
+std::string getHashAsString(llvm::MD5 &);
 std::string getDeclAsString(clang::Decl *, clang::Rewriter);
 std::string getStmtAsString(clang::Stmt *, clang::Rewriter);
 
+// Messages about the code generation go to llvm::outs(), unless the calling
+// thread redirects them, eg. to keep apart the messages of programs which are
+// generated in parallel
+llvm::raw_ostream &messages();
+
+class MessageRedirect {
+private:
+  llvm::raw_ostream *previous;
+
+public:
+  MessageRedirect(llvm::raw_ostream &os);
+  ~MessageRedirect();
+};
+
 enum class TestedValueType { functionCall, variable };
 
 static struct TestedValue {
@@ -42,6 +68,12 @@ static struct Declaration {
   bool isConst;
   bool isPointer;
   std::string size; // set to empty when not array
+  // the number of elements to store a variable length input in, when it is
+  // known from the tests; 0 otherwise
+  int capacity = 0;
+  // a narrower type to store the input in, when its values are known from the
+  // tests; empty otherwise
+  std::string storageType;
 } Declaration;
 
 static struct ResultDeclaration {
@@ -49,6 +81,165 @@ static struct ResultDeclaration {
   struct TestedValue testedValue;
 } ResultValue;
 
+// How the inputs or the results of the test cases are laid out in the buffers
+// passed to the kernel: an array of structs, with a struct for each test case,
+// or a struct of arrays, with a buffer for each field, where the values of
+// adjacent test cases are next to each other
+enum class BufferLayout { arrayOfStructs, structOfArrays };
+
+// How the test inputs and results are passed to the kernel
+struct BufferOptions {
+  BufferLayout inputLayout = BufferLayout::arrayOfStructs;
+  BufferLayout resultLayout = BufferLayout::arrayOfStructs;
+  // store the variable length inputs in a shared arena, as an offset and a
+  // length, instead of in fixed size arrays
+  bool packedInputs = false;
+  // store the fields in fixed width types, ordered by their alignment, and
+  // check that the host and the device lay out the structs the same way
+  bool abiSafeLayout = false;
+  // read the inputs in place, through a __global const pointer, instead of
+  // copying them into private memory; only the inputs which the program
+  // writes to are copied (array of structs inputs only)
+  bool globalInputs = false;
+  // compare the results with the expected ones on the device, in a kernel of
+  // their own
+  bool compareOnDevice = false;
+  // compare the results with the expected ones at the end of the kernel, and
+  // write only the failing ones to the front of the results buffer (array of
+  // structs results only)
+  bool compactResults = false;
+};
+
+// Which host code is generated besides populate_inputs and compare_results;
+// none of it changes what the kernel is passed
+struct HostCodeOptions {
+  // copy the inputs which are strings into an arena given by the caller of
+  // populate_inputs, which frees the whole batch at once, instead of
+  // allocating each of them on its own
+  bool hostArena = false;
+  // also generate a tool which compiles a tests file into a binary file of
+  // partecl_input records, and a loader which maps that file into memory
+  // (array of structs inputs only)
+  bool binaryTests = false;
+  // also generate a parser which reads tests files straight into
+  // partecl_input records (array of structs inputs only)
+  bool testsParser = false;
+  // also generate populate_inputs_parallel, which parses a tests file with
+  // that parser on several threads
+  bool parallelTests = false;
+  // also generate a host program which runs the tests file through the
+  // kernel in batches, overlapping the parsing, the copies and the kernels
+  // (array of structs inputs and results only)
+  bool hostDriver = false;
+};
+
+// inputs which are pointers, or arrays whose size is not a number
+bool isVariableLength(const struct Declaration &);
+
+// the fields of the input and the result structs, in order
+std::list<struct Declaration>
+getInputFields(const std::list<struct Declaration> &inputs,
+               const std::list<struct Declaration> &stdinInputs);
+
+// the fields of the input struct as it is stored in the buffers: in their
+// storage type, and when packed, with each variable length input replaced by
+// its offset and length in the arena
+std::list<struct Declaration>
+getStoredInputFields(const std::list<struct Declaration> &inputs,
+                     const std::list<struct Declaration> &stdinInputs,
+                     const BufferOptions &options);
+
+// whether the stored inputs can be written to a file as they are, ie. none of
+// them is a pointer
+bool canCompileTests(const std::list<struct Declaration> &inputs,
+                     const std::list<struct Declaration> &stdinInputs,
+                     const BufferOptions &options);
+
+// whether the inputs are stored differently than they are declared, so that
+// the kernel unpacks them into a partecl_input_view
+bool hasInputView(const std::list<struct Declaration> &inputs, bool packed);
+std::list<struct Declaration>
+getResultFields(const std::list<struct ResultDeclaration> &results);
+
+// the fields of the result struct as it is stored in the buffers
+std::list<struct Declaration>
+getStoredResultFields(const std::list<struct ResultDeclaration> &results,
+                      const BufferOptions &options);
+
+// fields which are stored as arrays in the structs: arrays, and strings with a
+// capacity
+bool isStoredAsArray(const struct Declaration &);
+
+// the number of elements of an array; arrays whose size is not a number get
+// their capacity, or a fixed size
+std::string getArraySize(const struct Declaration &);
+
+// A type which can be given in the config; in the ABI safe layout, it is
+// stored in a fixed width typedef in structs.h, named "partecl_" and the type
+struct ConfigType {
+  const char *name;
+  const char *deviceType;
+  const char *hostType;
+  unsigned size;
+};
+
+const std::vector<struct ConfigType> &getConfigTypes();
+
+// the name of the fixed width typedef of a type given in the config
+std::string getFixedWidthType(const std::string &type);
+
+// the size in bytes of a value of a type given in the config (types which are
+// not known are taken to be ints)
+unsigned getTypeSize(const std::string &type);
+
+// the size and the alignment in bytes of a field of the input or the result
+// struct on a 64 bit host; false if the size of its type is not known
+bool getFieldLayout(const struct Declaration &field, unsigned &size,
+                    unsigned &alignment);
+
+// A narrower integer type, which inputs can be stored in; it is a typedef in
+// structs.h, for the device type in the kernel and the host type in the CPU
+// code
+struct StorageType {
+  const char *name;
+  const char *deviceType;
+  const char *hostType;
+  long min;
+  long max;
+  unsigned size;
+};
+
+// the storage types, from the narrowest
+const std::vector<struct StorageType> &getStorageTypes();
+
+// the type of the elements of the buffer of a field, in the struct of arrays
+// layout
+std::string getFieldType(const struct Declaration &);
+
+// Returns code which copies a field between a struct and its buffer in the
+// struct of arrays layout (in the direction given by `toBuffer`), eg. between
+// "input->" and "inputs->" for the test case "idx". The elements of an array
+// are next to each other, for each test case in turn.
+std::string getFieldCopy(const struct Declaration &field,
+                         const std::string &structRef,
+                         const std::string &bufferRef, const std::string &index,
+                         bool toBuffer, const std::string &indent);
+
+// Returns code which an element of a field of a result (the index of the
+// element is given for arrays), eg. "results[idx].sum"
+typedef std::function<std::string(const struct Declaration &field,
+                                  const std::string &el)>
+    ResultElement;
+
+// Returns code which sets `flag` to 0 if any of the results differs from the
+// expected one. Arrays whose size is another result are compared up to the
+// expected size, strings up to the terminating character, and floating point
+// results may differ by PARTECL_TOLERANCE. Pointers are not compared.
+std::string
+getResultChecks(const std::list<struct ResultDeclaration> &resultDecls,
+                const ResultElement &result, const ResultElement &expected,
+                const std::string &flag);
+
 static std::map<std::string, std::string> functionToHeaderFile = {
     {"isalnum", "cl-ctype.h"},  {"isalpha", "cl-ctype.h"},
     {"isascii", "cl-ctype.h"},  {"iscntrl", "cl-ctype.h"},
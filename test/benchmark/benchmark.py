@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Vanya Yaneva, The University of Edinburgh
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Runs partecl-codegen on synthetic programs (see generate.py), growing one
+# dimension at a time from a baseline program, and records the time of every
+# phase and the peak memory use of each run in a CSV file.
+#
+# For every dimension, it also estimates how the total time grows with it
+# (time ~ size^k) and warns when it grows faster than linearly.
+#
+# usage: benchmark.py [options]
+
+import argparse
+import csv
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import generate
+
+DIMENSIONS = ["functions", "globals", "depth", "inputs", "stdin", "results",
+              "files"]
+
+
+def run(codegen, outdir, program, jobs):
+    sources = generate.generate(outdir, program["functions"],
+                                program["globals"], program["depth"],
+                                program["inputs"], program["stdin"],
+                                program["results"], program["files"])
+    kernel_dir = os.path.join(outdir, "kernel-gen")
+    os.makedirs(kernel_dir, exist_ok=True)
+    stats = os.path.join(outdir, "stats.json")
+
+    command = [codegen] + sources + [
+        "-config", os.path.join(outdir, "bench.config"), "-output", kernel_dir,
+        "-no-cache", "-j", str(jobs), "-stats-json", stats, "--"
+    ]
+    result = subprocess.run(command, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout)
+        sys.exit("partecl-codegen failed: " + " ".join(command))
+
+    with open(stats) as f:
+        return json.load(f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-codegen", default=os.path.expanduser(
+        "~/clang-llvm/build/bin/partecl-codegen"),
+        help="the partecl-codegen executable")
+    parser.add_argument("-output", default="benchmark.csv",
+                        help="the CSV file to write the results to")
+    parser.add_argument("-dimensions", default=",".join(DIMENSIONS),
+                        help="comma separated dimensions to grow")
+    parser.add_argument("-scales", default="1,2,4,8,16",
+                        help="comma separated factors to grow them by")
+    parser.add_argument("-repeat", type=int, default=3,
+                        help="runs of each program; the fastest one is kept")
+    parser.add_argument("-j", type=int, default=1, dest="jobs",
+                        help="passed on to partecl-codegen")
+    parser.add_argument("-max-exponent", type=float, default=1.3,
+                        help="warn if the time grows faster than size^k")
+    generate.add_arguments(parser)
+    args = parser.parse_args()
+
+    baseline = {dimension: getattr(args, dimension)
+                for dimension in DIMENSIONS}
+    scales = [int(scale) for scale in args.scales.split(",")]
+    workdir = tempfile.mkdtemp(prefix="partecl-benchmark-")
+
+    rows = []
+    superlinear = []
+    try:
+        for dimension in args.dimensions.split(","):
+            totals = []
+            for scale in scales:
+                program = dict(baseline)
+                program[dimension] = max(1, baseline[dimension]) * scale
+                # the chains have to fit into the functions
+                if dimension == "depth":
+                    program["functions"] = max(program["functions"],
+                                               program["depth"])
+
+                runs = []
+                for _ in range(args.repeat):
+                    outdir = os.path.join(workdir, "%s-%d" % (dimension, scale))
+                    shutil.rmtree(outdir, ignore_errors=True)
+                    runs.append(run(args.codegen, outdir, program, args.jobs))
+                    shutil.rmtree(outdir, ignore_errors=True)
+
+                def total(stats):
+                    return sum(phase["wall"] for phase in stats["phases"]
+                               if not phase["name"].startswith("kernel:"))
+                stats = min(runs, key=total)
+                totals.append((program[dimension], total(stats)))
+
+                for phase in stats["phases"]:
+                    rows.append([dimension, program[dimension], phase["name"],
+                                 "%.6f" % phase["wall"], "%.6f" % phase["cpu"],
+                                 stats["peakRSS"]])
+                print("%-10s %6d: %8.3f s, %7.1f MB" %
+                      (dimension, program[dimension], total(stats),
+                       stats["peakRSS"] / (1024.0 * 1024)))
+
+            # fit time ~ size^k through the smallest and largest programs
+            (size1, time1), (size2, time2) = totals[0], totals[-1]
+            if size2 > size1 and time1 > 0 and time2 > 0:
+                exponent = math.log(time2 / time1) / math.log(size2 / size1)
+                print("%-10s time ~ size^%.2f" % (dimension, exponent))
+                if exponent > args.max_exponent:
+                    superlinear.append(dimension)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    with open(args.output, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["dimension", "size", "phase", "wall", "cpu",
+                         "peak_rss"])
+        writer.writerows(rows)
+    print("Results written to " + args.output)
+
+    if superlinear:
+        print("WARNING: the time grows faster than linearly with: " +
+              ", ".join(superlinear))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
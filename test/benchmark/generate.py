@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Vanya Yaneva, The University of Edinburgh
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Generates a synthetic C program, together with its config and a test case,
+# for benchmarking partecl-codegen.
+#
+# The functions form call chains of the given depth, which main calls from the
+# top. The function at the bottom of each chain uses its share of the globals
+# and of the reads from stdin. Every other global is also written to there, so
+# that every function in the chain gets it as a parameter; the rest are only
+# read, and stay in constant memory. Every third global is an array.
+#
+# usage: generate.py [options] <output dir>
+
+import argparse
+import os
+
+
+def generate(outdir, functions, globals_, depth, inputs, stdin, results,
+             files):
+    depth = max(1, min(depth, functions))
+    chains = max(1, functions // depth)
+    files = max(1, min(files, chains))
+    os.makedirs(outdir, exist_ok=True)
+
+    def function(chain, level):
+        return "f%d_%d" % (chain, level)
+
+    def global_use(var):
+        return "g%d[%d]" % (var, var % 4) if var % 3 == 2 else "g%d" % var
+
+    # the globals and stdin reads used by the bottom of each chain
+    chain_globals = [[] for _ in range(chains)]
+    for var in range(globals_):
+        chain_globals[var % chains].append(var)
+    chain_stdin = [0] * chains
+    for read in range(stdin):
+        chain_stdin[read % chains] += 1
+
+    sources = ["bench.c"] + ["bench%d.c" % i for i in range(1, files)]
+    with open(os.path.join(outdir, "bench.h"), "w") as f:
+        f.write("#ifndef BENCH_H\n#define BENCH_H\n\n")
+        for var in range(globals_):
+            f.write("extern int g%d%s;\n" % (var, "[4]" if var % 3 == 2 else ""))
+        f.write("\n")
+        for chain in range(chains):
+            for level in range(depth):
+                f.write("int %s(int x);\n" % function(chain, level))
+        f.write("\n#endif\n")
+
+    for i, source in enumerate(sources):
+        with open(os.path.join(outdir, source), "w") as f:
+            f.write("#include <stdio.h>\n#include <stdlib.h>\n")
+            f.write("#include \"bench.h\"\n\n")
+
+            if i == 0:
+                for var in range(globals_):
+                    if var % 3 == 2:
+                        f.write("int g%d[4] = {%d, %d, %d, %d};\n" %
+                                (var, var, var + 1, var + 2, var + 3))
+                    else:
+                        f.write("int g%d = %d;\n" % (var, var))
+                f.write("\n")
+
+            for chain in range(i, chains, files):
+                f.write("int %s(int x)\n{\n  int s = x;\n" % function(chain, 0))
+                for var in chain_globals[chain]:
+                    f.write("  s += %s;\n" % global_use(var))
+                for var in chain_globals[chain]:
+                    if var % 2 == 1:
+                        f.write("  %s++;\n" % global_use(var))
+                for _ in range(chain_stdin[chain]):
+                    f.write("  s += fgetc(stdin);\n")
+                f.write("  return s;\n}\n\n")
+
+                for level in range(1, depth):
+                    f.write("int %s(int x)\n{\n" % function(chain, level))
+                    f.write("  return %s(x + %d);\n}\n\n" %
+                            (function(chain, level - 1), level))
+
+            if i == 0:
+                f.write("int main(int argc, char* argv[])\n{\n")
+                f.write("  int sum = 0;\n")
+                for k in range(inputs):
+                    f.write("  int a%d = atoi(argv[%d]);\n" % (k, k + 1))
+                    f.write("  sum += a%d;\n" % k)
+                for r in range(results):
+                    f.write("  int r%d = %s(sum);\n" %
+                            (r, function(r % chains, depth - 1)))
+                f.write("  printf(\"%d\\n\", sum);\n}\n")
+
+    with open(os.path.join(outdir, "bench.config"), "w") as f:
+        for k in range(inputs):
+            f.write("input: int a%d %d\n" % (k, k + 1))
+        for read in range(stdin):
+            f.write("stdin: char stdin%d\n" % (read + 1))
+        for r in range(results):
+            f.write("result: int result%d variable: r%d\n" % (r, r))
+
+    with open(os.path.join(outdir, "tests.txt"), "w") as f:
+        values = [str(k + 1) for k in range(inputs)]
+        values += ["a"] * stdin
+        values += ["0"] * results
+        f.write("1 " + " ".join(values) + "\n")
+
+    return [os.path.join(outdir, source) for source in sources]
+
+
+def add_arguments(parser):
+    parser.add_argument("-functions", type=int, default=100,
+                        help="number of functions besides main (N)")
+    parser.add_argument("-globals", type=int, default=10,
+                        help="number of global variables (M)")
+    parser.add_argument("-depth", type=int, default=5,
+                        help="depth of the call chains (D)")
+    parser.add_argument("-inputs", type=int, default=4,
+                        help="number of argv inputs (K)")
+    parser.add_argument("-stdin", type=int, default=2,
+                        help="number of reads from stdin")
+    parser.add_argument("-results", type=int, default=4,
+                        help="number of results")
+    parser.add_argument("-files", type=int, default=1,
+                        help="number of source files")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__)
+    add_arguments(parser)
+    parser.add_argument("outdir")
+    args = parser.parse_args()
+    sources = generate(args.outdir, args.functions, args.globals, args.depth,
+                       args.inputs, args.stdin, args.results, args.files)
+    print(" ".join(sources))
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017 Vanya Yaneva, The University of Edinburgh
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Generates a program with a call chain of the given depth, where only the
+# function at the bottom of the chain uses a global variable, and writes to it.
+# Every other function reaches it through its callees, and each level also
+# calls itself, so the generated kernel shows whether the facts are propagated
+# all the way up to main, through recursive calls. The bottom of the chain also
+# reads another global, which is never written to, so it stays in constant
+# memory and is not passed to any function.
+#
+# usage: generate.py <depth> <output dir>
+
+import os
+import sys
+
+depth = int(sys.argv[1])
+outdir = sys.argv[2]
+os.makedirs(outdir, exist_ok=True)
+
+with open(os.path.join(outdir, "call-graph.c"), "w") as f:
+    f.write("#include <stdio.h>\n#include <stdlib.h>\n\n")
+    f.write("int g = 1;\nint c = 2;\n\n")
+    f.write("int f0(int a, int n)\n{\n  g += a;\n  return g + c;\n}\n\n")
+    for i in range(1, depth):
+        f.write("int f%d(int a, int n)\n{\n" % i)
+        f.write("  if(n > 0)\n    return f%d(a, n - 1);\n" % i)
+        f.write("  return f%d(a, 0) + 1;\n}\n\n" % (i - 1))
+    f.write("int main(int argc, char* argv[])\n{\n")
+    f.write("  int a = atoi(argv[1]);\n")
+    f.write("  int res = f%d(a, 1);\n}\n" % (depth - 1))
+
+with open(os.path.join(outdir, "call-graph.config"), "w") as f:
+    f.write("input: int a 1\n")
+    f.write("result: int result variable: res\n")
+
+with open(os.path.join(outdir, "tests.txt"), "w") as f:
+    f.write("1 %d\n" % (depth + 1))
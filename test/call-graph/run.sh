@@ -0,0 +1,30 @@
+#generate call chains of increasing depth, run ParTeCL on them and check that
+#the global written at the bottom of the chain reached the top of it, while the
+#global which is only read stayed in constant memory
+#usage: run.sh [depth ...]
+
+CODEGEN=${PARTECL_CODEGEN:-~/clang-llvm/build/bin/partecl-codegen}
+DIR=$(mktemp -d)
+DEPTHS=${@:-10 100 1000 5000}
+
+for depth in $DEPTHS; do
+  python3 $(dirname $0)/generate.py $depth $DIR/$depth
+  mkdir -p $DIR/$depth/out
+
+  start=$(date +%s.%N)
+  $CODEGEN $DIR/$depth/call-graph.c -config $DIR/$depth/call-graph.config \
+    -output $DIR/$depth/out -no-cache -- > $DIR/$depth/log.txt
+  end=$(date +%s.%N)
+
+  top=$((depth - 1))
+  if grep -q "int f$top(.*int \*g)" $DIR/$depth/out/*.cl &&
+    grep -q "__constant int c" $DIR/$depth/out/*.cl &&
+    ! grep -q "int f$top(.*[ *]c[,)]" $DIR/$depth/out/*.cl; then
+    result=OK
+  else
+    result=FAIL
+  fi
+  echo "depth $depth: $result ($(echo "$end - $start" | bc) s)"
+done
+
+rm -r $DIR
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// never written, so it stays in constant memory
+int table[16] = {0x0, 0x3, 0x6, 0x5, 0xc, 0xf, 0xa, 0x9,
+                 0xb, 0x8, 0xd, 0xe, 0x7, 0x4, 0x1, 0x2};
+int mask = 0xf;
+
+// written, so every work-item has its own copy
+int steps = 0;
+
+int crc4(int value)
+{
+  int crc = 0;
+  while(value > 0)
+  {
+    crc = table[(crc ^ value) & mask];
+    value >>= 4;
+    steps++;
+  }
+  return crc;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2)
+  {
+    printf("Please, provide an integer.\n");
+    return 0;
+  }
+
+  int value = atoi(argv[1]);
+  int crc = crc4(value);
+  printf("%d\n", crc);
+}
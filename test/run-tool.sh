@@ -1,6 +1,10 @@
 #run ParTeCL and copy the tests to the output dir
+#set PARTECL_CODEGEN and PARTECL_RUNTIME to use other locations
 
-rm -r ~/partecl-runtime/kernel-gen/
-mkdir ~/partecl-runtime/kernel-gen/
-~/clang-llvm/build/bin/partecl-codegen $1 -config $2 -output /home/vanya/partecl-runtime/kernel-gen/ --
-cp $3 ~/partecl-runtime/kernel-gen/tests.txt
+CODEGEN=${PARTECL_CODEGEN:-~/clang-llvm/build/bin/partecl-codegen}
+RUNTIME=${PARTECL_RUNTIME:-~/partecl-runtime}
+
+rm -r $RUNTIME/kernel-gen/
+mkdir $RUNTIME/kernel-gen/
+$CODEGEN $1 -config $2 -output $RUNTIME/kernel-gen/ --
+cp $3 $RUNTIME/kernel-gen/tests.txt